@@ -0,0 +1,849 @@
+/*********************************************************************
+ * abundance_estimation.cpp is used as part of the bracken_est program
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "abundance_estimation.h"
+#include <errno.h>
+#include <limits.h>
+
+static const char *MAIN_LVLS[] = {"R", "K", "D", "P", "C", "O", "F", "G", "S"};
+#define N_MAIN_LVLS 9
+
+/*METHOD: Position of a level code in R,K,D,P,C,O,F,G,S (or -1)*/
+static int main_lvl_index(const string &level_id) {
+    for (int i = 0; i < N_MAIN_LVLS; i++) {
+        if (level_id == MAIN_LVLS[i])
+            return i;
+    }
+    return -1;
+}
+
+/*METHOD: Whitespace as removed by Python's str.strip()*/
+static bool py_isspace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r') || (c >= '\x1c' && c <= '\x1f');
+}
+
+/*METHOD: Remove leading and trailing whitespace*/
+string py_strip(const string &s) {
+    size_t start = 0;
+    size_t end = s.size();
+    while (start < end && py_isspace(s[start]))
+        start++;
+    while (end > start && py_isspace(s[end - 1]))
+        end--;
+    return s.substr(start, end - start);
+}
+
+/*METHOD: Split on every occurrence of a delimiter (empty fields are kept)*/
+void py_split(const string &s, char delim, vector<string> &fields) {
+    fields.clear();
+    size_t start = 0;
+    while (true) {
+        size_t end = s.find(delim, start);
+        if (end == string::npos) {
+            fields.push_back(s.substr(start));
+            return;
+        }
+        fields.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+/*METHOD: Parse a decimal integer the way Python's int() does*/
+bool py_int(const string &s, long long &val) {
+    string t = py_strip(s);
+    size_t i = 0;
+    bool negative = false;
+    if (i < t.size() && (t[i] == '+' || t[i] == '-')) {
+        negative = (t[i] == '-');
+        i++;
+    }
+    if (i >= t.size() || !isdigit(t[i]))
+        return false;
+    long long v = 0;
+    for (; i < t.size(); i++) {
+        //Single underscores are allowed between digits
+        if (t[i] == '_' && i + 1 < t.size() && isdigit(t[i + 1]) && isdigit(t[i - 1]))
+            continue;
+        if (!isdigit(t[i]))
+            return false;
+        v = v * 10 + (t[i] - '0');
+    }
+    val = negative ? -v : v;
+    return true;
+}
+
+/*METHOD: Split a path into root and extension as os.path.splitext does*/
+void py_splitext(const string &path, string &base, string &extension) {
+    size_t sep = path.rfind('/');
+    size_t dot = path.rfind('.');
+    size_t name_start = (sep == string::npos) ? 0 : sep + 1;
+    base = path;
+    extension = "";
+    if (dot == string::npos || (sep != string::npos && dot < sep))
+        return;
+    //Leading dots of the file name do not start an extension
+    for (size_t i = name_start; i < dot; i++) {
+        if (path[i] != '.') {
+            base = path.substr(0, dot);
+            extension = path.substr(dot);
+            return;
+        }
+    }
+}
+
+/*METHOD: Split text into lines; \n, \r\n and \r all end a line*/
+void split_lines(const string &data, vector<string> &lines) {
+    lines.clear();
+    size_t start = 0;
+    while (start < data.size()) {
+        size_t end = data.find_first_of("\r\n", start);
+        if (end == string::npos) {
+            lines.push_back(data.substr(start));
+            break;
+        }
+        lines.push_back(data.substr(start, end - start));
+        start = end + 1;
+        if (data[end] == '\r' && start < data.size() && data[start] == '\n')
+            start += 1;
+    }
+}
+
+/*METHOD: Read all lines of a file*/
+bool read_lines(const string &file, vector<string> &lines) {
+    std::ifstream in(file.c_str(), std::ios::in | std::ios::binary);
+    if (!in.is_open())
+        return false;
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    split_lines(buffer.str(), lines);
+    return true;
+}
+
+/*METHOD: Parse a float the way Python's float() does for kmer counts*/
+static double py_float(const string &s) {
+    string t = py_strip(s);
+    char *end = NULL;
+    double v = strtod(t.c_str(), &end);
+    if (t.empty() || *end != '\0')
+        errx(1, "  could not convert string to float: '%s'", s.c_str());
+    return v;
+}
+
+/*METHOD: Parse a taxid as stored in the binary index (plain decimal, no sign or leading zeros)*/
+static bool index_taxid(const string &s, int &taxid) {
+    if (s.empty() || s.size() > 10 || (s[0] == '0' && s.size() > 1))
+        return false;
+    long long v = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (!isdigit(s[i]))
+            return false;
+        v = v * 10 + (s[i] - '0');
+    }
+    if (v > INT32_MAX)
+        return false;
+    taxid = (int) v;
+    return true;
+}
+
+/*METHOD: Parse a kmer count as stored in the binary index (decimal digits only)*/
+static bool index_count(const string &s, uint64_t &count) {
+    if (s.empty())
+        return false;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (!isdigit(s[i]))
+            return false;
+    }
+    errno = 0;
+    unsigned long long v = strtoull(s.c_str(), NULL, 10);
+    if (errno == ERANGE)
+        return false;
+    count = v;
+    return true;
+}
+
+/*METHOD: Load a kmer distribution file; optionally keep only the given
+ * mapped taxids and genomes. The binary index next to the file is used when
+ * it is current, and written after reading the text file otherwise.*/
+bool KmerDistrib::load(const string &file, const std::unordered_set<string> *mapped_filter, const std::unordered_set<string> *genome_filter, bool use_index) {
+    struct stat text_stat;
+    if (stat(file.c_str(), &text_stat) != 0)
+        return false;
+    string index_file = file + KMER_DISTRIB_INDEX_SUFFIX;
+    if (use_index) {
+        KmerDistribIndex index;
+        if (index.open(index_file, text_stat)) {
+            load_index(index, mapped_filter, genome_filter);
+            return true;
+        }
+    }
+    vector<string> file_lines;
+    if (!read_lines(file, file_lines))
+        return false;
+    //Rows of a new index, unless some line cannot be stored in one
+    bool indexable = use_index;
+    vector<int> row_taxids;
+    vector<uint64_t> row_offsets(1, 0);
+    vector<distrib_record> records;
+    vector<string> fields;
+    vector<string> genome_strs;
+    vector<string> vals;
+    //The first line is the header
+    for (size_t l = 1; l < file_lines.size(); l++) {
+        py_split(py_strip(file_lines[l]), '\t', fields);
+        const string &mapped_taxid = fields[0];
+        bool keep = (mapped_filter == NULL || mapped_filter->count(mapped_taxid) > 0);
+        int taxid = 0;
+        if (indexable && (fields.size() < 2 || !index_taxid(mapped_taxid, taxid)))
+            indexable = false;
+        if (!keep && !indexable)
+            continue;
+        if (fields.size() < 2)
+            errx(1, "  invalid line in %s: %s", file.c_str(), file_lines[l].c_str());
+        vector<distrib_genome> genomes;
+        py_split(fields[1], ' ', genome_strs);
+        for (size_t g = 0; g < genome_strs.size(); g++) {
+            py_split(genome_strs[g], ':', vals);
+            if (vals.size() != 3) {
+                if (keep)
+                    errx(1, "  invalid genome entry in %s: %s", file.c_str(), genome_strs[g].c_str());
+                indexable = false;
+                break;
+            }
+            if (indexable) {
+                distrib_record d;
+                int genome_taxid = 0;
+                d.reserved = 0;
+                if (index_taxid(vals[0], genome_taxid) && index_count(vals[1], d.kmers_mapped)
+                        && index_count(vals[2], d.total_kmers)) {
+                    d.genome_taxid = genome_taxid;
+                    records.push_back(d);
+                } else {
+                    indexable = false;
+                }
+            }
+            if (!keep || (genome_filter != NULL && genome_filter->count(vals[0]) == 0))
+                continue;
+            distrib_genome d;
+            d.taxid = vals[0];
+            double total_kmers = py_float(vals[2]);
+            if (total_kmers == 0)
+                errx(1, "  float division by zero (genome %s in %s)", vals[0].c_str(), file.c_str());
+            d.fraction = py_float(vals[1]) / total_kmers;
+            genomes.push_back(d);
+        }
+        if (indexable) {
+            row_taxids.push_back(taxid);
+            row_offsets.push_back(records.size());
+        }
+        if (keep)
+            this->lines[mapped_taxid].push_back(genomes);
+    }
+    if (indexable && !KmerDistribIndex::write(index_file, text_stat, row_taxids, row_offsets, records))
+        fprintf(stderr, "Warning: could not write kmer distribution index %s\n", index_file.c_str());
+    return true;
+}
+
+/*METHOD: Load the rows of the given mapped taxids (or all rows) from the index*/
+void KmerDistrib::load_index(const KmerDistribIndex &index, const std::unordered_set<string> *mapped_filter, const std::unordered_set<string> *genome_filter) {
+    if (mapped_filter == NULL) {
+        for (size_t r = 0; r < index.size(); r++)
+            add_row(index, r, genome_filter);
+        return;
+    }
+    for (auto it = mapped_filter->begin(); it != mapped_filter->end(); ++it) {
+        //Taxids the index cannot hold do not match any line
+        int taxid;
+        if (!index_taxid(*it, taxid))
+            continue;
+        size_t first, last;
+        index.find(taxid, first, last);
+        for (size_t r = first; r < last; r++)
+            add_row(index, r, genome_filter);
+    }
+}
+
+/*METHOD: Add one row of the index as a line*/
+void KmerDistrib::add_row(const KmerDistribIndex &index, size_t row, const std::unordered_set<string> *genome_filter) {
+    vector<distrib_genome> genomes;
+    for (const distrib_record *d = index.row_begin(row); d != index.row_end(row); d++) {
+        string genome_taxid = std::to_string(d->genome_taxid);
+        if (genome_filter != NULL && genome_filter->count(genome_taxid) == 0)
+            continue;
+        if (d->total_kmers == 0)
+            errx(1, "  float division by zero (genome %s)", genome_taxid.c_str());
+        distrib_genome g;
+        g.taxid = genome_taxid;
+        g.fraction = (double) d->kmers_mapped / (double) d->total_kmers;
+        genomes.push_back(g);
+    }
+    this->lines[std::to_string(index.row_taxid(row))].push_back(genomes);
+}
+
+/*METHOD: Lines listing the genomes of a mapped taxid, or NULL*/
+const vector<vector<distrib_genome>>* KmerDistrib::find(const string &mapped_taxid) const {
+    auto it = this->lines.find(mapped_taxid);
+    return (it == this->lines.end()) ? NULL : &it->second;
+}
+
+/*Constructor: estimation level (e.g. S, G, S1) and read threshold*/
+AbundanceEstimator::AbundanceEstimator(const string &level, const string &thresh) {
+    this->level = level;
+    this->level_name = level;
+    const char *lvl_codes[] = {"D", "P", "O", "C", "F", "G", "S"};
+    const char *lvl_names[] = {"domains", "phylums", "orders", "classes", "families", "genuses", "species"};
+    for (int i = 0; i < 7; i++) {
+        if (level == lvl_codes[i])
+            this->level_name = lvl_names[i];
+    }
+    long long val = 0;
+    this->branch = 0;
+    if (level.size() > 1) {
+        if (!py_int(level.substr(1), val))
+            errx(1, "  invalid level: %s", level.c_str());
+        this->branch = (int) val;
+    }
+    this->branch_lvl = level.empty() ? -1 : main_lvl_index(level.substr(0, 1));
+    if (this->branch_lvl < 0)
+        errx(1, "  invalid level: %s", level.c_str());
+    if (!py_int(thresh, val))
+        errx(1, "  invalid threshold: %s", thresh.c_str());
+    this->thresh = (int) val;
+    this->root = -1;
+    this->total_reads = 0;
+    this->kept_reads = 0;
+    this->ignored_reads = 0;
+    this->u_reads = 0;
+    this->n_lvl_total = 0;
+    this->n_lvl_est = 0;
+    this->n_lvl_del = 0;
+    this->distributed_reads = 0;
+    this->nondistributed_reads = 0;
+    this->sum_all_reads = 0;
+}
+
+string AbundanceEstimator::get_abundance_lvl() const {
+    return this->level_name;
+}
+
+bool AbundanceEstimator::has_reads() const {
+    return this->sum_all_reads != 0;
+}
+
+/*METHOD: Parse one report line: name, taxid, level number and type, reads*/
+static bool process_kraken_report(const string &line, report_node &node) {
+    vector<string> fields;
+    py_split(py_strip(line), '\t', fields);
+    if (fields.size() < 5)
+        return false;
+    long long all_reads, level_reads, val;
+    if (!py_int(fields[1], all_reads))
+        return false;
+    if (!py_int(fields[2], level_reads))
+        errx(1, "  invalid literal for int(): '%s'", fields[2].c_str());
+    size_t n = fields.size();
+    //Account for krakenuniq
+    if (py_int(fields[n - 3], val)) {
+        node.taxid = fields[n - 3];
+        const string &rank = fields[n - 2];
+        const char *kuniq_ranks[] = {"species", "genus", "family", "order", "class", "phylum", "superkingdom", "kingdom"};
+        const char *kuniq_codes[] = {"S", "G", "F", "O", "C", "P", "D", "K"};
+        node.level_id = "-";
+        for (int i = 0; i < 8; i++) {
+            if (rank == kuniq_ranks[i])
+                node.level_id = kuniq_codes[i];
+        }
+    } else {
+        node.level_id = fields[n - 3];
+        node.taxid = fields[n - 2];
+    }
+    //Get name and spaces
+    const string &name = fields[n - 1];
+    size_t spaces = 0;
+    while (spaces < name.size() && name[spaces] == ' ')
+        spaces++;
+    node.name = name.substr(spaces);
+    node.level_num = (int) (spaces / 2);
+    node.all_reads = (double) all_reads;
+    node.lvl_reads = level_reads;
+    node.parent = -1;
+    return true;
+}
+
+/*METHOD: Read a report file into a tree (false if it is not a Kraken report)*/
+bool AbundanceEstimator::read_report(const string &in_file) {
+    fprintf(stderr, ">> Checking report file: %s\n", in_file.c_str());
+    vector<string> lines;
+    if (!read_lines(in_file, lines))
+        err(1, "  cannot open %s", in_file.c_str());
+    if (lines.empty())
+        errx(1, "  empty report file: %s", in_file.c_str());
+    return parse_report(lines);
+}
+
+/*METHOD: Check the format of report lines, then build the tree (false if they are not a Kraken report)*/
+bool AbundanceEstimator::parse_report(const vector<string> &lines) {
+    if (lines.empty())
+        return false;
+    //Test for kraken output file
+    if (!lines[0].empty() && (lines[0][0] == 'C' || lines[0][0] == 'U')) {
+        fprintf(stderr, "\tERROR: Bracken does not use the Kraken default output.\n");
+        fprintf(stderr, "\t       Bracken requires the Kraken report file (--report option with Kraken)\n");
+        return false;
+    }
+    //Test for mpa style
+    vector<string> fields;
+    py_split(lines[0], '\t', fields);
+    if (fields.size() == 2) {
+        fprintf(stderr, "\tERROR: Bracken is not compatible with mpa-style reports.\n");
+        fprintf(stderr, "\t       Bracken requires the default Kraken report format\n");
+        return false;
+    }
+
+    /*Parse kraken report file and create tree*/
+    int prev_node = -1;
+    bool has_last = false;
+    string last_taxid;
+    for (size_t l = 0; l < lines.size(); l++) {
+        const string &line = lines[l];
+        //Error checking for krakenuniq output files
+        if (!line.empty() && (line[0] == '#' || line[0] == '%'))
+            continue;
+        report_node node;
+        if (!process_kraken_report(line, node))
+            continue;
+        this->total_reads += node.lvl_reads;
+        //Skip unclassified
+        if (node.level_id == "U" || node.name == "unclassified") {
+            this->u_reads = node.lvl_reads;
+            continue;
+        }
+        //Tree Root
+        if (node.taxid == "1") {
+            node.level_id = "R";
+            this->nodes.push_back(node);
+            this->root = (int) this->nodes.size() - 1;
+            prev_node = this->root;
+            continue;
+        }
+        if (prev_node < 0)
+            errx(1, "  report line found before the root: %s", line.c_str());
+        //Save leaf nodes
+        if (node.level_num != this->nodes[prev_node].level_num + 1)
+            this->leaf_nodes.push_back(prev_node);
+        //Move to correct parent
+        while (node.level_num != this->nodes[prev_node].level_num + 1) {
+            prev_node = this->nodes[prev_node].parent;
+            if (prev_node < 0)
+                errx(1, "  no parent found for report line: %s", line.c_str());
+        }
+        //Determine correct level ID
+        int test_branch = 0;
+        if (py_strip(node.level_id).empty())
+            node.level_id = "-";
+        if (node.level_id == "-" || node.level_id.size() > 1) {
+            const string &prev_id = this->nodes[prev_node].level_id;
+            if (main_lvl_index(prev_id) >= 0) {
+                node.level_id = prev_id + "1";
+                test_branch = 1;
+            } else {
+                char last = prev_id.empty() ? ' ' : prev_id[prev_id.size() - 1];
+                if (!isdigit(last))
+                    errx(1, "  invalid level in report: %s", prev_id.c_str());
+                int num = (last - '0') + 1;
+                test_branch = num;
+                node.level_id = prev_id.substr(0, prev_id.size() - 1) + std::to_string(num);
+            }
+        }
+        //Desired level for abundance estimation or below
+        if (node.level_id == this->level) {
+            this->n_lvl_total += 1;
+            //Account for threshold at level
+            if (node.all_reads < this->thresh) {
+                this->n_lvl_del += 1;
+                this->ignored_reads += (long long) node.all_reads;
+                has_last = false;
+            } else {
+                //If level contains enough reads - save for abundance estimation
+                this->n_lvl_est += 1;
+                this->kept_reads += (long long) node.all_reads;
+                lvl_entry &lvl = this->lvl_taxids[node.taxid];
+                lvl.name = node.name;
+                lvl.all_reads = (long long) node.all_reads;
+                lvl.lvl_reads = node.lvl_reads;
+                lvl.added_reads = 0;
+                has_last = true;
+                last_taxid = node.taxid;
+                map2lvl_entry &m = this->map2lvl_taxids[node.taxid];
+                m.lvl_taxid = node.taxid;
+                m.lvl_reads = node.lvl_reads;
+                m.add_reads = 0;
+            }
+        } else {
+            int lvl_index = main_lvl_index(node.level_id.substr(0, 1));
+            if (!(this->branch > 0 && test_branch > this->branch) && lvl_index < 0)
+                errx(1, "  invalid level in report: %s", node.level_id.c_str());
+            //For all nodes below the desired level
+            if ((this->branch > 0 && test_branch > this->branch) || lvl_index >= this->branch_lvl) {
+                if (has_last) {
+                    map2lvl_entry &m = this->map2lvl_taxids[node.taxid];
+                    m.lvl_taxid = last_taxid;
+                    m.lvl_reads = node.lvl_reads;
+                    m.add_reads = 0;
+                }
+            }
+        }
+        //Add node to tree
+        node.parent = prev_node;
+        this->nodes.push_back(node);
+        int curr_node = (int) this->nodes.size() - 1;
+        this->nodes[prev_node].children.push_back(curr_node);
+        prev_node = curr_node;
+    }
+    //Add last node
+    this->leaf_nodes.push_back(prev_node);
+    return true;
+}
+
+/*METHOD: Report taxids that may be looked up in the kmer distribution*/
+void AbundanceEstimator::get_needed_taxids(std::unordered_set<string> &mapped, std::unordered_set<string> &genomes) const {
+    for (size_t n = 0; n < this->nodes.size(); n++)
+        mapped.insert(this->nodes[n].taxid);
+    for (auto it = this->map2lvl_taxids.begin(); it != this->map2lvl_taxids.end(); ++it)
+        genomes.insert(it->first);
+    for (auto it = this->lvl_taxids.begin(); it != this->lvl_taxids.end(); ++it)
+        genomes.insert(it->first);
+}
+
+/*METHOD: Genomes of this sample mapping to a taxid (empty if none)*/
+const vector<distrib_genome>* AbundanceEstimator::get_distribution(const KmerDistrib &distrib, const string &mapped_taxid) {
+    auto cached = this->kmer_distr.find(mapped_taxid);
+    if (cached != this->kmer_distr.end())
+        return &cached->second;
+    vector<distrib_genome> &result = this->kmer_distr[mapped_taxid];
+    const vector<vector<distrib_genome>> *lines = distrib.find(mapped_taxid);
+    if (lines == NULL)
+        return &result;
+    //A later line for the same taxid replaces an earlier one
+    for (size_t l = 0; l < lines->size(); l++) {
+        vector<distrib_genome> temp;
+        std::unordered_set<string> seen;
+        for (size_t g = 0; g < (*lines)[l].size(); g++) {
+            const distrib_genome &d = (*lines)[l][g];
+            //Only include mappings for genomes within this sample
+            if (!this->lvl_taxids.contains(d.taxid) && !this->map2lvl_taxids.contains(d.taxid))
+                continue;
+            if (seen.insert(d.taxid).second)
+                temp.push_back(d);
+        }
+        if (!temp.empty())
+            result.swap(temp);
+    }
+    return &result;
+}
+
+/*METHOD: Distribute the reads of each node above the level to the genomes below it*/
+void AbundanceEstimator::estimate(const KmerDistrib &distrib) {
+    vector<int> curr_nodes;
+    if (this->root >= 0)
+        curr_nodes.push_back(this->root);
+    vector<std::pair<double, double>> probability_prelim;
+    for (size_t head = 0; head < curr_nodes.size(); head++) {
+        const report_node &curr_node = this->nodes[curr_nodes[head]];
+        //Do not redistribute level reads
+        if (curr_node.level_id == this->level)
+            continue;
+        //If above level, append
+        for (size_t c = 0; c < curr_node.children.size(); c++)
+            curr_nodes.push_back(curr_node.children[c]);
+        //No reads to distribute
+        if (curr_node.lvl_reads == 0)
+            continue;
+        //No genomes produce this classification
+        const vector<distrib_genome> *curr_dict = get_distribution(distrib, curr_node.taxid);
+        if (curr_dict->empty()) {
+            this->nondistributed_reads += curr_node.lvl_reads;
+            continue;
+        }
+        //Get the dictionary listing all genomes mapping to this node
+        this->distributed_reads += curr_node.lvl_reads;
+        probability_prelim.clear();
+        double all_genome_reads = 0;
+        for (size_t g = 0; g < curr_dict->size(); g++) {
+            const distrib_genome &genome = (*curr_dict)[g];
+            //Get the fraction of kmers of the genome expected to map to this node
+            double fraction = genome.fraction;
+            //Determine the number of reads classified by Kraken uniquely for the genome
+            //and the fraction of the genome that is unique
+            const map2lvl_entry *m = this->map2lvl_taxids.find(genome.taxid);
+            if (m == NULL)
+                errx(1, "  genome %s not found in report", genome.taxid.c_str());
+            double num_classified_reads = (double) m->lvl_reads;
+            double lvl_fraction = 1.;
+            const vector<distrib_genome> *genome_dict = get_distribution(distrib, genome.taxid);
+            for (size_t k = 0; k < genome_dict->size(); k++) {
+                if ((*genome_dict)[k].taxid == genome.taxid) {
+                    lvl_fraction = (*genome_dict)[k].fraction;
+                    break;
+                }
+            }
+            if (lvl_fraction == 0)
+                errx(1, "  float division by zero (genome %s)", genome.taxid.c_str());
+            //Based on the classified reads and the fraction of unique reads, estimate
+            //the true number of reads belonging to this genome in the sample
+            double est_genome_reads = num_classified_reads / lvl_fraction;
+            all_genome_reads += est_genome_reads;
+            probability_prelim.push_back(std::make_pair(fraction, est_genome_reads));
+        }
+        if (all_genome_reads == 0)
+            continue;
+        //Get final probabilities
+        double total_probability = 0.0;
+        for (size_t g = 0; g < probability_prelim.size(); g++) {
+            double P_A = probability_prelim[g].second / all_genome_reads;
+            double P_A_R = probability_prelim[g].first * P_A;
+            probability_prelim[g].second = P_A_R;
+            total_probability += P_A_R;
+        }
+        if (total_probability == 0)
+            errx(1, "  float division by zero (taxid %s)", curr_node.taxid.c_str());
+        //Find the normalize probabilty and Distribute reads accordingly
+        for (size_t g = 0; g < probability_prelim.size(); g++) {
+            double add_fraction = probability_prelim[g].second / total_probability;
+            double add_reads = add_fraction * (double) curr_node.lvl_reads;
+            this->map2lvl_taxids.find((*curr_dict)[g].taxid)->add_reads += add_reads;
+        }
+    }
+    //For all genomes, map reads up to level
+    for (auto it = this->map2lvl_taxids.begin(); it != this->map2lvl_taxids.end(); ++it)
+        this->lvl_taxids.find(it->second.lvl_taxid)->added_reads += it->second.add_reads;
+    //Sum all of the reads for the desired level -- use for fraction of reads
+    this->sum_all_reads = 0;
+    for (auto it = this->lvl_taxids.begin(); it != this->lvl_taxids.end(); ++it)
+        this->sum_all_reads += (double) it->second.all_reads + it->second.added_reads;
+}
+
+/*METHOD: Write the abundance estimate of each taxid at the level*/
+void AbundanceEstimator::write_output(const string &o_file) const {
+    FILE *out = fopen(o_file.c_str(), "w");
+    if (out == NULL)
+        err(1, "  cannot open %s", o_file.c_str());
+    write_output(out);
+    if (fclose(out) != 0)
+        err(1, "  cannot write %s", o_file.c_str());
+}
+
+/*METHOD: Write the abundance estimates to an open stream*/
+void AbundanceEstimator::write_output(FILE *out) const {
+    fprintf(out, "name\ttaxonomy_id\ttaxonomy_lvl\tkraken_assigned_reads\tadded_reads\tnew_est_reads\tfraction_total_reads\n");
+    long long sum_reads = (long long) this->sum_all_reads;
+    for (auto it = this->lvl_taxids.begin(); it != this->lvl_taxids.end(); ++it) {
+        const lvl_entry &lvl = it->second;
+        //Count up all added reads + all_reads already at the level
+        long long new_all_reads = (long long) ((double) lvl.all_reads + lvl.added_reads);
+        fprintf(out, "%s\t%s\t%s\t%lld\t%lld\t%lld\t%0.5f\n", lvl.name.c_str(), it->first.c_str(),
+            this->level.c_str(), lvl.all_reads, new_all_reads - lvl.all_reads, new_all_reads,
+            (double) new_all_reads / (double) sum_reads);
+    }
+}
+
+/*METHOD: Print the read counts of the estimation*/
+void AbundanceEstimator::print_summary(FILE *out, const string &in_file, const string &o_file) const {
+    const char *lvl = this->level_name.c_str();
+    fprintf(out, "BRACKEN SUMMARY (Kraken report: %s)\n", in_file.c_str());
+    fprintf(out, "    >>> Threshold: %i \n", this->thresh);
+    fprintf(out, "    >>> Number of %s in sample: %i \n", lvl, this->n_lvl_total);
+    fprintf(out, "\t  >> Number of %s with reads > threshold: %i \n", lvl, this->n_lvl_est);
+    fprintf(out, "\t  >> Number of %s with reads < threshold: %i \n", lvl, this->n_lvl_del);
+    fprintf(out, "    >>> Total reads in sample: %lld\n", this->total_reads);
+    fprintf(out, "\t  >> Total reads kept at %s level (reads > threshold): %lld\n", lvl, this->kept_reads);
+    fprintf(out, "\t  >> Total reads discarded (%s reads < threshold): %lld\n", lvl, this->ignored_reads);
+    fprintf(out, "\t  >> Reads distributed: %lld\n", this->distributed_reads);
+    fprintf(out, "\t  >> Reads not distributed (eg. no %s above threshold): %lld\n", lvl, this->nondistributed_reads);
+    fprintf(out, "\t  >> Unclassified reads: %lld\n", this->u_reads);
+    fprintf(out, "BRACKEN OUTPUT PRODUCED: %s\n", o_file.c_str());
+}
+
+/*METHOD: Name of the new report: input name with _bracken_<level> before the extension*/
+string AbundanceEstimator::get_report_name(const string &in_file) const {
+    string base, extension;
+    py_splitext(in_file, base, extension);
+    return base + "_bracken_" + this->level_name + extension;
+}
+
+/*Order of children by reads (stable, as Python's sorted)*/
+struct report_node_order {
+    const vector<report_node> *nodes;
+    bool operator()(int a, int b) const {
+        return (*nodes)[a].all_reads < (*nodes)[b].all_reads;
+    }
+};
+
+/*METHOD: Write a Kraken-style report with the new read counts*/
+void AbundanceEstimator::write_report(const string &r_file) {
+    FILE *out = fopen(r_file.c_str(), "w");
+    if (out == NULL)
+        err(1, "  cannot open %s", r_file.c_str());
+    write_report(out);
+    if (fclose(out) != 0)
+        err(1, "  cannot write %s", r_file.c_str());
+}
+
+/*METHOD: Write the Kraken-style report to an open stream*/
+void AbundanceEstimator::write_report(FILE *out) {
+    /*For each child node, add reads to all parents*/
+    std::unordered_map<string, double> new_reads;
+    for (size_t l = 0; l < this->leaf_nodes.size(); l++) {
+        int curr_node = this->leaf_nodes[l];
+        if (curr_node < 0)
+            continue;
+        //Move to estimation level
+        bool skip = false;
+        while (this->level != this->nodes[curr_node].level_id) {
+            if (this->nodes[curr_node].parent < 0) {
+                skip = true;
+                break;
+            }
+            curr_node = this->nodes[curr_node].parent;
+        }
+        if (skip)
+            continue;
+        //Determine number of reads to add OR skip
+        const lvl_entry *lvl = this->lvl_taxids.find(this->nodes[curr_node].taxid);
+        if (lvl == NULL)
+            continue;
+        double new_total = lvl->added_reads + (double) lvl->all_reads;
+        //If this level tree already traversed, do not traverse
+        if (new_reads.count(this->nodes[curr_node].taxid) > 0)
+            continue;
+        //Save reads for this node
+        new_reads[this->nodes[curr_node].taxid] = new_total;
+        //Traverse tree
+        while (this->nodes[curr_node].parent >= 0) {
+            curr_node = this->nodes[curr_node].parent;
+            report_node &node = this->nodes[curr_node];
+            //Add to dictionary if not previously found
+            auto it = new_reads.find(node.taxid);
+            if (it == new_reads.end()) {
+                it = new_reads.insert(std::make_pair(node.taxid, 0.0)).first;
+                node.all_reads = 0;
+            }
+            it->second += new_total;
+            node.all_reads += new_total;
+        }
+    }
+    /*Print modified kraken report*/
+    vector<int> curr_nodes;
+    if (this->root >= 0)
+        curr_nodes.push_back(this->root);
+    report_node_order order;
+    order.nodes = &this->nodes;
+    vector<int> sorted_children;
+    while (!curr_nodes.empty()) {
+        const report_node &curr_node = this->nodes[curr_nodes.back()];
+        curr_nodes.pop_back();
+        //For each child node, add to list of nodes to evaluate
+        int children = 0;
+        sorted_children = curr_node.children;
+        std::stable_sort(sorted_children.begin(), sorted_children.end(), order);
+        for (size_t c = 0; c < sorted_children.size(); c++) {
+            const string &child_lvl = this->nodes[sorted_children[c]].level_id;
+            //Add if at level or above
+            if (child_lvl.substr(0, 1) != this->level || child_lvl == this->level) {
+                curr_nodes.push_back(sorted_children[c]);
+                children += 1;
+            }
+        }
+        //Print information for this level
+        auto it = new_reads.find(curr_node.taxid);
+        if (it == new_reads.end())
+            continue;
+        double new_all_reads = it->second;
+        fprintf(out, "%0.2f\t", new_all_reads / this->sum_all_reads * 100);
+        fprintf(out, "%lld\t", (long long) new_all_reads);
+        if (children == 0)
+            fprintf(out, "%lld\t", (long long) new_all_reads);
+        else
+            fprintf(out, "0\t");
+        fprintf(out, "%s\t%s\t%s%s\n", curr_node.level_id.c_str(), curr_node.taxid.c_str(),
+            string(curr_node.level_num * 2, ' ').c_str(), curr_node.name.c_str());
+    }
+}
+
+/*METHOD: Name and taxid of each taxid at the level with its estimated reads*/
+void AbundanceEstimator::get_estimates(vector<std::pair<string, string>> &names, vector<long long> &est_reads) const {
+    for (auto it = this->lvl_taxids.begin(); it != this->lvl_taxids.end(); ++it) {
+        names.push_back(std::make_pair(it->second.name, it->first));
+        est_reads.push_back((long long) ((double) it->second.all_reads + it->second.added_reads));
+    }
+}
+
+/*Estimated reads of one name in each sample (-1 where not estimated)*/
+struct combined_row {
+    string taxid;
+    vector<long long> reads;
+};
+
+/*METHOD: Write the estimates of several samples as one tab-delimited matrix,
+ * as combine_bracken_outputs.py does from their output files*/
+void write_combined(const string &c_file, const string &level, const vector<const AbundanceEstimator *> &samples, const vector<string> &sample_names) {
+    ordered_dict<combined_row> rows;
+    vector<long long> total_reads(samples.size(), 0);
+    vector<std::pair<string, string>> names;
+    vector<long long> est_reads;
+    for (size_t s = 0; s < samples.size(); s++) {
+        names.clear();
+        est_reads.clear();
+        samples[s]->get_estimates(names, est_reads);
+        for (size_t i = 0; i < names.size(); i++) {
+            bool is_new = !rows.contains(names[i].first);
+            combined_row &row = rows[names[i].first];
+            if (is_new) {
+                row.taxid = names[i].second;
+                row.reads.assign(samples.size(), -1);
+            } else if (row.taxid != names[i].second) {
+                errx(1, "Taxonomy IDs not matching for %s: (%s\t%s)", names[i].first.c_str(),
+                    names[i].second.c_str(), row.taxid.c_str());
+            }
+            total_reads[s] += est_reads[i];
+            row.reads[s] = est_reads[i];
+        }
+    }
+    FILE *out = fopen(c_file.c_str(), "w");
+    if (out == NULL)
+        err(1, "  cannot open %s", c_file.c_str());
+    fprintf(out, "name\ttaxonomy_id\ttaxonomy_lvl");
+    for (size_t s = 0; s < sample_names.size(); s++)
+        fprintf(out, "\t%s_num\t%s_frac", sample_names[s].c_str(), sample_names[s].c_str());
+    fprintf(out, "\n");
+    for (auto it = rows.begin(); it != rows.end(); ++it) {
+        fprintf(out, "%s\t%s\t%s", it->first.c_str(), it->second.taxid.c_str(), level.c_str());
+        for (size_t s = 0; s < samples.size(); s++) {
+            long long num = it->second.reads[s];
+            if (num >= 0)
+                fprintf(out, "\t%lld\t%0.5f", num, (double) num / (double) total_reads[s]);
+            else
+                fprintf(out, "\t0\t0.00000");
+        }
+        fprintf(out, "\n");
+    }
+    if (fclose(out) != 0)
+        err(1, "  cannot write %s", c_file.c_str());
+}
@@ -0,0 +1,184 @@
+/*********************************************************************
+ * abundance_estimation.h is used as part of the bracken_est program
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef ABUNDANCE_ESTIMATION_H
+#define ABUNDANCE_ESTIMATION_H
+
+#include "kmer2read_headers.h"
+#include "kmer_distrib_index.h"
+#include <unordered_map>
+#include <unordered_set>
+
+/* Dictionary keyed by taxid strings that remembers insertion order
+ * (assigning to an existing key keeps its position, as in Python).
+ */
+template <typename V>
+class ordered_dict {
+    public:
+        /*Value of a key, inserted with a default value if missing*/
+        V& operator[](const string &key) {
+            auto it = this->index.find(key);
+            if (it != this->index.end())
+                return this->items[it->second].second;
+            this->index[key] = this->items.size();
+            this->items.push_back(std::make_pair(key, V()));
+            return this->items.back().second;
+        }
+        V* find(const string &key) {
+            auto it = this->index.find(key);
+            return (it == this->index.end()) ? NULL : &this->items[it->second].second;
+        }
+        const V* find(const string &key) const {
+            auto it = this->index.find(key);
+            return (it == this->index.end()) ? NULL : &this->items[it->second].second;
+        }
+        bool contains(const string &key) const { return this->index.count(key) > 0; }
+        size_t size() const { return this->items.size(); }
+        void clear() { this->items.clear(); this->index.clear(); }
+        typename vector<std::pair<string, V>>::iterator begin() { return this->items.begin(); }
+        typename vector<std::pair<string, V>>::iterator end() { return this->items.end(); }
+        typename vector<std::pair<string, V>>::const_iterator begin() const { return this->items.begin(); }
+        typename vector<std::pair<string, V>>::const_iterator end() const { return this->items.end(); }
+    private:
+        vector<std::pair<string, V>> items;
+        std::unordered_map<string, size_t> index;
+};
+
+/*Fraction of a genome's reads that map to one taxid*/
+struct distrib_genome {
+    string taxid;
+    double fraction;
+};
+
+/* Class holding a databaseXmers.kmer_distrib file.
+ * Each line lists the genomes whose reads map to one taxid. Loading can be
+ * limited to the mapped taxids and genomes of a single report; with a
+ * current binary index only those rows are read.
+ */
+class KmerDistrib {
+    public:
+        bool load(const string &, const std::unordered_set<string> *, const std::unordered_set<string> *, bool);
+        /*Load from an open binary index*/
+        void load_index(const KmerDistribIndex &, const std::unordered_set<string> *, const std::unordered_set<string> *);
+        /*Lines of a mapped taxid (usually one), in file order*/
+        const vector<vector<distrib_genome>>* find(const string &) const;
+    private:
+        void add_row(const KmerDistribIndex &, size_t, const std::unordered_set<string> *);
+
+        std::unordered_map<string, vector<vector<distrib_genome>>> lines;
+};
+
+/*A node of the Kraken report tree*/
+struct report_node {
+    string name;
+    string taxid;
+    int level_num;
+    string level_id;
+    double all_reads;
+    long long lvl_reads;
+    int parent;
+    vector<int> children;
+};
+
+/*Reads of a taxid at the estimation level*/
+struct lvl_entry {
+    string name;
+    long long all_reads;
+    long long lvl_reads;
+    double added_reads;
+};
+
+/*Reads of a taxid at or below the estimation level*/
+struct map2lvl_entry {
+    string lvl_taxid;
+    long long lvl_reads;
+    double add_reads;
+};
+
+/* Class estimating abundances from one Kraken report (the est_abundance.py
+ * method). Taxids are kept as strings and every dictionary keeps Python's
+ * insertion order, so sums are accumulated in the same order and the output
+ * files are identical to those of est_abundance.py.
+ */
+class AbundanceEstimator {
+    public:
+        AbundanceEstimator(const string &, const string &);
+        /*Read the report (or its lines) and build the tree*/
+        bool read_report(const string &);
+        bool parse_report(const vector<string> &);
+        /*Taxids needed from the kmer distribution: mapped taxids and genomes*/
+        void get_needed_taxids(std::unordered_set<string> &, std::unordered_set<string> &) const;
+        /*Distribute reads to the estimation level*/
+        void estimate(const KmerDistrib &);
+        /*Write the abundance estimates, the summary and the new report*/
+        void write_output(const string &) const;
+        void write_output(FILE *) const;
+        void print_summary(FILE *, const string &, const string &) const;
+        void write_report(const string &);
+        void write_report(FILE *);
+        /*Default name of the new report*/
+        string get_report_name(const string &) const;
+        string get_abundance_lvl() const;
+        bool has_reads() const;
+        /*Estimated reads of each taxid at the level, in output order*/
+        void get_estimates(vector<std::pair<string, string>> &, vector<long long> &) const;
+    private:
+        const vector<distrib_genome>* get_distribution(const KmerDistrib &, const string &);
+
+        string level;
+        string level_name;
+        int branch;
+        int branch_lvl;
+        int thresh;
+        /*Report tree*/
+        vector<report_node> nodes;
+        int root;
+        vector<int> leaf_nodes;
+        ordered_dict<lvl_entry> lvl_taxids;
+        ordered_dict<map2lvl_entry> map2lvl_taxids;
+        /*Mapped taxid -> genome distribution relevant to this report*/
+        std::unordered_map<string, vector<distrib_genome>> kmer_distr;
+        /*Counters for the summary*/
+        long long total_reads;
+        long long kept_reads;
+        long long ignored_reads;
+        long long u_reads;
+        int n_lvl_total;
+        int n_lvl_est;
+        int n_lvl_del;
+        long long distributed_reads;
+        long long nondistributed_reads;
+        double sum_all_reads;
+};
+
+/*Write the estimates of several samples as one matrix (combine_bracken_outputs.py)*/
+void write_combined(const string &, const string &, const vector<const AbundanceEstimator *> &, const vector<string> &);
+
+/*Helpers matching Python's str.strip(), str.split(), int() and os.path.splitext()*/
+string py_strip(const string &);
+void py_split(const string &, char, vector<string> &);
+bool py_int(const string &, long long &);
+void py_splitext(const string &, string &, string &);
+/*Split text / read a text file into lines (universal newlines)*/
+void split_lines(const string &, vector<string> &);
+bool read_lines(const string &, vector<string> &);
+
+#endif
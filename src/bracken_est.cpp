@@ -0,0 +1,666 @@
+/*********************************************************************
+ * bracken_est.cpp is the main function of the bracken_est program
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2018/09/06
+ */
+
+#include "kmer2read_headers.h"
+#include "abundance_estimation.h"
+#include "estimation_server.h"
+#include "stream_estimation.h"
+#include <time.h>
+#include <glob.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*General Function Declarations*/
+void parse_command_line(int argc, char **argv);
+void usage(int exit_code=0);
+void print_time(const char *);
+void add_report(const string &, const string &);
+void read_manifest(const string &);
+void add_reports(const string &);
+int run_batch();
+int run_client();
+int run_stream();
+bool emit_estimates(const ReadCounter &, const resident_distrib &, int);
+bool replace_file(const string &, AbundanceEstimator &, bool);
+bool write_text(const string &, const string &);
+
+/*Variables - Remains Constant*/
+string in_file = "";
+string kmer_distr_file = "";
+string output_file = "";
+string level = "S";
+string report_file = "";
+string thresh = "10";
+bool distrib_index = true;
+/*Batch mode: reports, their sample names and where to write the results*/
+vector<string> batch_reports;
+vector<string> batch_names;
+string out_dir = ".";
+string combined_file = "";
+int num_threads = 1;
+/*Server mode: socket to serve on or send the report to*/
+string serve_socket = "";
+string client_socket = "";
+/*Stream mode: Kraken output to read, the taxonomy and when to update the estimates*/
+string stream_file = "";
+string taxonomy_dir = "";
+bool taxonomy_cache = true;
+long long update_reads = 0;
+int update_interval = 0;
+
+/*Main Driver Program*/
+int main(int argc, char *argv[]) {
+    omp_set_num_threads(1);
+    parse_command_line(argc, argv);
+    if (serve_socket != "") {
+        vector<string> files;
+        py_split(kmer_distr_file, ',', files);
+        EstimationServer server(files, distrib_index);
+        server.load();
+        server.run(serve_socket);
+        return 0;
+    }
+    print_time("PROGRAM START TIME");
+    if (!batch_reports.empty())
+        return run_batch();
+    if (client_socket != "")
+        return run_client();
+    if (stream_file != "")
+        return run_stream();
+
+    /*Read the report, then only the kmer distribution lines it needs*/
+    AbundanceEstimator estimator(level, thresh);
+    if (!estimator.read_report(in_file))
+        exit(1);
+    std::unordered_set<string> mapped_taxids;
+    std::unordered_set<string> genome_taxids;
+    estimator.get_needed_taxids(mapped_taxids, genome_taxids);
+    KmerDistrib kmer_distr;
+    if (!kmer_distr.load(kmer_distr_file, &mapped_taxids, &genome_taxids, distrib_index))
+        err(1, "  cannot open %s", kmer_distr_file.c_str());
+
+    /*Distribute reads and print the results*/
+    estimator.estimate(kmer_distr);
+    if (!estimator.has_reads()) {
+        fprintf(stderr, "Error: no reads found. Please check your Kraken report\n");
+        exit(1);
+    }
+    estimator.write_output(output_file);
+    estimator.print_summary(stdout, in_file, output_file);
+    print_time("PROGRAM END TIME");
+
+    /*Kraken-style report with the new read counts*/
+    if (report_file == "")
+        report_file = estimator.get_report_name(in_file);
+    estimator.write_report(report_file);
+    return 0;
+}
+
+/*METHOD: Estimate abundances for many reports with one loaded kmer distribution.
+ * Reports are processed in parallel; a report that fails is skipped and the
+ * program exits with status 1 after the others are written.*/
+int run_batch() {
+    size_t n_samples = batch_reports.size();
+    vector<string> outputs(n_samples);
+    vector<string> reports(n_samples);
+    vector<AbundanceEstimator> estimators(n_samples, AbundanceEstimator(level, thresh));
+    vector<int> failed(n_samples, 0);
+    for (size_t i = 0; i < n_samples; i++) {
+        //SAMPLE.bracken and SAMPLE_bracken_<level> with the extension of the report
+        string report_base, extension;
+        py_splitext(batch_reports[i].substr(batch_reports[i].rfind('/') + 1), report_base, extension);
+        outputs[i] = out_dir + "/" + batch_names[i] + ".bracken";
+        reports[i] = estimators[i].get_report_name(out_dir + "/" + batch_names[i] + extension);
+    }
+    /*Read all reports, then the kmer distribution lines any of them needs*/
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < n_samples; i++) {
+        if (!estimators[i].read_report(batch_reports[i]))
+            failed[i] = 1;
+    }
+    std::unordered_set<string> mapped_taxids;
+    std::unordered_set<string> genome_taxids;
+    for (size_t i = 0; i < n_samples; i++) {
+        if (!failed[i])
+            estimators[i].get_needed_taxids(mapped_taxids, genome_taxids);
+    }
+    KmerDistrib kmer_distr;
+    if (!kmer_distr.load(kmer_distr_file, &mapped_taxids, &genome_taxids, distrib_index))
+        err(1, "  cannot open %s", kmer_distr_file.c_str());
+    /*Distribute reads and write the results of each sample*/
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < n_samples; i++) {
+        if (failed[i])
+            continue;
+        estimators[i].estimate(kmer_distr);
+        if (!estimators[i].has_reads()) {
+            fprintf(stderr, "Error: no reads found in %s. Please check your Kraken report\n", batch_reports[i].c_str());
+            failed[i] = 1;
+            continue;
+        }
+        estimators[i].write_output(outputs[i]);
+        estimators[i].write_report(reports[i]);
+    }
+    /*Print the summaries in input order*/
+    vector<const AbundanceEstimator *> samples;
+    vector<string> names;
+    int n_failed = 0;
+    for (size_t i = 0; i < n_samples; i++) {
+        if (failed[i]) {
+            n_failed += 1;
+            continue;
+        }
+        estimators[i].print_summary(stdout, batch_reports[i], outputs[i]);
+        samples.push_back(&estimators[i]);
+        names.push_back(batch_names[i]);
+    }
+    if (combined_file != "" && !samples.empty()) {
+        write_combined(combined_file, level, samples, names);
+        printf("BRACKEN COMBINED OUTPUT PRODUCED: %s (%i samples)\n", combined_file.c_str(), (int) samples.size());
+    }
+    if (n_failed > 0)
+        fprintf(stderr, "Error: %i of %i reports could not be processed\n", n_failed, (int) n_samples);
+    print_time("PROGRAM END TIME");
+    return (n_failed > 0) ? 1 : 0;
+}
+
+/*METHOD: Have a server estimate the abundances of one report and write the
+ * same files as a local run*/
+int run_client() {
+    std::ifstream in(in_file.c_str(), std::ios::in | std::ios::binary);
+    if (!in.is_open())
+        err(1, "  cannot open %s", in_file.c_str());
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::map<string, string> fields;
+    fields["LEVEL"] = level;
+    fields["THRESHOLD"] = thresh;
+    fields["DATABASE"] = kmer_distr_file;
+    fields["INPUT"] = in_file;
+    fields["OUTPUT"] = output_file;
+    string error, summary, output, new_report;
+    if (!request_estimate(client_socket, fields, buffer.str(), error, summary, output, new_report)) {
+        fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+    if (report_file == "")
+        report_file = AbundanceEstimator(level, thresh).get_report_name(in_file);
+    if (!write_text(output_file, output))
+        err(1, "  cannot write %s", output_file.c_str());
+    fputs(summary.c_str(), stdout);
+    print_time("PROGRAM END TIME");
+    if (!write_text(report_file, new_report))
+        err(1, "  cannot write %s", report_file.c_str());
+    return 0;
+}
+
+/*METHOD: Count Kraken per-read output as it arrives (from a file, a FIFO or
+ * stdin) and rewrite the estimates every --update-reads reads and/or
+ * --update-interval seconds, and once more at the end of the input. Each
+ * update builds the report of all reads so far in memory and estimates it
+ * like a report file.*/
+int run_stream() {
+    /*Load the taxonomy, its names and the kmer distribution once*/
+    taxonomy my_taxonomy;
+    string nodes_file = taxonomy_dir + "/nodes.dmp";
+    if (!construct_taxonomy(nodes_file, &my_taxonomy, taxonomy_cache))
+        err(1, "  cannot open %s", nodes_file.c_str());
+    ReadCounter counter(&my_taxonomy);
+    if (!counter.load_names(taxonomy_dir + "/names.dmp"))
+        printf("\t\tWarning: no names.dmp in %s; taxids are used as names\n", taxonomy_dir.c_str());
+    resident_distrib distrib;
+    distrib.file = kmer_distr_file;
+    if (!load_resident(distrib, distrib_index))
+        err(1, "  cannot open %s", kmer_distr_file.c_str());
+
+    int fd = 0;
+    if (stream_file != "-" && (fd = open(stream_file.c_str(), O_RDONLY)) < 0)
+        err(1, "  cannot open %s", stream_file.c_str());
+    printf("\t>> Reading Kraken output from %s\n", (stream_file == "-") ? "stdin" : stream_file.c_str());
+    fflush(stdout);
+    vector<char> buffer(1 << 16);
+    string partial = "";
+    long long n_bad = 0;
+    uint64_t last_reads = 0;
+    int n_updates = 0;
+    bool written = false;
+    time_t last_update = time(NULL);
+    auto update = [&]() {
+        if (n_bad > 0)
+            fprintf(stderr, "\tWarning: %lli lines are not Kraken output and were skipped\n", n_bad);
+        if (emit_estimates(counter, distrib, ++n_updates))
+            written = true;
+        last_reads = counter.get_reads();
+        last_update = time(NULL);
+    };
+    bool done = false;
+    while (!done) {
+        /*Wait for input, but no longer than the next timed update*/
+        int timeout = -1;
+        if (update_interval > 0)
+            timeout = (int) max((time_t) 0, last_update + update_interval - time(NULL)) * 1000;
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0 && errno != EINTR)
+            err(1, "  cannot read %s", stream_file.c_str());
+        if (ready > 0) {
+            ssize_t n = read(fd, buffer.data(), buffer.size());
+            if (n < 0 && errno != EINTR && errno != EAGAIN)
+                err(1, "  cannot read %s", stream_file.c_str());
+            if (n == 0)
+                done = true;
+            /*Count complete lines; the last partial line waits for the next read*/
+            const char *p = buffer.data();
+            const char *end = p + max(n, (ssize_t) 0);
+            while (p < end) {
+                const char *nl = (const char *) memchr(p, '\n', end - p);
+                if (nl == NULL) {
+                    partial.append(p, end);
+                    break;
+                }
+                const char *line = p;
+                size_t len = nl - p;
+                if (!partial.empty()) {
+                    partial.append(p, nl);
+                    line = partial.data();
+                    len = partial.size();
+                }
+                if (len > 0 && line[len - 1] == '\r')
+                    len--;
+                if (len > 0 && !counter.add_line(line, len))
+                    n_bad += 1;
+                partial.clear();
+                p = nl + 1;
+                if (update_reads > 0 && counter.get_reads() - last_reads >= (uint64_t) update_reads)
+                    update();
+            }
+            if (done && !partial.empty()) {
+                if (!counter.add_line(partial.data(), partial.size()))
+                    n_bad += 1;
+                partial.clear();
+            }
+        }
+        /*Update when the interval has passed (if there are new reads) and at the end*/
+        bool changed = counter.get_reads() != last_reads;
+        if (done && (changed || n_updates == 0))
+            update();
+        else if (update_interval > 0 && time(NULL) >= last_update + update_interval) {
+            if (changed)
+                update();
+            else
+                last_update = time(NULL);
+        }
+    }
+    if (fd != 0)
+        close(fd);
+    delete distrib.index;
+    delete distrib.distrib;
+    print_time("PROGRAM END TIME");
+    if (!written) {
+        fprintf(stderr, "Error: no reads found. Please check your Kraken output\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*METHOD: Estimate the abundances of all reads counted so far and replace the
+ * output files (false, leaving them as they were, if there are no reads yet)*/
+bool emit_estimates(const ReadCounter &counter, const resident_distrib &distrib, int update) {
+    printf("\t>> Update %i: %llu reads", update, (unsigned long long) counter.get_reads());
+    if (counter.get_unknown() > 0)
+        printf(" (%llu with taxids missing from the taxonomy)", (unsigned long long) counter.get_unknown());
+    printf("\n");
+    fflush(stdout);
+    vector<string> lines;
+    counter.build_report(lines);
+    AbundanceEstimator estimator(level, thresh);
+    if (lines.empty() || !estimator.parse_report(lines)) {
+        fprintf(stderr, "\tNo reads to estimate yet\n");
+        return false;
+    }
+    estimate_resident(distrib, estimator);
+    if (!estimator.has_reads()) {
+        fprintf(stderr, "\tNo reads at the estimation level yet\n");
+        return false;
+    }
+    if (!replace_file(output_file, estimator, false))
+        err(1, "  cannot write %s", output_file.c_str());
+    estimator.print_summary(stdout, stream_file, output_file);
+    if (report_file != "" && !replace_file(report_file, estimator, true))
+        err(1, "  cannot write %s", report_file.c_str());
+    fflush(stdout);
+    return true;
+}
+
+/*METHOD: Write the estimates (or the new report) to a temporary file and
+ * rename it over the old one, so readers never see a partial file*/
+bool replace_file(const string &file, AbundanceEstimator &estimator, bool report) {
+    string tmp_file = file + ".tmp";
+    FILE *out = fopen(tmp_file.c_str(), "w");
+    if (out == NULL)
+        return false;
+    if (report)
+        estimator.write_report(out);
+    else
+        estimator.write_output(out);
+    bool ok = (ferror(out) == 0);
+    ok = (fclose(out) == 0) && ok;
+    if (!ok || rename(tmp_file.c_str(), file.c_str()) != 0) {
+        unlink(tmp_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*METHOD: Write a string to a file*/
+bool write_text(const string &file, const string &text) {
+    FILE *out = fopen(file.c_str(), "w");
+    if (out == NULL)
+        return false;
+    bool ok = fwrite(text.data(), 1, text.size(), out) == text.size();
+    return (fclose(out) == 0) && ok;
+}
+
+/*METHOD: Add a report to the batch; the sample name defaults to the file name
+ * without its extension*/
+void add_report(const string &report, const string &name) {
+    string sample = name;
+    if (sample == "") {
+        string extension;
+        py_splitext(report.substr(report.rfind('/') + 1), sample, extension);
+    }
+    for (size_t i = 0; i < batch_names.size(); i++) {
+        if (batch_names[i] == sample)
+            errx(1, "  sample name %s is used for both %s and %s", sample.c_str(), batch_reports[i].c_str(), report.c_str());
+    }
+    batch_reports.push_back(report);
+    batch_names.push_back(sample);
+}
+
+/*METHOD: Read a manifest: one report per line, optionally followed by a tab
+ * and its sample name (blank lines and lines starting with # are skipped)*/
+void read_manifest(const string &m_file) {
+    vector<string> lines;
+    if (!read_lines(m_file, lines))
+        err(1, "  cannot open %s", m_file.c_str());
+    vector<string> fields;
+    for (size_t l = 0; l < lines.size(); l++) {
+        string line = py_strip(lines[l]);
+        if (line.empty() || line[0] == '#')
+            continue;
+        py_split(line, '\t', fields);
+        add_report(py_strip(fields[0]), (fields.size() > 1) ? py_strip(fields[1]) : "");
+    }
+}
+
+/*METHOD: Add all reports matching a glob pattern*/
+void add_reports(const string &pattern) {
+    glob_t matches;
+    if (glob(pattern.c_str(), 0, NULL, &matches) != 0)
+        errx(1, "  no reports match %s", pattern.c_str());
+    for (size_t i = 0; i < matches.gl_pathc; i++)
+        add_report(matches.gl_pathv[i], "");
+    globfree(&matches);
+}
+
+/*METHOD: Print a label and the current time (UTC)*/
+void print_time(const char *label) {
+    char buffer[64];
+    time_t now = time(NULL);
+    strftime(buffer, sizeof(buffer), "%m-%d-%Y %H:%M:%S", gmtime(&now));
+    printf("%s: %s\n", label, buffer);
+    fflush(stdout);
+}
+
+/* METHOD: Process command line arguments. */
+void parse_command_line(int argc, char **argv) {
+    int opt;
+    int intval;
+    /*Set arguments*/
+    static struct option all_options[] = {
+        {"input",       required_argument, 0, 'i'},
+        {"kmer_distr",  required_argument, 0, 'k'},
+        {"output",      required_argument, 0, 'o'},
+        {"level",       required_argument, 0, 'l'},
+        {"out-report",  required_argument, 0, 'r'},
+        {"thresh",      required_argument, 0, 't'},
+        {"threshold",   required_argument, 0, 't'},
+        {"no-distrib-index", no_argument, 0, 'I'},
+        {"manifest",    required_argument, 0, 'm'},
+        {"reports",     required_argument, 0, 'g'},
+        {"outdir",      required_argument, 0, 'd'},
+        {"combined",    required_argument, 0, 'c'},
+        {"threads",     required_argument, 0, 'p'},
+        {"serve",       required_argument, 0, 's'},
+        {"client",      required_argument, 0, 'x'},
+        {"stream",      required_argument, 0, 'f'},
+        {"taxonomy",    required_argument, 0, 'b'},
+        {"no-taxonomy-cache", no_argument, 0, 'C'},
+        {"update-reads", required_argument, 0, 'n'},
+        {"update-interval", required_argument, 0, 'u'},
+        {"help",        no_argument, 0, 'h'},
+        {0, 0}
+        };
+    /*Process arguments*/
+    int option_index = 0;
+    while ((opt = getopt_long(argc, argv, "hi:k:o:l:t:", all_options, &option_index)) != -1) {
+        switch(opt) {
+            case 'h':
+                usage(0);
+                break;
+            case 'i':
+                in_file = optarg;
+                break;
+            case 'k':
+                kmer_distr_file = optarg;
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'l':
+                level = optarg;
+                break;
+            case 'r':
+                report_file = optarg;
+                break;
+            case 't':
+                thresh = optarg;
+                break;
+            case 'I':
+                /*always parse the text kmer distribution*/
+                distrib_index = false;
+                break;
+            case 'm':
+                read_manifest(optarg);
+                break;
+            case 'g':
+                add_reports(optarg);
+                break;
+            case 'd':
+                out_dir = optarg;
+                break;
+            case 'c':
+                combined_file = optarg;
+                break;
+            case 's':
+                serve_socket = optarg;
+                break;
+            case 'x':
+                client_socket = optarg;
+                break;
+            case 'f':
+                stream_file = optarg;
+                break;
+            case 'b':
+                /*taxonomy FOLDER*/
+                taxonomy_dir = optarg;
+                if (taxonomy_dir.size() > 1 && taxonomy_dir.back() == '/')
+                    taxonomy_dir.pop_back();
+                break;
+            case 'C':
+                /*always parse nodes.dmp*/
+                taxonomy_cache = false;
+                break;
+            case 'n':
+                update_reads = atoll(optarg);
+                if (update_reads <= 0)
+                    errx(1, "  --update-reads must be positive");
+                break;
+            case 'u':
+                update_interval = atoi(optarg);
+                if (update_interval <= 0)
+                    errx(1, "  --update-interval must be positive");
+                break;
+            case 'p':
+                intval = atoi(optarg);
+                /*check negative number of threads*/
+                if (intval <= 0) {
+                    errx(1, "  can't use nonpositive threads");
+                    usage(1);
+                }
+                if (intval > omp_get_num_procs()) {
+                    errx(1, "  thread count exceeds number of processors");
+                    usage(1);
+                }
+                /*set number of threads*/
+                num_threads = intval;
+                omp_set_num_threads(num_threads);
+                break;
+            default:
+                usage(1);
+                break;
+        }
+    }
+    /*Check mandatory options*/
+    if (serve_socket != "") {
+        if (kmer_distr_file == "") {
+            printf("  Must specify --kmer_distr file(s) to serve!\n");
+            usage(1);
+        }
+        return;
+    } else if (client_socket != "" && !batch_reports.empty()) {
+        printf("  --client cannot be used with --manifest/--reports!\n");
+        usage(1);
+    }
+    if (stream_file != "") {
+        if (!batch_reports.empty() || client_socket != "" || in_file != "") {
+            printf("  --stream cannot be used with --input, --client or --manifest/--reports!\n");
+            usage(1);
+        } else if (taxonomy_dir == "") {
+            printf("  Must specify --taxonomy folder!\n");
+            usage(1);
+        } else if (kmer_distr_file == "") {
+            printf("  Must specify --kmer_distr file!\n");
+            usage(1);
+        } else if (output_file == "") {
+            printf("  Must specify --output file!\n");
+            usage(1);
+        }
+        return;
+    } else if (taxonomy_dir != "" || update_reads > 0 || update_interval > 0) {
+        printf("  --taxonomy, --update-reads and --update-interval require --stream!\n");
+        usage(1);
+    }
+    if (!batch_reports.empty()) {
+        if (in_file != "" || output_file != "" || report_file != "") {
+            printf("  --input, --output and --out-report cannot be used with --manifest/--reports!\n");
+            usage(1);
+        } else if (kmer_distr_file == "") {
+            printf("  Must specify --kmer_distr file!\n");
+            usage(1);
+        }
+        return;
+    } else if (combined_file != "") {
+        printf("  --combined requires --manifest or --reports!\n");
+        usage(1);
+    }
+    if (in_file == "") {
+        printf("  Must specify --input file! (Kraken report)\n");
+        usage(1);
+    } else if (kmer_distr_file == "" && client_socket == "") {
+        printf("  Must specify --kmer_distr file!\n");
+        usage(1);
+    } else if (output_file == "") {
+        printf("  Must specify --output file!\n");
+        usage(1);
+    }
+}
+
+/* METHOD: Print usage */
+void usage(int exit_code) {
+    if (exit_code == 1) {
+        printf("  For usage, please run: \n");
+        printf("     bracken_est --help\n");
+        exit(exit_code);
+    }
+    cerr << "--------------------------------------------------------------------------" << endl;
+    cerr << "Usage: bracken_est [options]" << endl << endl
+        << "  *Required Parameters:" << endl
+        << "     -i, --input FILE        Kraken report file" << endl
+        << "     -k, --kmer_distr FILE   kmer distribution file" << endl
+        << "                             (databaseXmers.kmer_distrib)" << endl
+        << "     -o, --output FILE       output file with the abundance estimates" << endl
+        << "  *Optional Parameters" << endl
+        << "     -l, --level LVL         level to push all reads to" << endl
+        << "                             (default = S)" << endl
+        << "     -t, --threshold NUM     minimum number of reads Kraken must assign to" << endl
+        << "                             a classification for it to be kept" << endl
+        << "                             (default = 10)" << endl
+        << "     --out-report FILE       name of the new Kraken-style report" << endl
+        << "                             (default = input report with _bracken_<level>" << endl
+        << "                             added to the filename)" << endl
+        << "     --no-distrib-index      parse the kmer distribution file instead of" << endl
+        << "                             loading (and writing) its binary index" << endl
+        << "                             FILE" KMER_DISTRIB_INDEX_SUFFIX << endl
+        << "  *Batch Mode (replaces --input, --output and --out-report)" << endl
+        << "     --manifest FILE         file listing one Kraken report per line, optionally" << endl
+        << "                             followed by a tab and the sample name" << endl
+        << "     --reports PATTERN       Kraken reports matching a glob pattern (quote it)" << endl
+        << "                             sample names are the file names without extension" << endl
+        << "     --outdir DIR            folder for SAMPLE.bracken and the new reports" << endl
+        << "                             (default = current folder)" << endl
+        << "     --combined FILE         also write all samples as one matrix, as" << endl
+        << "                             combine_bracken_outputs.py does" << endl
+        << "     --threads NUM           number of reports processed in parallel" << endl
+        << "                             (default = 1)" << endl
+        << "  *Server Mode" << endl
+        << "     --serve SOCKET          keep the --kmer_distr FILE[,FILE] databases loaded" << endl
+        << "                             and answer requests on a Unix domain socket" << endl
+        << "                             (kill -HUP reloads the databases)" << endl
+        << "     --client SOCKET         send the --input report to a server instead of" << endl
+        << "                             loading a database (-k picks one of the served" << endl
+        << "                             databases by file or base name; default = first)" << endl
+        << "  *Stream Mode (replaces --input)" << endl
+        << "     --stream FILE           Kraken per-read output to count as it arrives" << endl
+        << "                             (a file, a named pipe or - for stdin)" << endl
+        << "     --taxonomy FOLDER       taxonomy folder with the nodes.dmp (and names.dmp)" << endl
+        << "                             file of the Kraken database" << endl
+        << "     --update-reads NUM      rewrite the estimates every NUM reads" << endl
+        << "     --update-interval SEC   rewrite the estimates every SEC seconds" << endl
+        << "                             (estimates are always written at the end; the" << endl
+        << "                             new report only if --out-report is given)" << endl
+        << "     --no-taxonomy-cache     parse nodes.dmp instead of loading (and writing)" << endl
+        << "                             the binary taxonomy cache nodes.dmp" TAXONOMY_CACHE_SUFFIX << endl;
+    cerr << "--------------------------------------------------------------------------" << endl;
+    exit(exit_code);
+}
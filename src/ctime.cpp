@@ -47,5 +47,15 @@ int timeval_subtract (struct timeval * result, struct timeval * x, struct timeva
    
     /*Return 1 if result is negative. */
     return x->tv_sec < y->tv_sec;
-}                      
+}
 
+/*METHOD: Modification time of a file in nanoseconds precision*/
+void get_mtime(const struct stat &sb, int64_t &sec, int64_t &nsec) {
+#ifdef __APPLE__
+    sec = sb.st_mtimespec.tv_sec;
+    nsec = sb.st_mtimespec.tv_nsec;
+#else
+    sec = sb.st_mtim.tv_sec;
+    nsec = sb.st_mtim.tv_nsec;
+#endif
+}
@@ -25,6 +25,7 @@
 #include "kmer2read_headers.h"
 
 int timeval_subtract( struct timeval *, struct timeval *, struct timeval *);
+void get_mtime(const struct stat &, int64_t &, int64_t &);
 
 #endif 
 
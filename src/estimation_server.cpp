@@ -0,0 +1,386 @@
+/*********************************************************************
+ * estimation_server.cpp is used as part of the bracken_est program
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "estimation_server.h"
+#include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*Set by signal handlers, checked between connections*/
+static volatile sig_atomic_t reload_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_reload(int) {
+    reload_requested = 1;
+}
+
+static void on_stop(int) {
+    stop_requested = 1;
+}
+
+/*METHOD: Write all bytes to a socket*/
+static bool write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/*METHOD: Read until end of file (or until limit bytes were read)*/
+static bool read_all(int fd, string &data, size_t limit) {
+    char buffer[1 << 16];
+    while (data.size() < limit) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return false;
+        if (n == 0)
+            break;
+        data.append(buffer, n);
+    }
+    return true;
+}
+
+/*METHOD: Read a message header: "KEY VALUE" lines up to an empty line.
+ * Bytes read past the header are left in rest.*/
+static bool read_header(int fd, std::map<string, string> &header, string &rest) {
+    string data;
+    char buffer[4096];
+    size_t end;
+    while ((end = data.find("\n\n")) == string::npos) {
+        if (data.size() > MAX_REQUEST_HEADER)
+            return false;
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data.append(buffer, n);
+    }
+    rest = data.substr(end + 2);
+    vector<string> lines;
+    split_lines(data.substr(0, end), lines);
+    for (size_t l = 0; l < lines.size(); l++) {
+        size_t space = lines[l].find(' ');
+        if (space == string::npos)
+            header[lines[l]] = "";
+        else
+            header[lines[l].substr(0, space)] = lines[l].substr(space + 1);
+    }
+    return true;
+}
+
+/*METHOD: Parse a length field of a header*/
+static bool get_length(const std::map<string, string> &header, const string &key, size_t &length) {
+    auto it = header.find(key);
+    long long val;
+    if (it == header.end() || !py_int(it->second, val) || val < 0)
+        return false;
+    length = (size_t) val;
+    return true;
+}
+
+/*Constructor: kmer distribution files, and whether to use their binary indexes*/
+EstimationServer::EstimationServer(const vector<string> &files, bool use_index) {
+    this->use_index = use_index;
+    for (size_t i = 0; i < files.size(); i++) {
+        resident_distrib d;
+        d.file = files[i];
+        d.index = NULL;
+        d.distrib = NULL;
+        this->distribs.push_back(d);
+    }
+}
+
+EstimationServer::~EstimationServer() {
+    unload();
+}
+
+/*METHOD: Release the loaded distributions*/
+void EstimationServer::unload() {
+    for (size_t i = 0; i < this->distribs.size(); i++) {
+        delete this->distribs[i].index;
+        delete this->distribs[i].distrib;
+        this->distribs[i].index = NULL;
+        this->distribs[i].distrib = NULL;
+    }
+}
+
+/*METHOD: Load a kmer distribution to keep in memory. The binary index is kept
+ * mapped when it can be used (after writing it if it is missing or stale);
+ * otherwise the whole text file is kept.*/
+bool load_resident(resident_distrib &d, bool use_index) {
+    const string &file = d.file;
+    d.index = NULL;
+    d.distrib = new KmerDistrib();
+    KmerDistribIndex *index = new KmerDistribIndex();
+    struct stat text_stat;
+    bool ok = stat(file.c_str(), &text_stat) == 0;
+    if (ok && use_index && index->open(file + KMER_DISTRIB_INDEX_SUFFIX, text_stat)) {
+        d.index = index;
+    } else {
+        ok = ok && d.distrib->load(file, NULL, NULL, use_index);
+        //Loading the text file writes a new index if it can
+        if (ok && use_index && stat(file.c_str(), &text_stat) == 0
+                && index->open(file + KMER_DISTRIB_INDEX_SUFFIX, text_stat))
+            d.index = index;
+    }
+    if (d.index != NULL) {
+        delete d.distrib;
+        d.distrib = NULL;
+    } else {
+        delete index;
+    }
+    if (!ok) {
+        delete d.index;
+        delete d.distrib;
+        d.index = NULL;
+        d.distrib = NULL;
+    }
+    return ok;
+}
+
+/*METHOD: Distribute the reads of a parsed report with a resident kmer
+ * distribution; only the rows of the taxids in the report are read from the index*/
+void estimate_resident(const resident_distrib &d, AbundanceEstimator &estimator) {
+    if (d.index == NULL) {
+        estimator.estimate(*d.distrib);
+        return;
+    }
+    std::unordered_set<string> mapped_taxids;
+    std::unordered_set<string> genome_taxids;
+    estimator.get_needed_taxids(mapped_taxids, genome_taxids);
+    KmerDistrib kmer_distr;
+    kmer_distr.load_index(*d.index, &mapped_taxids, &genome_taxids);
+    estimator.estimate(kmer_distr);
+}
+
+/*METHOD: Load all kmer distributions. A failed reload keeps the previous databases.*/
+void EstimationServer::load() {
+    vector<resident_distrib> loaded = this->distribs;
+    for (size_t i = 0; i < loaded.size(); i++) {
+        const string &file = loaded[i].file;
+        printf("\t>> Loading %s\n", file.c_str());
+        fflush(stdout);
+        if (!load_resident(loaded[i], this->use_index)) {
+            for (size_t j = 0; j < i; j++) {
+                delete loaded[j].index;
+                delete loaded[j].distrib;
+            }
+            if (this->distribs[0].index == NULL && this->distribs[0].distrib == NULL)
+                err(1, "  cannot open %s", file.c_str());
+            warn("  cannot reload %s; keeping the loaded databases", file.c_str());
+            return;
+        }
+    }
+    unload();
+    this->distribs.swap(loaded);
+}
+
+/*METHOD: Database requested by name (the file as given or its base name; empty for the first)*/
+const resident_distrib* EstimationServer::find_distrib(const string &name) const {
+    if (name == "")
+        return &this->distribs[0];
+    for (size_t i = 0; i < this->distribs.size(); i++) {
+        const string &file = this->distribs[i].file;
+        if (file == name || file.substr(file.rfind('/') + 1) == name)
+            return &this->distribs[i];
+    }
+    return NULL;
+}
+
+/*METHOD: Accept connections until SIGINT/SIGTERM; SIGHUP reloads the databases*/
+void EstimationServer::run(const string &socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path))
+        errx(1, "  socket path too long: %s", socket_path.c_str());
+    strcpy(addr.sun_path, socket_path.c_str());
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        err(1, "  cannot create socket");
+    unlink(socket_path.c_str());
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+        err(1, "  cannot bind %s", socket_path.c_str());
+    if (listen(listen_fd, SOMAXCONN) != 0)
+        err(1, "  cannot listen on %s", socket_path.c_str());
+
+    /*Finished children are reaped automatically; signals interrupt accept()*/
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = on_reload;
+    sigaction(SIGHUP, &sa, NULL);
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("\t>> Serving %i database(s) on %s\n", (int) this->distribs.size(), socket_path.c_str());
+    fflush(stdout);
+    while (!stop_requested) {
+        if (reload_requested) {
+            reload_requested = 0;
+            printf("\t>> Reloading databases\n");
+            load();
+            fflush(stdout);
+            continue;
+        }
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            err(1, "  accept failed");
+        }
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listen_fd);
+            handle(fd);
+            close(fd);
+            exit(0);
+        }
+        if (pid < 0)
+            warn("  cannot fork for a request");
+        close(fd);
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    printf("\t>> Server stopped\n");
+}
+
+/*METHOD: Answer one request*/
+void EstimationServer::handle(int fd) {
+    std::map<string, string> header;
+    string report;
+    size_t length = 0;
+    string error = "";
+    if (!read_header(fd, header, report) || !get_length(header, "LENGTH", length) || length > MAX_REQUEST_LENGTH)
+        error = "invalid request";
+    else if (report.size() < length && !read_all(fd, report, length))
+        error = "cannot read request";
+    else if (report.size() != length)
+        error = "request shorter than LENGTH";
+    const resident_distrib *d = NULL;
+    if (error == "") {
+        d = find_distrib(header["DATABASE"]);
+        if (d == NULL)
+            error = "unknown database " + header["DATABASE"];
+    }
+    string level = header.count("LEVEL") ? header["LEVEL"] : "S";
+    string thresh = header.count("THRESHOLD") ? header["THRESHOLD"] : "10";
+    AbundanceEstimator estimator(level, thresh);
+    if (error == "") {
+        vector<string> lines;
+        split_lines(report, lines);
+        fprintf(stderr, ">> Checking report file: %s\n", header["INPUT"].c_str());
+        if (!estimator.parse_report(lines))
+            error = "not a Kraken report";
+    }
+    if (error == "") {
+        estimate_resident(*d, estimator);
+        if (!estimator.has_reads())
+            error = "no reads found. Please check your Kraken report";
+    }
+    if (error != "") {
+        string response = "STATUS ERROR " + error + "\n\n";
+        write_all(fd, response.data(), response.size());
+        return;
+    }
+    /*Write the three parts to memory*/
+    char *parts[3] = {NULL, NULL, NULL};
+    size_t sizes[3] = {0, 0, 0};
+    FILE *out = open_memstream(&parts[0], &sizes[0]);
+    estimator.print_summary(out, header["INPUT"], header["OUTPUT"]);
+    fclose(out);
+    out = open_memstream(&parts[1], &sizes[1]);
+    estimator.write_output(out);
+    fclose(out);
+    out = open_memstream(&parts[2], &sizes[2]);
+    estimator.write_report(out);
+    fclose(out);
+    string response = "STATUS OK\nSUMMARY " + std::to_string(sizes[0]) + "\nOUTPUT " + std::to_string(sizes[1])
+        + "\nREPORT " + std::to_string(sizes[2]) + "\n\n";
+    bool ok = write_all(fd, response.data(), response.size());
+    for (int i = 0; i < 3; i++) {
+        ok = ok && write_all(fd, parts[i], sizes[i]);
+        free(parts[i]);
+    }
+}
+
+/*METHOD: Send a report to a server and receive the summary, output and new report*/
+bool request_estimate(const string &socket_path, const std::map<string, string> &fields, const string &report, string &error, string &summary, string &output, string &new_report) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        error = "socket path too long: " + socket_path;
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        error = "cannot connect to " + socket_path + ": " + strerror(errno);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    string request;
+    for (auto it = fields.begin(); it != fields.end(); ++it)
+        request += it->first + " " + it->second + "\n";
+    request += "LENGTH " + std::to_string(report.size()) + "\n\n";
+    bool ok = write_all(fd, request.data(), request.size()) && write_all(fd, report.data(), report.size());
+    shutdown(fd, SHUT_WR);
+    std::map<string, string> header;
+    string body;
+    ok = ok && read_header(fd, header, body) && read_all(fd, body, (size_t) -1);
+    close(fd);
+    if (!ok || header.count("STATUS") == 0) {
+        error = "no response from " + socket_path;
+        return false;
+    }
+    if (header["STATUS"] != "OK") {
+        error = (header["STATUS"].compare(0, 6, "ERROR ") == 0) ? header["STATUS"].substr(6) : header["STATUS"];
+        return false;
+    }
+    size_t sizes[3];
+    if (!get_length(header, "SUMMARY", sizes[0]) || !get_length(header, "OUTPUT", sizes[1])
+            || !get_length(header, "REPORT", sizes[2]) || sizes[0] + sizes[1] + sizes[2] != body.size()) {
+        error = "invalid response from " + socket_path;
+        return false;
+    }
+    summary = body.substr(0, sizes[0]);
+    output = body.substr(sizes[0], sizes[1]);
+    new_report = body.substr(sizes[0] + sizes[1], sizes[2]);
+    return true;
+}
@@ -0,0 +1,76 @@
+/*********************************************************************
+ * estimation_server.h is used as part of the bracken_est program
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef ESTIMATION_SERVER_H
+#define ESTIMATION_SERVER_H
+
+#include "kmer2read_headers.h"
+#include "abundance_estimation.h"
+
+/*A kmer distribution kept resident by the server*/
+struct resident_distrib {
+    string file;
+    /*Binary index of the file, or (if none can be used) the whole file*/
+    KmerDistribIndex *index;
+    KmerDistrib *distrib;
+};
+
+/* Class serving abundance estimates over a Unix domain socket.
+ * The kmer distributions stay loaded (as mapped binary indexes when
+ * possible) and each connection is handled by a forked child, which sees
+ * the databases as they were when it was accepted. SIGHUP reloads the
+ * databases between connections; connections arriving meanwhile wait in
+ * the listen queue.
+ *
+ * Request:  header lines "KEY VALUE" (LEVEL, THRESHOLD, DATABASE, INPUT,
+ *           OUTPUT, LENGTH), an empty line, then LENGTH bytes of report.
+ * Response: "STATUS OK" and the lengths SUMMARY, OUTPUT and REPORT, an
+ *           empty line, then the three parts; or "STATUS ERROR message".
+ */
+class EstimationServer {
+    public:
+        EstimationServer(const vector<string> &, bool);
+        ~EstimationServer();
+        /*Load (or reload) all kmer distributions*/
+        void load();
+        /*Accept connections until SIGINT/SIGTERM*/
+        void run(const string &);
+    private:
+        void unload();
+        void handle(int);
+        const resident_distrib* find_distrib(const string &) const;
+
+        vector<resident_distrib> distribs;
+        bool use_index;
+};
+
+/*Load a kmer distribution to keep resident; estimate a parsed report with it*/
+bool load_resident(resident_distrib &, bool);
+void estimate_resident(const resident_distrib &, AbundanceEstimator &);
+
+/*Send a report to a server; false (with a message) on failure*/
+bool request_estimate(const string &, const std::map<string, string> &, const string &, string &, string &, string &, string &);
+
+/*Largest request header and report accepted by the server*/
+#define MAX_REQUEST_HEADER (1 << 16)
+#define MAX_REQUEST_LENGTH ((size_t) 1 << 32)
+
+#endif
@@ -32,41 +32,100 @@ void parse_command_line(int argc, char **argv);
 void usage(int exit_code=0);
 
 /*Function Declarations*/ 
-void construct_taxonomy(const string, taxonomy *);
-void get_seqid2taxid(string, map<string, int> *); 
+void split_list(const string &, vector<string> &);
+void read_list(const string &, vector<string> &);
+int merge_parts(int argc, char **argv);
+void get_seqid2taxid(string, SeqidIndex *);
 /*Variables - Remains Constant*/
 int num_threads = 1; 
 int kmer_len = 31;
-int read_len = 100; 
+bool kmer_len_given = false;
+vector<int> read_lens;
 string taxid_file = "";
 string seqid_file = "";
 string kraken_file = ""; 
-string output_file = "";
+vector<string> output_files;
+vector<string> distrib_files;
+bool ordered_output = false;
+bool taxonomy_cache = true;
+bool distrib_index = true;
+string store_file = "";
+int shard = 0;
+int n_shards = 0;
+size_t max_memory = 0;
+size_t cache_size = 0;
+bool dedup_lines = false;
+string kraken2_db = "";
+vector<string> library_files;
 /*Other Program variables*/
-map<string, int> seqid2taxid;
-taxonomy *my_taxonomy = new taxonomy();
-map<int, taxonomy *> taxid2node;
+SeqidIndex seqid2taxid;
+Kraken2Database k2_database;
+taxonomy my_taxonomy;
 /*Main Driver Program*/
 int main(int argc, char *argv[]) {
     /*set Default number of threads*/    
     omp_set_num_threads(1);
+    if (argc > 1 && strcmp(argv[1], "merge") == 0)
+        return merge_parts(argc - 1, argv + 1);
     
     /*Parse command line*/
     printf("\t>>STEP 0: PARSING COMMAND LINE ARGUMENTS\n");
     parse_command_line(argc, argv);  
+    if (kraken2_db != "") {
+        if (!k2_database.open(kraken2_db))
+            errx(1, "  cannot open Kraken 2 database: %s", k2_database.get_error().c_str());
+        if (kmer_len_given && kmer_len != k2_database.get_kmer_len())
+            errx(1, "  --kmerlen %i does not match the Kraken 2 database (built with %imers)", kmer_len, k2_database.get_kmer_len());
+        kmer_len = k2_database.get_kmer_len();
+    }
     printf("\t\tTaxonomy nodes file: %s\n", taxid_file.c_str());
     printf("\t\tSeqid file:          %s\n", seqid_file.c_str());
     printf("\t\tNum Threads:         %i\n", num_threads);
     printf("\t\tKmer Length:         %i\n", kmer_len);
-    printf("\t\tRead Length:         %i\n", read_len);
+    printf("\t\tRead Length:         ");
+    for (size_t r = 0; r < read_lens.size(); r++)
+        printf("%s%i", (r > 0) ? "," : "", read_lens[r]);
+    printf("\n");
+    printf("\t\tOrdered Output:      %s\n", ordered_output ? "yes" : "no");
+    if (store_file != "")
+        printf("\t\tStore file:          %s\n", store_file.c_str());
+    if (n_shards > 0)
+        printf("\t\tShard:               %i/%i\n", shard + 1, n_shards);
+    if (max_memory > 0)
+        printf("\t\tMax read memory:     %llu MB\n", (unsigned long long) max_memory >> 20);
+    if (cache_size > 0)
+        printf("\t\tClassify cache:      %llu MB per thread\n", (unsigned long long) cache_size >> 20);
+    if (dedup_lines)
+        printf("\t\tDeduplicate:         identical kmer lines\n");
+    if (kraken2_db != "") {
+        printf("\t\tKraken 2 database:   %s\n", kraken2_db.c_str());
+        printf("\t\tLibrary files:       %i\n", (int) library_files.size());
+    }
     
     //Time Vals
     struct timeval ta, tb, tresult; 
     gettimeofday (&ta, NULL); 
     /*Construct taxonomy*/
     get_seqid2taxid(seqid_file, &seqid2taxid);
-    construct_taxonomy(taxid_file, my_taxonomy);
-    evaluate_kfile(kraken_file, output_file, my_taxonomy, &taxid2node, seqid2taxid, kmer_len, read_len);
+    if (!construct_taxonomy(taxid_file, &my_taxonomy, taxonomy_cache)) {
+        printf("  cannot open %s", taxid_file.c_str());
+        usage(1);
+    }
+    convert_options options;
+    options.output_files = output_files;
+    options.distrib_files = distrib_files;
+    options.ordered = ordered_output;
+    options.distrib_index = distrib_index;
+    options.store_file = store_file;
+    options.shard = shard;
+    options.n_shards = n_shards;
+    options.max_memory = max_memory;
+    options.cache_size = cache_size;
+    options.dedup = dedup_lines;
+    if (kraken2_db != "")
+        evaluate_library(k2_database, library_files, &my_taxonomy, &seqid2taxid, read_lens, options);
+    else
+        evaluate_kfile(kraken_file, &my_taxonomy, &seqid2taxid, kmer_len, read_lens, options);
     gettimeofday( &tb, NULL);
     timeval_subtract(&tresult, &tb, &ta);
     int minutes = int (tresult.tv_sec / 60);
@@ -94,6 +153,18 @@ void parse_command_line(int argc, char **argv) {
         {"threads",     required_argument, 0, 't'},
         {"kmerlen",     required_argument, 0, 'k'},
         {"readlen",     required_argument, 0, 'l'},
+        {"ordered",     no_argument, 0, 'O'},
+        {"no-taxonomy-cache", no_argument, 0, 'C'},
+        {"no-distrib-index", no_argument, 0, 'I'},
+        {"distrib",     required_argument, 0, 'D'},
+        {"store",       required_argument, 0, 'S'},
+        {"shard",       required_argument, 0, 'P'},
+        {"max-memory",  required_argument, 0, 'M'},
+        {"classify-cache", required_argument, 0, 'Q'},
+        {"dedup",       no_argument, 0, 'U'},
+        {"kraken2-db",  required_argument, 0, 'd'},
+        {"library",     required_argument, 0, 'L'},
+        {"library-list", required_argument, 0, 'F'},
         {0, 0}
         };
     /*Process arguments*/
@@ -129,8 +200,14 @@ void parse_command_line(int argc, char **argv) {
                 }*/
                 break;
             case 'o':
-                /*Output file name*/
-                output_file = optarg;
+                /*Output file names (one per read length)*/
+                output_files.clear();
+                split_list(optarg, output_files);
+                break;
+            case 'D':
+                /*kmer_distrib file names (one per read length)*/
+                distrib_files.clear();
+                split_list(optarg, distrib_files);
                 break;
             case 'c':
                 /*database.kraken file*/
@@ -143,11 +220,23 @@ void parse_command_line(int argc, char **argv) {
                 }*/
                 break;
             case 'l':
-                /*check negative kmer length*/
-                /*do not allow kmer lengths <= 1*/
-                read_len = atoi(optarg);
-                if (read_len <= 1) {
-                    errx(1, "  read lengths must be >= 1\n");
+                /*comma-separated list of read lengths*/
+                /*do not allow read lengths <= 1*/
+                read_lens.clear();
+                {
+                    vector<string> lens;
+                    split_list(optarg, lens);
+                    for (size_t r = 0; r < lens.size(); r++) {
+                        int read_len = atoi(lens[r].c_str());
+                        if (read_len <= 1) {
+                            errx(1, "  read lengths must be >= 1\n");
+                            usage(1);
+                        }
+                        read_lens.push_back(read_len);
+                    }
+                }
+                if (read_lens.empty() || read_lens.size() > MAX_READ_LENGTHS) {
+                    errx(1, "  must give between 1 and %i read lengths\n", MAX_READ_LENGTHS);
                     usage(1);
                 }
                 break;
@@ -155,11 +244,75 @@ void parse_command_line(int argc, char **argv) {
                 /*check negative kmer length*/
                 /*do not allow kmer lengths <= 1*/
                 kmer_len = atoi(optarg);
+                kmer_len_given = true;
                 if (kmer_len <= 1) {
                     errx(1, "  kmer lengths must be >= 1\n");
                     usage(1);
                 }
                 break;
+            case 'O':
+                /*keep output lines in database.kraken order*/
+                ordered_output = true;
+                break;
+            case 'C':
+                /*always parse nodes.dmp*/
+                taxonomy_cache = false;
+                break;
+            case 'I':
+                /*only write the text kmer distribution*/
+                distrib_index = false;
+                break;
+            case 'S':
+                /*read mappings kept between runs*/
+                store_file = optarg;
+                break;
+            case 'P':
+                /*shard i/N (1 <= i <= N)*/
+                {
+                    int i = 0, n = 0;
+                    char extra;
+                    if (sscanf(optarg, "%d/%d%c", &i, &n, &extra) != 2 || n < 1 || i < 1 || i > n) {
+                        errx(1, "  --shard must be i/N with 1 <= i <= N\n");
+                        usage(1);
+                    }
+                    shard = i - 1;
+                    n_shards = n;
+                }
+                break;
+            case 'M':
+                /*stream the kraken file through read buffers of at most this many MB*/
+                intval = atoi(optarg);
+                if (intval <= 0) {
+                    errx(1, "  --max-memory must be a positive number of MB");
+                    usage(1);
+                }
+                max_memory = (size_t) intval << 20;
+                break;
+            case 'Q':
+                /*cache the classification of recent windows in this many MB per thread*/
+                intval = atoi(optarg);
+                if (intval <= 0) {
+                    errx(1, "  --classify-cache must be a positive number of MB");
+                    usage(1);
+                }
+                cache_size = (size_t) intval << 20;
+                break;
+            case 'U':
+                /*convert each distinct kmer line once*/
+                dedup_lines = true;
+                break;
+            case 'd':
+                /*Kraken 2 database folder (hash.k2d, opts.k2d, taxo.k2d)*/
+                kraken2_db = optarg;
+                break;
+            case 'L':
+                /*library FASTA files classified with the Kraken 2 database*/
+                split_list(optarg, library_files);
+                break;
+            case 'F':
+                /*file listing library FASTA files, one per line*/
+                read_list(optarg, library_files);
+                break;
             case 't':
                 intval = atoi(optarg);
                 /*check negative number of threads*/
@@ -187,18 +340,41 @@ void parse_command_line(int argc, char **argv) {
     } else if (seqid_file == "") {
         printf("  Must specify --seqid2taxid file!\n");
         usage(1);
-    } else if (kraken_file == "") {
+    } else if (kraken_file == "" && kraken2_db == "") {
         printf("  Must specify --kraken file! (database.kraken file)\n");
         usage(1);
-    } else if (output_file == "") {
-        printf("  Must specify --output file!\n");
+    } else if (kraken_file != "" && kraken2_db != "") {
+        printf("  Must specify only one of --kraken and --kraken2-db!\n");
+        usage(1);
+    } else if (kraken2_db != "" && library_files.empty()) {
+        printf("  Must specify the --library files of the --kraken2-db database!\n");
+        usage(1);
+    } else if (kraken2_db != "" && (n_shards > 0 || max_memory > 0 || dedup_lines)) {
+        printf("  --shard, --max-memory and --dedup read a --kraken file!\n");
+        usage(1);
+    } else if (store_file != "" && n_shards > 0) {
+        printf("  --store cannot be used with --shard (shards would overwrite each other's store)!\n");
+        usage(1);
+    } else if (output_files.empty() && distrib_files.empty()) {
+        printf("  Must specify --output and/or --distrib file!\n");
+        usage(1);
+    }
+    if (read_lens.empty())
+        read_lens.push_back(100);
+    if (!output_files.empty() && output_files.size() != read_lens.size()) {
+        printf("  Must specify one --output file per read length!\n");
+        usage(1);
+    } else if (!distrib_files.empty() && distrib_files.size() != read_lens.size()) {
+        printf("  Must specify one --distrib file per read length!\n");
         usage(1);
     }
+    output_files.resize(read_lens.size());
+    distrib_files.resize(read_lens.size());
     /*check if files exists*/
     //taxid_file = "taxonomy/nodes.dmp";
     ifstream test1(taxid_file.c_str());
     ifstream test2(seqid_file.c_str());
-    ifstream test3(kraken_file.c_str());
+    ifstream test3((kraken2_db != "") ? library_files[0].c_str() : kraken_file.c_str());
     if (!test1.is_open()) {
         printf("  %s does not exist",taxid_file.c_str());
         usage(1);
@@ -206,7 +382,7 @@ void parse_command_line(int argc, char **argv) {
         printf("  %s does not exist",seqid_file.c_str());
         usage(1);
     } else if (!test3.is_open()) {
-        printf("  %s does not exist",kraken_file.c_str());
+        printf("  %s does not exist",(kraken2_db != "") ? library_files[0].c_str() : kraken_file.c_str());
         usage(1);
     }
 }
@@ -227,148 +403,201 @@ void usage(int exit_code) {
         << "                            (typically downloaded with the Kraken taxonomy)" << endl
         << "     --kraken FILE          kraken file of all classifications of all library" << endl
         << "                            sequences (typically database.kraken)" << endl
-        << "     --output FILE          name of an output file to print read distributions to" << endl
+        << "     --output FILE[,FILE]   name of an output file to print read distributions to" << endl
         << "                            (suggested name: databaseXmers.kraken_cnts)" << endl
+        << "                            give one file per read length, in the same order" << endl
+        << "     --distrib FILE[,FILE]  name of a kmer distribution file to write directly" << endl
+        << "                            (suggested name: databaseXmers.kmer_distrib)" << endl
+        << "                            --output is optional when --distrib is given" << endl
         << "  *Optional Parameters" << endl
         << "     -k NUM                 kmer length used to build Kraken database" << endl
         << "                            (default = 31)" << endl
-        << "     -l NUM                 read length (evaluate every l-length read)" << endl
-        << "                            (default = 100)" << endl
+        << "     -l NUM[,NUM]           read length (evaluate every l-length read)" << endl
+        << "                            (default = 100); a comma-separated list evaluates" << endl
+        << "                            several read lengths in a single pass" << endl
         << "     -t NUM                 number of threads" << endl
         << "                            (default = 1)" << endl
-        << "  User must specify --seqid2taxid, --taxonomy, --kraken, and --output options" 
+        << "     --ordered              write output lines in the same order as the" << endl
+        << "                            kraken file (reproducible output with -t > 1)" << endl
+        << "     --no-taxonomy-cache    parse nodes.dmp instead of loading (and writing)" << endl
+        << "                            the binary taxonomy cache nodes.dmp" TAXONOMY_CACHE_SUFFIX << endl
+        << "     --no-distrib-index     do not write the binary index FILE" KMER_DISTRIB_INDEX_SUFFIX " of each" << endl
+        << "                            --distrib FILE (used by bracken_est)" << endl
+        << "     --store FILE           reuse the read mappings of sequences whose kmer line" << endl
+        << "                            is unchanged since an earlier run, then add the" << endl
+        << "                            sequences of this run to FILE" << endl
+        << "     --shard i/N            only evaluate the i-th of N parts of the kraken file;" << endl
+        << "                            each --distrib FILE then holds partial counts" << endl
+        << "                            (not with --store)" << endl
+        << "     --max-memory MB        stream the kraken file through read buffers of at" << endl
+        << "                            most MB megabytes instead of mapping it whole, and" << endl
+        << "                            drop the text read from the page cache" << endl
+        << "     --classify-cache MB    remember the classification of recent windows (by" << endl
+        << "                            their taxon counts) in MB megabytes per thread and" << endl
+        << "                            report the hit rate" << endl
+        << "     --dedup                convert sequences with identical kmer lines once" << endl
+        << "                            and give the others the same read mappings" << endl
+        << "                            (uncompressed file without --max-memory only)" << endl
+        << "  Classifying the library directly (instead of --kraken):" << endl
+        << "     --kraken2-db FOLDER    Kraken 2 database folder (hash.k2d, opts.k2d and" << endl
+        << "                            taxo.k2d) used to classify the library sequences" << endl
+        << "                            (its kmer length is used; a different --kmerlen" << endl
+        << "                            is an error)" << endl
+        << "     --library FILE[,FILE]  library FASTA files (plain or gzipped) the" << endl
+        << "                            database was built from (may be repeated)" << endl
+        << "     --library-list FILE    file naming one library FASTA file per line (for" << endl
+        << "                            names holding commas)" << endl
+        << "  Merging shards:" << endl
+        << "     kmer2read_distr merge --distrib FILE [--no-distrib-index] PART [PART ...]" << endl
+        << "                            write the kmer distribution file of all N partial" << endl
+        << "                            files of one read length (identical to a single run)" << endl
+        << "  User must specify --seqid2taxid, --taxonomy, --kraken (or --kraken2-db and" << endl
+        << "  --library), and --output and/or --distrib options" 
         << endl;
     cerr << "---------------------------------------------------------------------------" << endl;
     cerr << endl;
     exit(exit_code);
 }
 
-/*METHOD: Use the nodes.dmp to construct the taxonomy!*/ 
-//MUST MAKE TAXONOMY HEADER/STRUCTURE
-//copy method of building from python folder
-void construct_taxonomy(const string t_file, taxonomy *my_taxonomy) {
-    /*Initialize variables*/
-    int pos1, pos2, pos3;
-    int n_count = 0;
-    string line;
-    int curr_taxid = 0;
-    int curr_parent = 0;
-    taxonomy *curr_node;
-    string rank = "";
-    map<int, map<int, taxonomy *>> parent2kids; 
-    /*Read through file line by line*/
-    ifstream nodefile (t_file);
-    if (nodefile.is_open()){
-        printf("\t>>STEP 2: READING NODES.DMP FILE\n");
-        printf("\t\t0 nodes read");
-        while(getline(nodefile, line)) {
-            n_count += 1;
-            if (n_count % 1000 == 0) 
-                printf("\r\t\t%i nodes read", n_count);
-            //Find delimiter indices
-            pos1 = line.find("\t|\t");
-            pos2 = line.find("\t|\t", pos1+1);
-            pos3 = line.find("\t|\t", pos2+1);
-            //Extract taxid, parent, and rank information
-            curr_taxid = atoi(line.substr(0, pos1).c_str());
-            curr_parent = atoi(line.substr(pos1+3, pos2-pos1-3).c_str()); 
-            rank = line.substr(pos2+3, pos3-pos2-3); 
-            //Set Node information
-            if (curr_taxid == 1) {
-                curr_node = new taxonomy(curr_taxid, rank);
-                my_taxonomy = curr_node;
-                curr_node->set_lvl_num(1);
-                taxid2node[curr_taxid] = curr_node;
-            } else {
-                if (taxid2node.find(curr_parent) == taxid2node.end()) {
-                    //Parent does not exist
-                    //Create node and insert into both vectors
-                    curr_node = new taxonomy(curr_taxid, rank);
-                    taxid2node[curr_taxid] = curr_node;
-                    parent2kids[curr_parent][curr_taxid] = curr_node;
-                } else {
-                    //Parent does exist
-                    curr_node = new taxonomy(curr_taxid, rank, taxid2node[curr_parent]);
-                    taxid2node[curr_taxid] = curr_node;
-                    taxid2node[curr_parent]->add_child(curr_node);
-                }
-            }
+/*METHOD: Merge the partial kmer distributions of all shards of one read length
+ * into the kmer distribution file a single run would have written*/
+int merge_parts(int argc, char **argv) {
+    static struct option merge_options[] = {
+        {"distrib",     required_argument, 0, 'D'},
+        {"no-distrib-index", no_argument, 0, 'I'},
+        {"help",        no_argument, 0, 'h'},
+        {0, 0}
+        };
+    string out_file = "";
+    int opt;
+    int option_index = 0;
+    while ((opt = getopt_long(argc, argv, "h", merge_options, &option_index)) != -1) {
+        switch(opt) {
+            case 'D':
+                out_file = optarg;
+                break;
+            case 'I':
+                distrib_index = false;
+                break;
+            case 'h':
+                usage(0);
+                break;
+            default:
+                usage(1);
+                break;
         }
-        printf("\r\t\t%i total nodes read\n", n_count);
-        nodefile.close();
-    } else {
-        printf("  cannot open %s", t_file.c_str());  
-        usage(1); 
     }
-    // printf("\t>>STEP 2.2: LINKING PARENTS/CHILDREN TAXONS\n");
-    /*Traverse through parent array and make sure all parents/children are linked*/ 
-    map<int, taxonomy *> children;
-    taxonomy * parent; 
-    for (auto const& pair : parent2kids) {
-        curr_parent = pair.first;
-        parent = taxid2node[curr_parent];
-        children = pair.second;
-        for(auto const& child : children) {
-            curr_taxid = child.first;
-            taxid2node[curr_taxid]->add_parent(parent);
-            parent->add_child(taxid2node[curr_taxid]);
-        }
+    if (out_file == "" || optind >= argc) {
+        printf("  Must specify --distrib file and the partial files to merge!\n");
+        usage(1);
     }
-    /*Traverse through entire tree and set level numbers */
-    //printf("\t>>STEP 2.3: SETTING LEVELS\n");
-    n_count = 1;
-    //printf("\t\t%i node updated", n_count);
-    queue<taxonomy *> curr_nodes;
-    //Start with root'schildren
-    my_taxonomy->set_lvl_num(1);
-    vector<taxonomy *> retrieve_nodes = my_taxonomy->get_children();
-    for(taxonomy * add_n: retrieve_nodes) { 
-        curr_nodes.push(add_n);
+    int n_parts = argc - optind;
+    printf("\t>>MERGING %i PARTIAL KMER DISTRIBUTION FILES\n", n_parts);
+    vector<KmerDistribution> parts(n_parts);
+    vector<distrib_part_info> infos(n_parts);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int p = 0; p < n_parts; p++) {
+        if (!parts[p].read_part(argv[optind + p], infos[p]))
+            errx(1, "  %s is not a partial kmer distribution file", argv[optind + p]);
     }
-    //Iterate over all children in order
-    while (!curr_nodes.empty()) {
-        n_count += 1;
-        //if (n_count % 1000 == 0) 
-        //    printf("\r\t\t%i nodes updated", n_count);
-        curr_node = curr_nodes.front();
-        curr_nodes.pop();
-        curr_node->set_lvl_num(curr_node->get_parent()->get_lvl_num() + 1);
-        //Add this node's children
-        retrieve_nodes = curr_node->get_children();
-        for(taxonomy * add_n: retrieve_nodes) {
-            curr_nodes.push(add_n);
-        }
+    /*Every shard of the same kraken file and read length exactly once*/
+    vector<int> seen(infos[0].n_shards, 0);
+    for (int p = 0; p < n_parts; p++) {
+        const distrib_part_info &info = infos[p];
+        if (info.kmer_len != infos[0].kmer_len || info.read_len != infos[0].read_len
+                || info.n_shards != infos[0].n_shards || info.kraken_size != infos[0].kraken_size)
+            errx(1, "  %s does not belong to the same run as %s", argv[optind + p], argv[optind]);
+        if (info.shard < 0 || info.shard >= info.n_shards || seen[info.shard]++)
+            errx(1, "  shard %i/%i is given more than once", info.shard + 1, info.n_shards);
+    }
+    for (int s = 0; s < infos[0].n_shards; s++) {
+        if (!seen[s])
+            errx(1, "  shard %i/%i is missing", s + 1, infos[0].n_shards);
+    }
+    printf("\t\t%imers, with a database built using %imers\n", infos[0].read_len, infos[0].kmer_len);
+    printf("\t>>CREATING KMER DISTRIBUTION FILE %s\n", out_file.c_str());
+    KmerDistribution distrib;
+    distrib.merge(parts);
+    if (!distrib.write(out_file, distrib_index))
+        err(1, "  cannot write %s", out_file.c_str());
+    return 0;
+}
+
+/*METHOD: Split a comma-separated option value*/
+void split_list(const string &value, vector<string> &items) {
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t end = value.find(',', start);
+        if (end == string::npos)
+            end = value.size();
+        items.push_back(value.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+/*METHOD: Add the non-empty lines of a list file*/
+void read_list(const string &list_file, vector<string> &items) {
+    ifstream list(list_file.c_str());
+    if (!list.is_open())
+        err(1, "  cannot open %s", list_file.c_str());
+    string line;
+    while (getline(list, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (!line.empty())
+            items.push_back(line);
     }
-    //printf("\r\t\t%i total nodes updated\n", n_count);
 }
 
 /*METHOD: Create map of seqids to taxonomy ids from the seqid2taxid file*/
-void get_seqid2taxid(string s_file, map<string, int> *seqid2taxid) {
+void get_seqid2taxid(string s_file, SeqidIndex *seqid2taxid) {
+    /*Map the file and index each line without copying it*/
+    int fd = open(s_file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        printf("  cannot open %s", s_file.c_str());
+        usage(1);
+    }
+    struct stat sb;
+    fstat(fd, &sb);
+    size_t dataSize = sb.st_size;
+    const char *data = NULL;
+    if (dataSize > 0) {
+        data = static_cast<const char *>(mmap(NULL, dataSize, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (data == MAP_FAILED)
+            err(1, "  cannot read %s", s_file.c_str());
+    }
     /*Read through file line by line*/
     int s_count = 0;
-    int curr_taxid, pos1, pos2;
-    string curr_seqid, line;
-    ifstream mapfile (s_file);
-    if (mapfile.is_open()){
-        printf("\t>>STEP 1: READING SEQID2TAXID MAP\n");
-        printf("\t\t0 sequences read");
-        while(getline(mapfile, line)) {
-            s_count += 1;
-            if (s_count % 1000 == 0) 
-                printf("\r\t\t%i sequences read", s_count);
-            //Find delimiter indices
-            pos1 = line.find("\t");
-            pos2 = line.find("\n");
-            //Extract seqid and taxid 
-            curr_seqid = line.substr(0, pos1);
-            curr_taxid = atoi(line.substr(pos1+1, pos2-pos1).c_str()); 
-            //Save in map
-            seqid2taxid->insert(std::pair<string,int>(curr_seqid, curr_taxid));
-        }
-        printf("\r\t\t%i total sequences read\n", s_count);
-    } else {
-        printf("  cannot open %s", s_file.c_str());  
-        usage(1); 
+    printf("\t>>STEP 1: READING SEQID2TAXID MAP\n");
+    printf("\t\t0 sequences read");
+    const char *lineStart = data;
+    const char *dataEnd = data + dataSize;
+    while (lineStart < dataEnd) {
+        const char *lineEnd = static_cast<const char *>(memchr(lineStart, '\n', dataEnd - lineStart));
+        if (lineEnd == NULL)
+            lineEnd = dataEnd;
+        s_count += 1;
+        if (s_count % 1000 == 0) 
+            printf("\r\t\t%i sequences read", s_count);
+        //Find delimiter index
+        const char *tab = static_cast<const char *>(memchr(lineStart, '\t', lineEnd - lineStart));
+        const char *seqidEnd = (tab == NULL) ? lineEnd : tab;
+        const char *taxidStart = (tab == NULL) ? lineStart : tab + 1;
+        //Extract taxid (same rules as atoi)
+        while (taxidStart < lineEnd && isspace(*taxidStart))
+            taxidStart++;
+        bool negative = (taxidStart < lineEnd && *taxidStart == '-');
+        if (taxidStart < lineEnd && (*taxidStart == '-' || *taxidStart == '+'))
+            taxidStart++;
+        int curr_taxid = 0;
+        while (taxidStart < lineEnd && *taxidStart >= '0' && *taxidStart <= '9')
+            curr_taxid = curr_taxid * 10 + (*taxidStart++ - '0');
+        //Save in index
+        seqid2taxid->insert(lineStart, seqidEnd - lineStart, negative ? -curr_taxid : curr_taxid);
+        lineStart = lineEnd + 1;
     }
+    printf("\r\t\t%i total sequences read\n", s_count);
+    if (data != NULL)
+        munmap(const_cast<char *>(data), dataSize);
+    close(fd);
 }
-
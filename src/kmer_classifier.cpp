@@ -0,0 +1,314 @@
+/*********************************************************************
+ * kmer_classifier.cpp is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "kmer_classifier.h"
+
+/*Constructor: window of n_kmers kmers (at most n_kmers distinct taxa)*/
+KmerClassifier::KmerClassifier(int n_kmers, const taxonomy *my_taxonomy) {
+    this->my_taxonomy = my_taxonomy;
+    this->root_index = my_taxonomy->get_root();
+    this->n_kmers = max(n_kmers, 1);
+    this->n_words = (this->n_kmers + 63) / 64;
+    this->run_slot.assign(this->n_kmers, SLOT_NONE);
+    this->run_len.assign(this->n_kmers, 0);
+    this->slot_count.assign(this->n_kmers, 0);
+    this->slot_score.assign(this->n_kmers, 0);
+    this->slot_desc.assign((size_t) this->n_kmers * this->n_words, 0);
+    this->slot_hash.assign(this->n_kmers, 0);
+    this->active_slots.reserve(this->n_kmers);
+    this->active_taxa.reserve(this->n_kmers);
+    this->cache = NULL;
+    reset();
+}
+
+/*Constructor: the cache is empty until init is called*/
+ClassifyCache::ClassifyCache() {
+    this->mask = 0;
+    this->lookups = 0;
+    this->hits = 0;
+}
+
+/*METHOD: Allocate a power of 2 entries within cache_bytes*/
+void ClassifyCache::init(size_t cache_bytes) {
+    size_t n = 1;
+    while (2 * n * sizeof(cache_entry) <= cache_bytes)
+        n *= 2;
+    //Key 0 is the sum of an empty window, which is never looked up
+    cache_entry empty = {0, 0};
+    this->entries.assign(n, empty);
+    this->mask = n - 1;
+}
+
+size_t ClassifyCache::get_memory() const {
+    return this->entries.size() * sizeof(cache_entry);
+}
+
+uint64_t ClassifyCache::get_lookups() const {
+    return this->lookups;
+}
+
+uint64_t ClassifyCache::get_hits() const {
+    return this->hits;
+}
+
+/*Hash of a taxon in window keys (splitmix64 finalizer)*/
+static inline uint64_t taxon_hash(int taxon) {
+    uint64_t x = (uint64_t) (uint32_t) taxon + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/*METHOD: Look up and store window classifications in a cache (NULL for none)*/
+void KmerClassifier::set_cache(ClassifyCache *cache) {
+    this->cache = cache;
+}
+
+/*METHOD: Add the next count kmers of the sequence, dropping the oldest kmers once
+ * the window is full, and count the classification of every full window.
+ * TAXON_NONE marks unclassified or ambiguous kmers.*/
+void KmerClassifier::add_run(int taxon, int count, TaxidCounts &taxids_mapped) {
+    while (count > 0) {
+        int slot = SLOT_NONE;
+        bool is_new = false;
+        if (taxon != TAXON_NONE) {
+            if (taxon == this->root_index) {
+                slot = SLOT_ROOT;
+            } else {
+                slot = find_slot(taxon);
+                is_new = (slot == SLOT_NONE);
+            }
+        }
+        int n_added = 1;
+        if (!window_full()) {
+            //Fill the window; nothing is classified until it is full
+            n_added = min(count, this->n_kmers - this->window_size);
+            if (is_new)
+                slot = activate(taxon);
+            push_back(slot, n_added);
+            count -= n_added;
+            if (!window_full())
+                continue;
+            n_added = 1;
+        } else if (!is_new && this->run_slot[this->run_start] == slot) {
+            //Same kmers leave and enter: the window composition is unchanged
+            n_added = min(count, this->run_len[this->run_start]);
+            shift_runs(n_added);
+            append_run(slot, n_added);
+            count -= n_added;
+        } else {
+            //Slide by one kmer
+            pop_front(1);
+            if (is_new)
+                slot = activate(taxon);
+            push_back(slot, 1);
+            count -= 1;
+        }
+        taxids_mapped.add(classify(), n_added);
+    }
+}
+
+/*METHOD: Append n kmers of a slot to the run buffer*/
+void KmerClassifier::append_run(int slot, int n) {
+    int last = (this->run_start + this->n_runs - 1) % this->n_kmers;
+    if (this->n_runs > 0 && this->run_slot[last] == slot) {
+        this->run_len[last] += n;
+    } else {
+        last = (this->run_start + this->n_runs) % this->n_kmers;
+        this->run_slot[last] = slot;
+        this->run_len[last] = n;
+        this->n_runs += 1;
+    }
+}
+
+/*METHOD: Drop n kmers (all from the first run) from the run buffer*/
+int KmerClassifier::shift_runs(int n) {
+    int slot = this->run_slot[this->run_start];
+    this->run_len[this->run_start] -= n;
+    if (this->run_len[this->run_start] == 0) {
+        this->run_start = (this->run_start + 1) % this->n_kmers;
+        this->n_runs -= 1;
+    }
+    return slot;
+}
+
+/*METHOD: Append n kmers of a slot to the window*/
+void KmerClassifier::push_back(int slot, int n) {
+    append_run(slot, n);
+    if (slot >= 0)
+        add_to_slot(slot, n);
+    else if (slot == SLOT_ROOT)
+        this->root_count += n;
+    this->window_size += n;
+    this->changed = true;
+}
+
+/*METHOD: Drop the n oldest kmers (all from the first run) of the window*/
+int KmerClassifier::pop_front(int n) {
+    int slot = shift_runs(n);
+    if (slot >= 0)
+        remove_from_slot(slot, n);
+    else if (slot == SLOT_ROOT)
+        this->root_count -= n;
+    this->window_size -= n;
+    this->changed = true;
+    return slot;
+}
+
+/*METHOD: Empty the window before the next sequence*/
+void KmerClassifier::reset() {
+    this->run_start = 0;
+    this->n_runs = 0;
+    this->window_size = 0;
+    this->root_count = 0;
+    for (size_t i = 0; i < this->active_slots.size(); i++) {
+        this->slot_count[this->active_slots[i]] = 0;
+    }
+    this->active_slots.clear();
+    this->active_taxa.clear();
+    this->free_slots.clear();
+    for (int s = this->n_kmers - 1; s >= 0; s--)
+        this->free_slots.push_back(s);
+    this->changed = true;
+    this->last_taxid = 0;
+    this->window_hash = 0;
+}
+
+/*METHOD: Classify the current window*/
+int KmerClassifier::classify() {
+    if (!this->changed)
+        return this->last_taxid;
+    int max_taxid = 0;
+    if (this->active_slots.empty()) {
+        //Only root/unclassified kmers in the window
+        max_taxid = (this->root_count > 0) ? 1 : 0;
+    } else if (this->cache == NULL || this->active_slots.size() < CLASSIFY_CACHE_MIN_TAXA) {
+        max_taxid = score_window();
+    } else if (!this->cache->find(this->window_hash, max_taxid)) {
+        max_taxid = score_window();
+        this->cache->insert(this->window_hash, max_taxid);
+    }
+    this->changed = false;
+    this->last_taxid = max_taxid;
+    return max_taxid;
+}
+
+/*METHOD: Taxid with the highest root-to-leaf score among the active taxa
+ * (root kmers only matter when no other taxon is in the window)*/
+int KmerClassifier::score_window() const {
+    int max_score = 0;
+    int max_taxon = TAXON_NONE;
+    for (size_t i = 0; i < this->active_slots.size(); i++) {
+        int score = this->slot_score[this->active_slots[i]];
+        if (score > max_score) {
+            max_score = score;
+            max_taxon = this->active_taxa[i];
+        } else if (score == max_score) {
+            max_taxon = this->my_taxonomy->get_lca(max_taxon, this->active_taxa[i]);
+            //Taxa in detached trees only share the root
+            if (max_taxon < 0)
+                max_taxon = max(this->root_index, 0);
+        }
+    }
+    return this->my_taxonomy->get_taxid(max_taxon);
+}
+
+/*METHOD: Return the slot holding this taxon, or SLOT_NONE*/
+int KmerClassifier::find_slot(int taxon) const {
+    for (size_t i = 0; i < this->active_taxa.size(); i++) {
+        if (this->active_taxa[i] == taxon)
+            return this->active_slots[i];
+    }
+    return SLOT_NONE;
+}
+
+/*METHOD: Give a new taxon a slot and record its relation to every active taxon*/
+int KmerClassifier::activate(int taxon) {
+    int s = this->free_slots.back();
+    this->free_slots.pop_back();
+    uint64_t *row = &this->slot_desc[(size_t) s * this->n_words];
+    memset(row, 0, this->n_words * sizeof(uint64_t));
+    row[s / 64] |= (uint64_t) 1 << (s % 64);
+    this->slot_count[s] = 0;
+    this->slot_score[s] = 0;
+    this->slot_hash[s] = taxon_hash(taxon);
+    for (size_t i = 0; i < this->active_slots.size(); i++) {
+        int j = this->active_slots[i];
+        int other = this->active_taxa[i];
+        if (this->my_taxonomy->is_ancestor(other, taxon)) {
+            //Kmers of an active ancestor count towards the new taxon
+            this->slot_desc[(size_t) j * this->n_words + s / 64] |= (uint64_t) 1 << (s % 64);
+            this->slot_score[s] += this->slot_count[j];
+        } else if (this->my_taxonomy->is_ancestor(taxon, other)) {
+            row[j / 64] |= (uint64_t) 1 << (j % 64);
+        }
+    }
+    this->active_slots.push_back(s);
+    this->active_taxa.push_back(taxon);
+    return s;
+}
+
+/*METHOD: Release a slot whose taxon has left the window*/
+void KmerClassifier::deactivate(int s) {
+    uint64_t mask = ~((uint64_t) 1 << (s % 64));
+    size_t pos = 0;
+    for (size_t i = 0; i < this->active_slots.size(); i++) {
+        int j = this->active_slots[i];
+        this->slot_desc[(size_t) j * this->n_words + s / 64] &= mask;
+        if (j == s)
+            pos = i;
+    }
+    this->active_slots[pos] = this->active_slots.back();
+    this->active_slots.pop_back();
+    this->active_taxa[pos] = this->active_taxa.back();
+    this->active_taxa.pop_back();
+    this->free_slots.push_back(s);
+}
+
+/*METHOD: Count n more kmers for this slot and all of its descendants*/
+void KmerClassifier::add_to_slot(int s, int n) {
+    this->slot_count[s] += n;
+    this->window_hash += (uint64_t) n * this->slot_hash[s];
+    const uint64_t *row = &this->slot_desc[(size_t) s * this->n_words];
+    for (int w = 0; w < this->n_words; w++) {
+        uint64_t bits = row[w];
+        while (bits) {
+            this->slot_score[w * 64 + __builtin_ctzll(bits)] += n;
+            bits &= bits - 1;
+        }
+    }
+}
+
+/*METHOD: Count n fewer kmers for this slot and all of its descendants*/
+void KmerClassifier::remove_from_slot(int s, int n) {
+    this->slot_count[s] -= n;
+    this->window_hash -= (uint64_t) n * this->slot_hash[s];
+    const uint64_t *row = &this->slot_desc[(size_t) s * this->n_words];
+    for (int w = 0; w < this->n_words; w++) {
+        uint64_t bits = row[w];
+        while (bits) {
+            this->slot_score[w * 64 + __builtin_ctzll(bits)] -= n;
+            bits &= bits - 1;
+        }
+    }
+    if (this->slot_count[s] == 0)
+        deactivate(s);
+}
@@ -0,0 +1,148 @@
+/*********************************************************************
+ * kmer_classifier.h is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef KMER_CLASSIFIER_H
+#define KMER_CLASSIFIER_H
+
+#include "kmer2read_headers.h"
+#include "taxonomy.h"
+#include "taxid_counts.h"
+
+/* Class remembering the classification of recently seen windows.
+ * A window is keyed by the sum of count * hash(taxon) over its taxa, which
+ * identifies the multiset of (taxon, kmer count) pairs that determines its
+ * classification. The table is direct-mapped with a fixed number of
+ * entries, each holding the whole 64-bit key, so a wrong hit needs two
+ * different windows with the same 64-bit sum.
+ */
+class ClassifyCache {
+    public:
+        ClassifyCache();
+        /*Allocate about this many bytes of entries (0 disables the cache)*/
+        void init(size_t);
+        bool find(uint64_t, int &);
+        void insert(uint64_t, int);
+        size_t get_memory() const;
+        uint64_t get_lookups() const;
+        uint64_t get_hits() const;
+    private:
+        struct cache_entry {
+            uint64_t key;
+            int taxid;
+        };
+        vector<cache_entry> entries;
+        uint64_t mask;
+        uint64_t lookups;
+        uint64_t hits;
+};
+
+/* Class classifying a sliding window of kmers.
+ * The window holds the last n_kmers kmers of a sequence as a ring buffer of
+ * runs of identical kmers, so a long run of one taxon is classified once for
+ * every window position that leaves the window composition unchanged. Each distinct taxon
+ * in the window occupies a slot; per-slot state is kept in flat arrays and the
+ * ancestor relations between slots are kept as one bitset row per slot.
+ * Taxa are identified by their taxonomy index.
+ * A read is classified as the taxon whose root-to-leaf path holds the most
+ * kmers in the window (the LCA of all such taxa on ties).
+ */
+class KmerClassifier {
+    public:
+        KmerClassifier(int, const taxonomy *);
+        /*Methods for moving the window*/
+        void add_run(int, int, TaxidCounts &);
+        bool window_full() const;
+        void reset();
+        /*Methods for classifying the current window*/
+        void set_cache(ClassifyCache *);
+        int classify();
+    private:
+        int score_window() const;
+        int find_slot(int) const;
+        int activate(int);
+        void deactivate(int);
+        void add_to_slot(int, int);
+        void remove_from_slot(int, int);
+        void append_run(int, int);
+        int shift_runs(int);
+        void push_back(int, int);
+        int pop_front(int);
+
+        const taxonomy *my_taxonomy;
+        int root_index;
+        int n_kmers;
+        int n_words;
+        /*Ring buffer of runs (slot, length) of the kmers in the window*/
+        vector<int> run_slot;
+        vector<int> run_len;
+        int run_start;
+        int n_runs;
+        int window_size;
+        /*Kmers assigned to the root (taxid 1) in the window*/
+        int root_count;
+        /*Per-slot state*/
+        vector<int> slot_count;
+        vector<int> slot_score;
+        vector<uint64_t> slot_desc;
+        vector<int> free_slots;
+        vector<uint64_t> slot_hash;
+        /*Slots currently holding a taxon, and the parallel list of taxon indices*/
+        vector<int> active_slots;
+        vector<int> active_taxa;
+        /*Cached classification of the current window*/
+        bool changed;
+        int last_taxid;
+        /*Classifications of earlier windows, and the key of the current one*/
+        ClassifyCache *cache;
+        uint64_t window_hash;
+};
+
+/*Windows with fewer taxa than this are scored without the cache*/
+#define CLASSIFY_CACHE_MIN_TAXA 8
+
+/*Taxon index for unclassified, ambiguous or unknown kmers*/
+#define TAXON_NONE -1
+/*Slot values in the window for kmers without a slot*/
+#define SLOT_NONE -1
+#define SLOT_ROOT -2
+
+inline bool KmerClassifier::window_full() const {
+    return this->window_size == this->n_kmers;
+}
+
+/*Classification of a window with this key, if it is cached*/
+inline bool ClassifyCache::find(uint64_t key, int &taxid) {
+    this->lookups += 1;
+    const cache_entry &e = this->entries[key & this->mask];
+    if (e.key != key)
+        return false;
+    this->hits += 1;
+    taxid = e.taxid;
+    return true;
+}
+
+inline void ClassifyCache::insert(uint64_t key, int taxid) {
+    cache_entry &e = this->entries[key & this->mask];
+    e.key = key;
+    e.taxid = taxid;
+}
+
+#endif
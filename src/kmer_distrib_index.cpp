@@ -0,0 +1,179 @@
+/*********************************************************************
+ * kmer_distrib_index.cpp is used as part of the Bracken programs
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "kmer_distrib_index.h"
+#include "ctime.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+
+/*Index file layout: header, row taxids, row offsets and records, each aligned to 8 bytes*/
+#define KMER_DISTRIB_INDEX_MAGIC "BRKNKDI"
+#define KMER_DISTRIB_INDEX_VERSION 1
+#define KMER_DISTRIB_INDEX_BYTE_ORDER 0x01020304
+
+struct kmer_distrib_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    /*Size and modification time of the text file the index was written with*/
+    uint64_t text_size;
+    int64_t text_mtime_sec;
+    int64_t text_mtime_nsec;
+    uint64_t n_rows;
+    uint64_t n_records;
+    uint64_t taxids_offset;
+    uint64_t offsets_offset;
+    uint64_t records_offset;
+};
+
+/*Constructor and Destructor*/
+KmerDistribIndex::KmerDistribIndex() {
+    this->row_taxids = NULL;
+    this->row_offsets = NULL;
+    this->records = NULL;
+    this->n_rows = 0;
+    this->data = NULL;
+    this->data_size = 0;
+}
+
+KmerDistribIndex::~KmerDistribIndex() {
+    if (this->data != NULL)
+        munmap(this->data, this->data_size);
+}
+
+/*Sort helper: rows by mapped taxid*/
+struct row_order {
+    const vector<int> *taxids;
+    bool operator()(size_t a, size_t b) const {
+        return (*taxids)[a] < (*taxids)[b];
+    }
+};
+
+/*METHOD: Write an index file (written to a temporary file, then renamed)*/
+bool KmerDistribIndex::write(const string &index_file, const struct stat &text_stat, const vector<int> &taxids, const vector<uint64_t> &offsets, const vector<distrib_record> &records) {
+    /*Sort rows by taxid; repeated taxids keep their file order*/
+    vector<size_t> rows(taxids.size());
+    for (size_t r = 0; r < rows.size(); r++)
+        rows[r] = r;
+    row_order order;
+    order.taxids = &taxids;
+    std::stable_sort(rows.begin(), rows.end(), order);
+    vector<int32_t> sorted_taxids(rows.size());
+    vector<uint64_t> sorted_offsets(1, 0);
+    for (size_t r = 0; r < rows.size(); r++) {
+        sorted_taxids[r] = taxids[rows[r]];
+        sorted_offsets.push_back(sorted_offsets.back() + offsets[rows[r] + 1] - offsets[rows[r]]);
+    }
+
+    kmer_distrib_index_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, KMER_DISTRIB_INDEX_MAGIC, sizeof(header.magic));
+    header.version = KMER_DISTRIB_INDEX_VERSION;
+    header.byte_order = KMER_DISTRIB_INDEX_BYTE_ORDER;
+    header.text_size = text_stat.st_size;
+    get_mtime(text_stat, header.text_mtime_sec, header.text_mtime_nsec);
+    header.n_rows = rows.size();
+    header.n_records = records.size();
+    header.taxids_offset = (sizeof(header) + 7) & ~(uint64_t) 7;
+    header.offsets_offset = (header.taxids_offset + rows.size() * sizeof(int32_t) + 7) & ~(uint64_t) 7;
+    header.records_offset = header.offsets_offset + sorted_offsets.size() * sizeof(uint64_t);
+
+    string tmp_file = index_file + ".tmp." + std::to_string(getpid());
+    FILE *out = fopen(tmp_file.c_str(), "wb");
+    if (out == NULL)
+        return false;
+    static const char padding[8] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(padding, 1, header.taxids_offset - sizeof(header), out) == header.taxids_offset - sizeof(header);
+    if (ok && !sorted_taxids.empty())
+        ok = fwrite(sorted_taxids.data(), sizeof(int32_t), sorted_taxids.size(), out) == sorted_taxids.size();
+    uint64_t written = header.taxids_offset + sorted_taxids.size() * sizeof(int32_t);
+    ok = ok && fwrite(padding, 1, header.offsets_offset - written, out) == header.offsets_offset - written;
+    ok = ok && fwrite(sorted_offsets.data(), sizeof(uint64_t), sorted_offsets.size(), out) == sorted_offsets.size();
+    /*Records of each row in sorted order*/
+    for (size_t r = 0; ok && r < rows.size(); r++) {
+        size_t count = offsets[rows[r] + 1] - offsets[rows[r]];
+        if (count > 0)
+            ok = fwrite(&records[offsets[rows[r]]], sizeof(distrib_record), count, out) == count;
+    }
+    ok = (fclose(out) == 0) && ok;
+    if (ok)
+        ok = rename(tmp_file.c_str(), index_file.c_str()) == 0;
+    if (!ok)
+        unlink(tmp_file.c_str());
+    return ok;
+}
+
+/*METHOD: Map an index file; fails if it was written for a different text file*/
+bool KmerDistribIndex::open(const string &index_file, const struct stat &text_stat) {
+    int fd = ::open(index_file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t) sb.st_size < sizeof(kmer_distrib_index_header)) {
+        close(fd);
+        return false;
+    }
+    size_t size = sb.st_size;
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+    /*Check the header against this build and the current text file*/
+    const kmer_distrib_index_header *header = static_cast<const kmer_distrib_index_header *>(mapped);
+    int64_t mtime_sec, mtime_nsec;
+    get_mtime(text_stat, mtime_sec, mtime_nsec);
+    bool ok = memcmp(header->magic, KMER_DISTRIB_INDEX_MAGIC, sizeof(header->magic)) == 0
+        && header->version == KMER_DISTRIB_INDEX_VERSION
+        && header->byte_order == KMER_DISTRIB_INDEX_BYTE_ORDER
+        && header->text_size == (uint64_t) text_stat.st_size
+        && header->text_mtime_sec == mtime_sec
+        && header->text_mtime_nsec == mtime_nsec
+        && header->taxids_offset % 8 == 0 && header->offsets_offset % 8 == 0 && header->records_offset % 8 == 0
+        && header->taxids_offset <= size && header->n_rows <= (size - header->taxids_offset) / sizeof(int32_t)
+        && header->offsets_offset <= size && header->n_rows < (size - header->offsets_offset) / sizeof(uint64_t)
+        && header->records_offset <= size && header->n_records <= (size - header->records_offset) / sizeof(distrib_record);
+    const char *base = static_cast<const char *>(mapped);
+    const uint64_t *offsets = reinterpret_cast<const uint64_t *>(base + header->offsets_offset);
+    ok = ok && offsets[header->n_rows] == header->n_records;
+    if (!ok) {
+        munmap(mapped, size);
+        return false;
+    }
+    if (this->data != NULL)
+        munmap(this->data, this->data_size);
+    this->data = mapped;
+    this->data_size = size;
+    this->row_taxids = reinterpret_cast<const int32_t *>(base + header->taxids_offset);
+    this->row_offsets = offsets;
+    this->records = reinterpret_cast<const distrib_record *>(base + header->records_offset);
+    this->n_rows = header->n_rows;
+    return true;
+}
+
+/*METHOD: Rows of a mapped taxid: [first, last) (empty if not found)*/
+void KmerDistribIndex::find(int taxid, size_t &first, size_t &last) const {
+    const int32_t *begin = this->row_taxids;
+    const int32_t *end = begin + this->n_rows;
+    std::pair<const int32_t *, const int32_t *> range = std::equal_range(begin, end, (int32_t) taxid);
+    first = range.first - begin;
+    last = range.second - begin;
+}
@@ -0,0 +1,86 @@
+/*********************************************************************
+ * kmer_distrib_index.h is used as part of the Bracken programs
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef KMER_DISTRIB_INDEX_H
+#define KMER_DISTRIB_INDEX_H
+
+#include "kmer2read_headers.h"
+
+/*One genome entry of a kmer distribution line*/
+struct distrib_record {
+    int32_t genome_taxid;
+    uint32_t reserved;
+    uint64_t kmers_mapped;
+    uint64_t total_kmers;
+};
+
+/* Class reading a binary databaseXmers.kmer_distrib file.
+ * Lines are stored as rows sorted by mapped taxid (rows of a repeated taxid
+ * keep their file order) with an offset index into one array of fixed-width
+ * genome records, so the rows of a few taxids can be read from the mapped
+ * file without parsing the rest. The index is tied to the size and
+ * modification time of the text file it was written with.
+ */
+class KmerDistribIndex {
+    public:
+        KmerDistribIndex();
+        ~KmerDistribIndex();
+        KmerDistribIndex(const KmerDistribIndex &) = delete;
+        KmerDistribIndex& operator=(const KmerDistribIndex &) = delete;
+        /*Map an index file; fails if it was written for a different text file*/
+        bool open(const string &, const struct stat &);
+        /*Write the rows (taxid and records [offsets[r], offsets[r+1]) of each line, in file order)*/
+        static bool write(const string &, const struct stat &, const vector<int> &, const vector<uint64_t> &, const vector<distrib_record> &);
+        /*Rows of a mapped taxid: [first, last)*/
+        void find(int, size_t &, size_t &) const;
+        size_t size() const;
+        int row_taxid(size_t) const;
+        const distrib_record* row_begin(size_t) const;
+        const distrib_record* row_end(size_t) const;
+    private:
+        const int32_t *row_taxids;
+        const uint64_t *row_offsets;
+        const distrib_record *records;
+        size_t n_rows;
+        void *data;
+        size_t data_size;
+};
+
+/*Suffix of the binary index written next to a .kmer_distrib file*/
+#define KMER_DISTRIB_INDEX_SUFFIX ".index"
+
+inline size_t KmerDistribIndex::size() const {
+    return this->n_rows;
+}
+
+inline int KmerDistribIndex::row_taxid(size_t row) const {
+    return this->row_taxids[row];
+}
+
+inline const distrib_record* KmerDistribIndex::row_begin(size_t row) const {
+    return this->records + this->row_offsets[row];
+}
+
+inline const distrib_record* KmerDistribIndex::row_end(size_t row) const {
+    return this->records + this->row_offsets[row + 1];
+}
+
+#endif
@@ -0,0 +1,281 @@
+/*********************************************************************
+ * kmer_distribution.cpp is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "kmer_distribution.h"
+
+/*Partial file layout: header, then genome counts and pair counts as (key, count, first) records*/
+#define DISTRIB_PART_MAGIC "BRKNKDP"
+#define DISTRIB_PART_VERSION 1
+#define DISTRIB_PART_BYTE_ORDER 0x01020304
+
+struct distrib_part_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t kmer_len;
+    int32_t read_len;
+    int32_t shard;
+    int32_t n_shards;
+    uint64_t kraken_size;
+    uint64_t n_genomes;
+    uint64_t n_pairs;
+};
+
+struct distrib_part_record {
+    uint64_t key;
+    uint64_t count;
+    uint64_t first;
+};
+
+/*Constructor*/
+KmerDistribution::KmerDistribution() {
+    this->pair_shards.resize(DISTRIB_SHARDS);
+    this->genome_shards.resize(DISTRIB_SHARDS);
+}
+
+/*METHOD: Shard of a key*/
+int KmerDistribution::get_shard(uint64_t key) {
+    return (int) ((key * 0x9E3779B97F4A7C15ULL) >> (64 - DISTRIB_SHARD_BITS));
+}
+
+/*METHOD: Add to a count, keeping the earliest position*/
+void KmerDistribution::add_count(std::unordered_map<uint64_t, distrib_count> &counts, uint64_t key, uint64_t count, uint64_t first) {
+    auto it = counts.find(key);
+    if (it == counts.end()) {
+        distrib_count c = {count, first};
+        counts.insert(std::make_pair(key, c));
+    } else {
+        it->second.count += count;
+        it->second.first = min(it->second.first, first);
+    }
+}
+
+/*METHOD: Add the read mappings of one sequence*/
+void KmerDistribution::add(int genome_taxid, const TaxidCounts &taxids_mapped, uint64_t position) {
+    //Sequences without read mappings are ignored
+    if (taxids_mapped.empty())
+        return;
+    uint64_t genome = (uint32_t) genome_taxid;
+    uint64_t total = 0;
+    for (auto it = taxids_mapped.begin(); it != taxids_mapped.end(); ++it) {
+        uint64_t key = (genome << 32) | (uint32_t) it->taxid;
+        add_count(this->pair_shards[get_shard(key)], key, it->count, position);
+        total += it->count;
+    }
+    add_count(this->genome_shards[get_shard(genome)], genome, total, position);
+}
+
+/*METHOD: Merge the per-thread parts, one shard per thread at a time*/
+void KmerDistribution::merge(vector<KmerDistribution> &parts) {
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int s = 0; s < DISTRIB_SHARDS; s++) {
+        for (size_t p = 0; p < parts.size(); p++) {
+            std::unordered_map<uint64_t, distrib_count> &pairs = parts[p].pair_shards[s];
+            for (auto it = pairs.begin(); it != pairs.end(); ++it)
+                add_count(this->pair_shards[s], it->first, it->second.count, it->second.first);
+            std::unordered_map<uint64_t, distrib_count>().swap(pairs);
+            std::unordered_map<uint64_t, distrib_count> &genomes = parts[p].genome_shards[s];
+            for (auto it = genomes.begin(); it != genomes.end(); ++it)
+                add_count(this->genome_shards[s], it->first, it->second.count, it->second.first);
+            std::unordered_map<uint64_t, distrib_count>().swap(genomes);
+        }
+    }
+}
+
+/*Sort helpers: genomes by first appearance, mappings by genome order then first appearance*/
+struct genome_order {
+    bool operator()(const std::pair<uint64_t, uint64_t> &a, const std::pair<uint64_t, uint64_t> &b) const {
+        return a.second < b.second;
+    }
+};
+
+/*METHOD: Write the kmer distribution file (and its binary index)*/
+bool KmerDistribution::write(const string &d_file, bool with_index) const {
+    /*Order genomes by the position they were first seen at*/
+    vector<std::pair<uint64_t, uint64_t>> genomes;
+    std::unordered_map<uint64_t, uint64_t> totals;
+    for (int s = 0; s < DISTRIB_SHARDS; s++) {
+        for (auto it = this->genome_shards[s].begin(); it != this->genome_shards[s].end(); ++it) {
+            genomes.push_back(std::make_pair(it->first, it->second.first));
+            totals[it->first] = it->second.count;
+        }
+    }
+    std::sort(genomes.begin(), genomes.end(), genome_order());
+    std::unordered_map<uint64_t, uint64_t> genome_rank;
+    for (size_t g = 0; g < genomes.size(); g++)
+        genome_rank[genomes[g].first] = g;
+    /*Order each genome's mapped taxids by first position (then taxid, as within a line)*/
+    struct mapping {
+        uint64_t rank, first;
+        uint32_t genome, mapped;
+        uint64_t count;
+        bool operator<(const mapping &o) const {
+            if (rank != o.rank) return rank < o.rank;
+            if (first != o.first) return first < o.first;
+            return mapped < o.mapped;
+        }
+    };
+    vector<mapping> mappings;
+    for (int s = 0; s < DISTRIB_SHARDS; s++) {
+        for (auto it = this->pair_shards[s].begin(); it != this->pair_shards[s].end(); ++it) {
+            mapping m;
+            m.genome = (uint32_t) (it->first >> 32);
+            m.mapped = (uint32_t) it->first;
+            m.rank = genome_rank[m.genome];
+            m.first = it->second.first;
+            m.count = it->second.count;
+            mappings.push_back(m);
+        }
+    }
+    std::sort(mappings.begin(), mappings.end());
+    /*Group by mapped taxid, in order of first insertion*/
+    vector<int> row_taxids;
+    vector<vector<size_t>> mapped_lists;
+    std::unordered_map<uint32_t, size_t> mapped_index;
+    for (size_t i = 0; i < mappings.size(); i++) {
+        auto it = mapped_index.find(mappings[i].mapped);
+        if (it == mapped_index.end()) {
+            it = mapped_index.insert(std::make_pair(mappings[i].mapped, row_taxids.size())).first;
+            row_taxids.push_back((int) mappings[i].mapped);
+            mapped_lists.push_back(vector<size_t>());
+        }
+        mapped_lists[it->second].push_back(i);
+    }
+    vector<uint64_t> row_offsets(1, 0);
+    vector<distrib_record> records;
+    records.reserve(mappings.size());
+    for (size_t m = 0; m < mapped_lists.size(); m++) {
+        for (size_t j = 0; j < mapped_lists[m].size(); j++) {
+            const mapping &g = mappings[mapped_lists[m][j]];
+            distrib_record d;
+            d.genome_taxid = (int32_t) g.genome;
+            d.reserved = 0;
+            d.kmers_mapped = g.count;
+            d.total_kmers = totals[g.genome];
+            records.push_back(d);
+        }
+        row_offsets.push_back(records.size());
+    }
+
+    /*Output distributions to file*/
+    FILE *o_file = fopen(d_file.c_str(), "w");
+    if (o_file == NULL)
+        return false;
+    fprintf(o_file, "mapped_taxid\tgenome_taxids:kmers_mapped:total_genome_kmers\n");
+    for (size_t m = 0; m < row_taxids.size(); m++) {
+        fprintf(o_file, "%i\t", row_taxids[m]);
+        for (size_t j = row_offsets[m]; j < row_offsets[m + 1]; j++) {
+            fprintf(o_file, "%i:%llu:%llu ", (int) records[j].genome_taxid,
+                (unsigned long long) records[j].kmers_mapped, (unsigned long long) records[j].total_kmers);
+        }
+        fprintf(o_file, "\n");
+    }
+    if (fclose(o_file) != 0)
+        return false;
+    /*Binary index of the same lines, tied to the file just written*/
+    if (with_index) {
+        string index_file = d_file + KMER_DISTRIB_INDEX_SUFFIX;
+        struct stat d_stat;
+        if (stat(d_file.c_str(), &d_stat) != 0 || !KmerDistribIndex::write(index_file, d_stat, row_taxids, row_offsets, records))
+            printf("\t\tWarning: could not write kmer distribution index %s\n", index_file.c_str());
+    }
+    return true;
+}
+
+/*METHOD: Write all records of a set of shards*/
+static bool write_records(FILE *out, const vector<std::unordered_map<uint64_t, distrib_count>> &shards) {
+    vector<distrib_part_record> records;
+    for (size_t s = 0; s < shards.size(); s++) {
+        records.clear();
+        for (auto it = shards[s].begin(); it != shards[s].end(); ++it) {
+            distrib_part_record r = {it->first, it->second.count, it->second.first};
+            records.push_back(r);
+        }
+        if (!records.empty() && fwrite(records.data(), sizeof(distrib_part_record), records.size(), out) != records.size())
+            return false;
+    }
+    return true;
+}
+
+/*METHOD: Write the counts of one shard (to a temporary file, then renamed)*/
+bool KmerDistribution::write_part(const string &p_file, const distrib_part_info &info) const {
+    distrib_part_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DISTRIB_PART_MAGIC, sizeof(header.magic));
+    header.version = DISTRIB_PART_VERSION;
+    header.byte_order = DISTRIB_PART_BYTE_ORDER;
+    header.kmer_len = info.kmer_len;
+    header.read_len = info.read_len;
+    header.shard = info.shard;
+    header.n_shards = info.n_shards;
+    header.kraken_size = info.kraken_size;
+    for (int s = 0; s < DISTRIB_SHARDS; s++) {
+        header.n_genomes += this->genome_shards[s].size();
+        header.n_pairs += this->pair_shards[s].size();
+    }
+    string tmp_file = p_file + ".tmp." + std::to_string(getpid());
+    FILE *out = fopen(tmp_file.c_str(), "wb");
+    if (out == NULL)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && write_records(out, this->genome_shards);
+    ok = ok && write_records(out, this->pair_shards);
+    ok = (fclose(out) == 0) && ok;
+    if (ok)
+        ok = rename(tmp_file.c_str(), p_file.c_str()) == 0;
+    if (!ok)
+        unlink(tmp_file.c_str());
+    return ok;
+}
+
+/*METHOD: Read the counts of one shard into this (empty) distribution*/
+bool KmerDistribution::read_part(const string &p_file, distrib_part_info &info) {
+    FILE *in = fopen(p_file.c_str(), "rb");
+    if (in == NULL)
+        return false;
+    distrib_part_header header;
+    bool ok = fread(&header, sizeof(header), 1, in) == 1
+        && memcmp(header.magic, DISTRIB_PART_MAGIC, sizeof(header.magic)) == 0
+        && header.version == DISTRIB_PART_VERSION
+        && header.byte_order == DISTRIB_PART_BYTE_ORDER;
+    vector<distrib_part_record> records(ok ? 1 << 16 : 0);
+    for (int section = 0; ok && section < 2; section++) {
+        vector<std::unordered_map<uint64_t, distrib_count>> &shards = (section == 0) ? this->genome_shards : this->pair_shards;
+        uint64_t left = (section == 0) ? header.n_genomes : header.n_pairs;
+        while (ok && left > 0) {
+            size_t n = (size_t) min(left, (uint64_t) records.size());
+            ok = fread(records.data(), sizeof(distrib_part_record), n, in) == n;
+            for (size_t i = 0; ok && i < n; i++)
+                add_count(shards[get_shard(records[i].key)], records[i].key, records[i].count, records[i].first);
+            left -= n;
+        }
+    }
+    ok = ok && fgetc(in) == EOF;
+    fclose(in);
+    if (!ok)
+        return false;
+    info.kmer_len = header.kmer_len;
+    info.read_len = header.read_len;
+    info.shard = header.shard;
+    info.n_shards = header.n_shards;
+    info.kraken_size = header.kraken_size;
+    return true;
+}
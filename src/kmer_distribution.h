@@ -0,0 +1,81 @@
+/*********************************************************************
+ * kmer_distribution.h is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef KMER_DISTRIBUTION_H
+#define KMER_DISTRIBUTION_H
+
+#include "kmer2read_headers.h"
+#include "kmer_distrib_index.h"
+#include "taxid_counts.h"
+#include <unordered_map>
+
+/*Number of hash shards; shards are merged in parallel*/
+#define DISTRIB_SHARD_BITS 6
+#define DISTRIB_SHARDS (1 << DISTRIB_SHARD_BITS)
+
+/*Count of kmers (or reads) and the file position where the key was first seen*/
+struct distrib_count {
+    uint64_t count;
+    uint64_t first;
+};
+
+/*Read length and shard of a partial kmer distribution (one shard of a kraken file)*/
+struct distrib_part_info {
+    int kmer_len;
+    int read_len;
+    int shard;
+    int n_shards;
+    uint64_t kraken_size;
+};
+
+/* Class accumulating the read distribution of every genome
+ * (genome taxid, mapped taxid) -> number of reads, and writing it as a
+ * databaseXmers.kmer_distrib file.
+ * Each thread fills its own instance; the instances are then merged shard
+ * by shard. Entries are written in the order generate_kmer_distribution.py
+ * uses for the same kraken file (first appearance of each genome and of each
+ * of its mapped taxids), so the output does not depend on thread count.
+ * Shards of one kraken file keep file positions, so their partial counts
+ * merge into the same file as a single run.
+ */
+class KmerDistribution {
+    public:
+        KmerDistribution();
+        /*Add the read mappings of one sequence found at a given file position*/
+        void add(int, const TaxidCounts &, uint64_t);
+        /*Merge the per-thread parts into this one*/
+        void merge(vector<KmerDistribution> &);
+        /*Write the .kmer_distrib file and optionally its binary index*/
+        bool write(const string &, bool) const;
+        /*Write/read the counts of one shard, to be merged into the final file*/
+        bool write_part(const string &, const distrib_part_info &) const;
+        bool read_part(const string &, distrib_part_info &);
+    private:
+        static int get_shard(uint64_t);
+        static void add_count(std::unordered_map<uint64_t, distrib_count> &, uint64_t, uint64_t, uint64_t);
+
+        /*(genome << 32 | mapped taxid) -> reads*/
+        vector<std::unordered_map<uint64_t, distrib_count>> pair_shards;
+        /*genome -> total reads*/
+        vector<std::unordered_map<uint64_t, distrib_count>> genome_shards;
+};
+
+#endif
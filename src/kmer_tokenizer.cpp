@@ -0,0 +1,93 @@
+/*********************************************************************
+ * kmer_tokenizer.cpp is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "kmer_tokenizer_impl.h"
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+struct ScalarScanner {
+    static delim_masks scan(const char *p) {
+        return scan_bytes(p, 64);
+    }
+};
+
+#if defined(__x86_64__)
+/*SSE2 is part of x86-64, so it needs no check*/
+struct Sse2Scanner {
+    static delim_masks scan(const char *p) {
+        const __m128i colon = _mm_set1_epi8(':');
+        const __m128i space = _mm_set1_epi8(' ');
+        delim_masks m = {0, 0};
+        for (int i = 0; i < 4; i++) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+            m.colons |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, colon)) << (16 * i);
+            m.spaces |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, space)) << (16 * i);
+        }
+        return m;
+    }
+};
+#endif
+
+typedef size_t (*pair_parser)(const char *&, const char *, kmer_pair *, size_t);
+
+/*METHOD: Pick the tokenizer for this CPU*/
+pair_parser select_parser(const char *&name) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        name = "avx2";
+        return parse_kmer_pairs_avx2;
+    }
+    name = "sse2";
+    return parse_kmer_pairs_sse2;
+#else
+    name = "scalar";
+    return parse_kmer_pairs_scalar;
+#endif
+}
+
+const char *parser_name = "scalar";
+const pair_parser parser = select_parser(parser_name);
+
+}
+
+size_t parse_kmer_pairs_scalar(const char *&p, const char *end, kmer_pair *pairs, size_t max_pairs) {
+    return parse_pairs<ScalarScanner>(p, end, pairs, max_pairs);
+}
+
+#if defined(__x86_64__)
+size_t parse_kmer_pairs_sse2(const char *&p, const char *end, kmer_pair *pairs, size_t max_pairs) {
+    return parse_pairs<Sse2Scanner>(p, end, pairs, max_pairs);
+}
+#endif
+
+/*METHOD: Parse up to max_pairs "taxid:count" pairs with the tokenizer of this CPU*/
+size_t parse_kmer_pairs(const char *&p, const char *end, kmer_pair *pairs, size_t max_pairs) {
+    return parser(p, end, pairs, max_pairs);
+}
+
+/*METHOD: Name of the tokenizer used*/
+const char *get_tokenizer_name() {
+    return parser_name;
+}
@@ -0,0 +1,45 @@
+/*********************************************************************
+ * kmer_tokenizer.h is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef KMER_TOKENIZER_H
+#define KMER_TOKENIZER_H
+
+#include "kmer2read_headers.h"
+
+/*One "taxid:count" pair of the kmer field of a kraken line. Ambiguous kmers
+ * ("A:count") have taxid 0, like unclassified ones; the paired-end separator
+ * "|:|" has taxid KMER_MATE_SEPARATOR and count 0.*/
+struct kmer_pair {
+    uint32_t taxid;
+    uint32_t count;
+};
+
+#define KMER_MATE_SEPARATOR UINT32_MAX
+/*Number of pairs parsed per call by the users of parse_kmer_pairs*/
+#define KMER_PAIR_BATCH 256
+
+/*Parse up to max_pairs pairs of [p, end), moving p past them; 0 once no
+ * pair is left. Uses the fastest tokenizer the CPU supports.*/
+size_t parse_kmer_pairs(const char *&, const char *, kmer_pair *, size_t);
+/*Name of the tokenizer used (avx2, sse2 or scalar)*/
+const char *get_tokenizer_name();
+
+#endif
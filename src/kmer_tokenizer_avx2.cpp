@@ -0,0 +1,53 @@
+/*********************************************************************
+ * kmer_tokenizer_avx2.cpp is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+/*Built for AVX2 through the target attribute (whatever CXXFLAGS are); only
+ * called on CPUs with AVX2*/
+#if defined(__x86_64__)
+#define KMER_TOKENIZER_TARGET __attribute__((target("avx2")))
+#endif
+#include "kmer_tokenizer_impl.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+namespace {
+
+struct Avx2Scanner {
+    static KMER_TOKENIZER_TARGET delim_masks scan(const char *p) {
+        const __m256i colon = _mm256_set1_epi8(':');
+        const __m256i space = _mm256_set1_epi8(' ');
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+        delim_masks m;
+        m.colons = (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, colon))
+            | (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, colon)) << 32;
+        m.spaces = (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, space))
+            | (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, space)) << 32;
+        return m;
+    }
+};
+
+}
+
+KMER_TOKENIZER_TARGET size_t parse_kmer_pairs_avx2(const char *&p, const char *end, kmer_pair *pairs, size_t max_pairs) {
+    return parse_pairs<Avx2Scanner>(p, end, pairs, max_pairs);
+}
+#endif
@@ -0,0 +1,147 @@
+/*********************************************************************
+ * kmer_tokenizer_impl.h is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef KMER_TOKENIZER_IMPL_H
+#define KMER_TOKENIZER_IMPL_H
+
+#include "kmer_tokenizer.h"
+
+/* Tokenizer shared by every instruction set. Each file including this header
+ * is compiled for one instruction set, so everything here has internal
+ * linkage and is never shared between them.
+ *
+ * The text is scanned in blocks of 64 bytes: the Scanner gives a bitmask of
+ * the ':' and of the ' ' bytes of a block, and the delimiters are then
+ * visited in order with count-trailing-zeros instead of one memchr per
+ * delimiter.
+ */
+
+/*Per-ISA parsers, chosen at run time by parse_kmer_pairs*/
+size_t parse_kmer_pairs_scalar(const char *&, const char *, kmer_pair *, size_t);
+size_t parse_kmer_pairs_sse2(const char *&, const char *, kmer_pair *, size_t);
+size_t parse_kmer_pairs_avx2(const char *&, const char *, kmer_pair *, size_t);
+
+/*Target attribute of the functions below, defined before including this
+ * header by a file built for an instruction set beyond the compiler's default*/
+#ifndef KMER_TOKENIZER_TARGET
+#define KMER_TOKENIZER_TARGET
+#endif
+
+namespace {
+
+/*Bitmasks of the ':' and ' ' bytes of up to 64 bytes*/
+struct delim_masks {
+    uint64_t colons;
+    uint64_t spaces;
+};
+
+KMER_TOKENIZER_TARGET inline delim_masks scan_bytes(const char *p, size_t n) {
+    delim_masks m = {0, 0};
+    for (size_t i = 0; i < n; i++) {
+        m.colons |= (uint64_t) (p[i] == ':') << i;
+        m.spaces |= (uint64_t) (p[i] == ' ') << i;
+    }
+    return m;
+}
+
+/*Decimal value of [s, e) (wrapping on overflow). Up to 8 digits are
+ * converted at once when 8 bytes can be read from s, on little-endian hosts
+ * (where the first digit is the lowest byte of the word).*/
+KMER_TOKENIZER_TARGET inline uint32_t parse_uint(const char *s, const char *e, const char *limit) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    size_t len = e - s;
+    if (len - 1 < 8 && limit - s >= 8) {
+        uint64_t v;
+        memcpy(&v, s, 8);
+        //Keep the digits as the high bytes (leading zero bytes below them)
+        v <<= 8 * (8 - len);
+        v &= 0x0F0F0F0F0F0F0F0FULL;
+        v = (v * 2561) >> 8;
+        v = ((v & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+        v = ((v & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+        return (uint32_t) v;
+    }
+#else
+    (void) limit;
+#endif
+    uint32_t val = 0;
+    while (s < e)
+        val = val * 10 + (uint32_t) (*(s++) - '0');
+    return val;
+}
+
+/*Parse the pair whose taxid is [p, colon) and count is [colon + 1, end)*/
+KMER_TOKENIZER_TARGET inline kmer_pair read_pair(const char *p, const char *colon, const char *end, const char *limit) {
+    kmer_pair pair;
+    if (p[0] == 'A') {
+        pair.taxid = 0;
+        pair.count = parse_uint(colon + 1, end, limit);
+    } else if (p[0] == '|' && colon - p == 1) {
+        pair.taxid = KMER_MATE_SEPARATOR;
+        pair.count = 0;
+    } else {
+        pair.taxid = parse_uint(p, colon, limit);
+        pair.count = parse_uint(colon + 1, end, limit);
+    }
+    return pair;
+}
+
+template <typename Scanner>
+KMER_TOKENIZER_TARGET inline size_t parse_pairs(const char *&pos, const char *end, kmer_pair *pairs, size_t max_pairs) {
+    const char *p = pos;
+    const char *colon = NULL;
+    size_t n = 0;
+    size_t len = end - p;
+    for (size_t offset = 0; offset < len; offset += 64) {
+        const char *block = pos + offset;
+        delim_masks m = (len - offset >= 64) ? Scanner::scan(block) : scan_bytes(block, len - offset);
+        uint64_t delims = m.colons | m.spaces;
+        while (delims != 0) {
+            int bit = __builtin_ctzll(delims);
+            delims &= delims - 1;
+            const char *d = block + bit;
+            if ((m.colons >> bit) & 1) {
+                //The first ':' ends the taxid
+                if (colon == NULL)
+                    colon = d;
+                continue;
+            }
+            if (colon != NULL) {
+                pairs[n++] = read_pair(p, colon, d, end);
+                colon = NULL;
+            }
+            p = d + 1;
+            if (n == max_pairs) {
+                pos = p;
+                return n;
+            }
+        }
+    }
+    //The last pair ends at the end of the text
+    if (colon != NULL)
+        pairs[n++] = read_pair(p, colon, end, end);
+    pos = end;
+    return n;
+}
+
+}
+
+#endif
@@ -0,0 +1,291 @@
+/*********************************************************************
+ * kraken2_db.cpp is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "kraken2_db.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stddef.h>
+
+/*hash.k2d starts with its capacity, size, key bits and value bits*/
+#define KRAKEN2_HASH_HEADER_SIZE (4 * sizeof(uint64_t))
+/*taxo.k2d starts with this magic, the node count and the name and rank data sizes*/
+#define KRAKEN2_TAXO_MAGIC "K2TAXDAT"
+#define KRAKEN2_TAXO_HEADER_SIZE (8 + 3 * sizeof(uint64_t))
+/*Taxonomy nodes hold 6 (older databases) or 7 64-bit fields, the sixth
+ * being the external taxid*/
+#define KRAKEN2_EXTERNAL_ID_FIELD 5
+
+/*METHOD: MurmurHash3 finalizer, the hash of minimizers in Kraken 2*/
+static inline uint64_t murmur_hash3(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+/*Constructor*/
+Kraken2Database::Kraken2Database() {
+    memset(&this->opts, 0, sizeof(this->opts));
+    this->lmer_mask = 0;
+    memset(this->codes, UINT8_MAX, sizeof(this->codes));
+    const char *bases = "ACGT";
+    for (int b = 0; b < 4; b++) {
+        this->codes[(uint8_t) bases[b]] = b;
+        this->codes[(uint8_t) tolower(bases[b])] = b;
+    }
+    this->cells = NULL;
+    this->capacity = 0;
+    this->n_keys = 0;
+    this->value_bits = 0;
+    this->value_mask = 0;
+    this->hash_data = NULL;
+    this->hash_size = 0;
+}
+/*Destructor*/
+Kraken2Database::~Kraken2Database() {
+    if (this->hash_data != NULL)
+        munmap(this->hash_data, this->hash_size);
+}
+
+/*METHOD: Open opts.k2d, hash.k2d and taxo.k2d of a database directory*/
+bool Kraken2Database::open(const string &db_dir) {
+    string prefix = db_dir;
+    if (!prefix.empty() && prefix.back() != '/')
+        prefix += "/";
+    return read_options(prefix + "opts.k2d") && read_taxonomy(prefix + "taxo.k2d") && map_hash(prefix + "hash.k2d");
+}
+
+/*METHOD: Read the index options; only nucleotide databases are supported*/
+bool Kraken2Database::read_options(const string &file) {
+    FILE *fp = fopen(file.c_str(), "rb");
+    if (fp == NULL) {
+        this->error = file + ": " + strerror(errno);
+        return false;
+    }
+    memset(&this->opts, 0, sizeof(this->opts));
+    size_t n = fread(&this->opts, 1, sizeof(this->opts), fp);
+    fclose(fp);
+    if (n < offsetof(kraken2_options, dna_db) + 1 || this->opts.l == 0 || this->opts.l > 31 || this->opts.k < this->opts.l) {
+        this->error = file + ": not a Kraken 2 options file";
+        return false;
+    }
+    if (!this->opts.dna_db) {
+        this->error = file + ": protein databases are not supported";
+        return false;
+    }
+    this->lmer_mask = (1ULL << (2 * this->opts.l)) - 1;
+    this->opts.toggle_mask &= this->lmer_mask;
+    return true;
+}
+
+/*METHOD: Map the compact hash table*/
+bool Kraken2Database::map_hash(const string &file) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        this->error = file + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    uint64_t header[4];
+    if (fstat(fd, &st) != 0 || pread(fd, header, sizeof(header), 0) != (ssize_t) sizeof(header)
+            || header[0] == 0 || header[2] + header[3] != 32 || header[3] == 0 || header[3] >= 32
+            || (uint64_t) st.st_size != KRAKEN2_HASH_HEADER_SIZE + header[0] * sizeof(uint32_t)) {
+        close(fd);
+        this->error = file + ": not a Kraken 2 hash table";
+        return false;
+    }
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    //Lookups are random: read the whole table in once
+    flags |= MAP_POPULATE;
+#endif
+    void *data = mmap(NULL, st.st_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        this->error = file + ": " + strerror(errno);
+        return false;
+    }
+    this->hash_data = data;
+    this->hash_size = st.st_size;
+    this->cells = reinterpret_cast<const uint32_t *>(static_cast<const char *>(data) + KRAKEN2_HASH_HEADER_SIZE);
+    this->capacity = header[0];
+    this->n_keys = header[1];
+    this->value_bits = header[3];
+    this->value_mask = (1U << this->value_bits) - 1;
+    return true;
+}
+
+/*METHOD: Read the external taxid of every internal taxon*/
+bool Kraken2Database::read_taxonomy(const string &file) {
+    ifstream in(file.c_str(), std::ios::binary);
+    if (!in.is_open()) {
+        this->error = file + ": " + strerror(errno);
+        return false;
+    }
+    char magic[8];
+    uint64_t sizes[3];
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char *>(sizes), sizeof(sizes));
+    in.seekg(0, std::ios::end);
+    uint64_t file_size = (uint64_t) in.tellg();
+    uint64_t n_nodes = sizes[0];
+    uint64_t node_bytes = file_size - KRAKEN2_TAXO_HEADER_SIZE - sizes[1] - sizes[2];
+    if (!in || memcmp(magic, KRAKEN2_TAXO_MAGIC, sizeof(magic)) != 0 || n_nodes == 0
+            || file_size < KRAKEN2_TAXO_HEADER_SIZE + sizes[1] + sizes[2]
+            || (node_bytes != n_nodes * 6 * sizeof(uint64_t) && node_bytes != n_nodes * 7 * sizeof(uint64_t))) {
+        this->error = file + ": not a Kraken 2 taxonomy";
+        return false;
+    }
+    size_t n_fields = node_bytes / n_nodes / sizeof(uint64_t);
+    vector<uint64_t> nodes(n_nodes * n_fields);
+    in.seekg(KRAKEN2_TAXO_HEADER_SIZE);
+    in.read(reinterpret_cast<char *>(nodes.data()), node_bytes);
+    if (!in) {
+        this->error = file + ": truncated taxonomy";
+        return false;
+    }
+    //Taxids that cannot be taxonomy taxids are read as unclassified
+    this->external_ids.resize(n_nodes);
+    for (uint64_t i = 0; i < n_nodes; i++) {
+        uint64_t taxid = nodes[i * n_fields + KRAKEN2_EXTERNAL_ID_FIELD];
+        this->external_ids[i] = (taxid > INT32_MAX) ? 0 : (uint32_t) taxid;
+    }
+    return true;
+}
+
+/*METHOD: Canonical form of an l-mer: the smaller of it and its reverse
+ * complement. Databases before revcom version 1 (kraken2 2.0.7 and older)
+ * took the reverse complement without shifting it back into place.*/
+inline uint64_t Kraken2Database::canonical(uint64_t lmer) const {
+    uint64_t rc = lmer;
+    //Reverse the order of the 2-bit bases
+    rc = ((rc & 0xCCCCCCCCCCCCCCCCULL) >> 2) | ((rc & 0x3333333333333333ULL) << 2);
+    rc = ((rc & 0xF0F0F0F0F0F0F0F0ULL) >> 4) | ((rc & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    rc = ((rc & 0xFF00FF00FF00FF00ULL) >> 8) | ((rc & 0x00FF00FF00FF00FFULL) << 8);
+    rc = ((rc & 0xFFFF0000FFFF0000ULL) >> 16) | ((rc & 0x0000FFFF0000FFFFULL) << 16);
+    rc = (rc >> 32) | (rc << 32);
+    if (this->opts.revcom_version == 0)
+        rc = (~rc) & this->lmer_mask;
+    else
+        rc = (~rc) >> (64 - 2 * this->opts.l);
+    return (rc < lmer) ? rc : lmer;
+}
+
+/*METHOD: External taxid of a minimizer (0 if it is not in the table)*/
+inline uint32_t Kraken2Database::lookup(uint64_t minimizer) const {
+    uint64_t hc = murmur_hash3(minimizer);
+    if (this->opts.minimum_acceptable_hash_value != 0 && hc < this->opts.minimum_acceptable_hash_value)
+        return 0;
+    uint32_t key = (uint32_t) (hc >> (32 + this->value_bits));
+    //Linear probing until the key or an empty cell is found
+    uint64_t idx = hc % this->capacity;
+    uint64_t first = idx;
+    while (true) {
+        uint32_t cell = this->cells[idx];
+        uint32_t value = cell & this->value_mask;
+        if (value == 0)
+            return 0;
+        if ((cell >> this->value_bits) == key)
+            return (value < this->external_ids.size()) ? this->external_ids[value] : 0;
+        if (++idx == this->capacity)
+            idx = 0;
+        if (idx == first)
+            return 0;
+    }
+}
+
+/*METHOD: Append the kmer runs of kmers [begin, end) of a sequence. The
+ * minimizer of each kmer is the smallest of its l-mers (after canonical
+ * form, spaced seed mask and toggle mask), found with a monotonic queue of
+ * l-mers; consecutive kmers usually share it, so it is only looked up when
+ * it changes.*/
+void Kraken2Database::get_runs(const char *seq, size_t len, size_t begin, size_t end, vector<kmer_pair> &runs) const {
+    size_t k = this->opts.k;
+    size_t l = this->opts.l;
+    if (len < k || begin >= end)
+        return;
+    size_t stop = min(len, end + k - 1);
+    //Queue of candidate l-mers with increasing values, at most k - l + 2 long
+    size_t ring_size = 1;
+    while (ring_size < k - l + 2)
+        ring_size <<= 1;
+    size_t ring_mask = ring_size - 1;
+    vector<uint64_t> queue_vals(ring_size);
+    vector<size_t> queue_pos(ring_size);
+    size_t head = 0, tail = 0;
+
+    uint64_t lmer = 0;
+    size_t loaded = 0;
+    //Kmers starting before this position hold an ambiguous character
+    size_t clean_start = begin;
+    bool have_last = false;
+    uint64_t last_minimizer = 0;
+    uint32_t last_taxid = 0;
+    for (size_t i = begin; i < stop; i++) {
+        uint8_t code = this->codes[(uint8_t) seq[i]];
+        if (code == UINT8_MAX) {
+            clean_start = i + 1;
+            loaded = 0;
+            head = tail;
+        } else {
+            lmer = ((lmer << 2) | code) & this->lmer_mask;
+            if (++loaded >= l) {
+                uint64_t candidate = canonical(lmer);
+                if (this->opts.spaced_seed_mask != 0)
+                    candidate &= this->opts.spaced_seed_mask;
+                candidate ^= this->opts.toggle_mask;
+                while (tail != head && queue_vals[(tail - 1) & ring_mask] > candidate)
+                    tail--;
+                queue_vals[tail & ring_mask] = candidate;
+                queue_pos[tail & ring_mask] = i + 1 - l;
+                tail++;
+            }
+        }
+        if (i + 1 < begin + k)
+            continue;
+        //Classify the kmer ending at i
+        size_t start = i + 1 - k;
+        uint32_t taxid;
+        if (start < clean_start) {
+            taxid = KRAKEN2_AMBIGUOUS_TAXID;
+        } else {
+            while (queue_pos[head & ring_mask] < start)
+                head++;
+            uint64_t minimizer = queue_vals[head & ring_mask] ^ this->opts.toggle_mask;
+            if (!have_last || minimizer != last_minimizer) {
+                last_taxid = lookup(minimizer);
+                last_minimizer = minimizer;
+                have_last = true;
+            }
+            taxid = last_taxid;
+        }
+        if (!runs.empty() && runs.back().taxid == taxid) {
+            runs.back().count += 1;
+        } else {
+            kmer_pair run = {taxid, 1};
+            runs.push_back(run);
+        }
+    }
+}
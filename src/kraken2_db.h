@@ -0,0 +1,111 @@
+/*********************************************************************
+ * kraken2_db.h is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef KRAKEN2_DB_H
+#define KRAKEN2_DB_H
+
+#include "kmer2read_headers.h"
+#include "kmer_tokenizer.h"
+
+/*Taxid of the runs of ambiguous kmers (the "A" runs of kraken output). It is
+ * kept apart from unclassified kmers so runs split like kraken's, and is read
+ * as unclassified like any taxid above INT32_MAX.*/
+#define KRAKEN2_AMBIGUOUS_TAXID (UINT32_MAX - 1)
+
+/*Index options of a Kraken 2 database, as written to opts.k2d (older
+ * databases write fewer fields; the missing ones are 0)*/
+struct kraken2_options {
+    uint64_t k;
+    uint64_t l;
+    uint64_t spaced_seed_mask;
+    uint64_t toggle_mask;
+    bool dna_db;
+    uint64_t minimum_acceptable_hash_value;
+    int32_t revcom_version;
+    int32_t db_version;
+    int32_t db_type;
+};
+
+/* Class reading a Kraken 2 database (opts.k2d, hash.k2d and taxo.k2d) to
+ * classify library sequences the way kraken2 does, without kraken2 or its
+ * output file. The minimizer of every kmer (the smallest canonical l-mer,
+ * spaced and toggled as in the database options) is looked up in the mapped
+ * compact hash table, and the internal taxon found is reported by its
+ * external taxid. Kmers with a character other than ACGT are ambiguous.
+ */
+class Kraken2Database {
+    public:
+        Kraken2Database();
+        ~Kraken2Database();
+        Kraken2Database(const Kraken2Database &) = delete;
+        Kraken2Database& operator=(const Kraken2Database &) = delete;
+        /*Open the database files of a directory (false with the error set)*/
+        bool open(const string &);
+        string get_error() const;
+        int get_kmer_len() const;
+        int get_minimizer_len() const;
+        /*Number of minimizers in the hash table*/
+        uint64_t size() const;
+        /*Append the kmer runs of the kmers starting at [begin, end) of a
+         * sequence of length len, merging with the last run given*/
+        void get_runs(const char *, size_t, size_t, size_t, vector<kmer_pair> &) const;
+    private:
+        bool read_options(const string &);
+        bool map_hash(const string &);
+        bool read_taxonomy(const string &);
+        uint64_t canonical(uint64_t) const;
+        uint32_t lookup(uint64_t) const;
+
+        kraken2_options opts;
+        uint64_t lmer_mask;
+        /*2-bit code of each character (UINT8_MAX if ambiguous)*/
+        uint8_t codes[256];
+        /*Compact hash table: 32-bit cells of key_bits of hashed key and
+         * value_bits of internal taxon*/
+        const uint32_t *cells;
+        uint64_t capacity;
+        uint64_t n_keys;
+        uint64_t value_bits;
+        uint32_t value_mask;
+        void *hash_data;
+        size_t hash_size;
+        /*External taxid of every internal taxon*/
+        vector<uint32_t> external_ids;
+        string error;
+};
+
+inline string Kraken2Database::get_error() const {
+    return this->error;
+}
+
+inline int Kraken2Database::get_kmer_len() const {
+    return (int) this->opts.k;
+}
+
+inline int Kraken2Database::get_minimizer_len() const {
+    return (int) this->opts.l;
+}
+
+inline uint64_t Kraken2Database::size() const {
+    return this->n_keys;
+}
+
+#endif
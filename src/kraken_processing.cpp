@@ -19,381 +19,917 @@
  * Jennifer Lu, jlu26@jhmi.edu
  * Updated: 2022/03/31
  */
-#include <set>
-
 #include "kraken_processing.h"
 
-#include <limits>
-
-struct TaxidInfo {
-    int count;
-    int score;
-    std::set<int> active_ancestors;
-    std::set<int> ancestors_seen;
-    bool active_ancestors_updated;
-};
-
-// Second idea: Change the logic so that a kmer links to all the taxids that
-// depend on it. That way instead of scanning the active kmers to find out who
-// to update we will instead have a list of dependents that we know we have to
-// update. Any dependent with a count of 0, we remove from the set because it
-// has fallen off.
-class KmerClassifier {
- public:
-    KmerClassifier() {
-        scores[0].count = 0;
-        scores[1].count = 0;
-    }
-
-    int
-    classify_kmers(int kmer_to_add, int kmer_to_remove,
-                   const std::map<int, taxonomy *> *taxid2node) {
-        if (kmer_to_remove >= 0) {
-            scores[kmer_to_remove].count -= 1;
-            scores[kmer_to_remove].score -= 1;
-
-            if (scores[kmer_to_remove].count == 0) {
-                active_kmers.erase(kmer_to_remove);
-            }
+/*METHOD: Split bytes [start, stop) of the mapped kraken file into chunks that
+ * start and end on line boundaries*/
+void partition_kfile(const char *data, size_t start, size_t stop, size_t chunk_size, vector<std::pair<size_t, size_t>> &chunks) {
+    while (start < stop) {
+        size_t end = start + chunk_size;
+        if (end >= stop) {
+            end = stop;
+        } else {
+            //Extend the chunk to include the rest of the current line
+            const char *nl = static_cast<const char *>(memchr(data + end, '\n', stop - end));
+            end = (nl == NULL) ? stop : (nl - data) + 1;
         }
+        chunks.push_back(std::make_pair(start, end));
+        start = end;
+    }
+}
 
-        bool new_kmer = false;
+/*METHOD: Byte range [begin, end) of the lines of shard i of n: the lines that
+ * start in the i-th of n equal parts of the file*/
+void get_shard_range(const KrakenReader &reader, int shard, int n_shards, size_t &begin, size_t &end) {
+    size_t dataSize = reader.size();
+    size_t bounds[2];
+    for (int b = 0; b < 2; b++) {
+        //dataSize * (shard + b) / n_shards without overflow
+        size_t k = shard + b;
+        size_t pos = dataSize / n_shards * k + dataSize % n_shards * k / n_shards;
+        //Move to the start of the first line starting at or after pos
+        bounds[b] = reader.line_start(pos);
+    }
+    begin = bounds[0];
+    end = bounds[1];
+}
 
-        if (kmer_to_add > 1) {
-             if (active_kmers.find(kmer_to_add) == active_kmers.end()) {
-                new_kmer = true;
-                active_kmers.insert(kmer_to_add);
-                scores[kmer_to_add].count = 0;
-                scores[kmer_to_add].score = 0;
-                scores[kmer_to_add].active_ancestors_updated = true;
-            }
+/*METHOD: Append the decimal representation of an integer to a buffer*/
+inline void append_int(string &buf, long long val) {
+    char digits[24];
+    int n = 0;
+    bool negative = val < 0;
+    unsigned long long uval = negative ? -(unsigned long long) val : val;
+    do {
+        digits[n++] = '0' + (uval % 10);
+        uval /= 10;
+    } while (uval > 0);
+    if (negative)
+        buf.push_back('-');
+    while (n > 0)
+        buf.push_back(digits[--n]);
+}
 
-            if (new_kmer) {
-                taxonomy *new_node = taxid2node->find(kmer_to_add)->second;
-                auto comp = [] (taxonomy *a, taxonomy *b) {
-                    return a->get_lvl_num() < b->get_lvl_num();
-                };
+/*METHOD: Write a full buffer at the given file offset*/
+void pwrite_all(int fd, const string &buf, off_t offset) {
+    size_t written = 0;
+    while (written < buf.size()) {
+        ssize_t n = pwrite(fd, buf.data() + written, buf.size() - written, offset + written);
+        if (n < 0)
+            err(1, "  cannot write output file");
+        written += n;
+    }
+}
 
-                std::vector<taxonomy *> nodes;
-                nodes.reserve(active_kmers.size() - 1);
+/*METHOD: Reserve space at the end of the output and write the buffer there*/
+void flush_unordered(kfile_output &out, string &buf) {
+    if (buf.empty())
+        return;
+    off_t offset = __sync_fetch_and_add(&out.offset, (off_t) buf.size());
+    pwrite_all(out.fd, buf, offset);
+    buf.clear();
+}
 
-                for (auto it = active_kmers.begin(); it != active_kmers.end(); it++) {
-                    taxonomy *node = taxid2node->find(*it)->second;
-                    if (node != new_node) {
-                        nodes.push_back(node);
-                    }
-                }
+/*METHOD: Write every finished chunk that is next in input order*/
+void drain_ordered(kfile_output &out) {
+    //Only one thread drains at a time; others leave their buffers pending
+    while (omp_test_lock(&out.write_lock)) {
+        size_t c = __atomic_load_n(&out.next_chunk, __ATOMIC_ACQUIRE);
+        while (c < out.pending.size() && __atomic_load_n(&out.ready[c], __ATOMIC_ACQUIRE)) {
+            pwrite_all(out.fd, out.pending[c], out.offset);
+            out.offset += out.pending[c].size();
+            string().swap(out.pending[c]);
+            c += 1;
+        }
+        __atomic_store_n(&out.next_chunk, c, __ATOMIC_RELEASE);
+        omp_unset_lock(&out.write_lock);
+        //Retry if a chunk finished while the lock was held
+        if (c >= out.pending.size() || !__atomic_load_n(&out.ready[c], __ATOMIC_ACQUIRE))
+            break;
+    }
+}
 
-                std::sort(nodes.begin(), nodes.end(), comp);
-
-                while (nodes.size() != 0) {
-                    auto node = nodes.back();
-                    auto taxid = node->get_taxid();
-
-                    if (node->get_lvl_num() < new_node->get_lvl_num()) {
-                        break;
-                    } else if (scores[taxid].ancestors_seen.find(kmer_to_add) != scores[taxid].ancestors_seen.end()) {
-                        scores[taxid].score += 1;
-                        scores[taxid].active_ancestors.insert(kmer_to_add);
-                    } else {
-                        while (node->get_parent() != NULL && node->get_lvl_num() > new_node->get_lvl_num()) {
-                            node = node->get_parent();
-                        }
-                        if (node->get_taxid() == kmer_to_add) {
-                            scores[taxid].score += 1;
-                            scores[taxid].active_ancestors.insert(kmer_to_add);
-                            scores[taxid].ancestors_seen.insert(kmer_to_add);
-                        }
-                    }
-                    nodes.pop_back();
-                }
+/*METHOD: Print progress no more often than once per PROGRESS_INTERVAL seconds*/
+void report_progress(const int *seqs_read, double *last_report, omp_lock_t *progress_lock) {
+    double now = omp_get_wtime();
+    if (now - *last_report < PROGRESS_INTERVAL)
+        return;
+    if (!omp_test_lock(progress_lock))
+        return;
+    if (now - *last_report >= PROGRESS_INTERVAL) {
+        *last_report = now;
+        cerr << "\r\t\t" << __atomic_load_n(seqs_read, __ATOMIC_RELAXED) << " sequences converted...";
+    }
+    omp_unset_lock(progress_lock);
+}
 
-                taxonomy *curr_n = new_node;
-                auto score = scores[kmer_to_add];
-                while (!nodes.empty()) {
-                    auto node = nodes.back();
-                    if (scores[kmer_to_add].ancestors_seen.find(node->get_taxid()) != scores[kmer_to_add].ancestors_seen.end()) {
-                        scores[kmer_to_add].score += scores[node->get_taxid()].count;
-                        scores[kmer_to_add].active_ancestors.insert(node->get_taxid());
-                    } else {
-                        curr_n = new_node;
-                        while (curr_n->get_parent() != NULL /* && curr_n->get_lvl_num() < node->get_lvl_num()*/) {
-                            curr_n = curr_n->get_parent();
-                            if (curr_n->get_taxid() == nodes.back()->get_taxid()) {
-                                scores[kmer_to_add].score += scores[curr_n->get_taxid()].count;
-                                scores[kmer_to_add].active_ancestors.insert(curr_n->get_taxid());
-                                scores[kmer_to_add].ancestors_seen.insert(curr_n->get_taxid());
-                            }
-                        }
-                    }
-                    nodes.pop_back();
-                }
-            }
+/*A line-aligned range of kraken text and the position of its first byte in the file*/
+struct kfile_chunk {
+    const char *begin;
+    const char *end;
+    uint64_t position;
+};
+
+/*METHOD: Make room for the ordered output of the chunks of a batch*/
+void reserve_chunks(kfile_job &job, size_t n_chunks) {
+    if (!job.options->ordered)
+        return;
+    for (size_t r = 0; r < job.outs.size(); r++) {
+        if (job.outs[r].fd >= 0) {
+            job.outs[r].pending.resize(n_chunks);
+            job.outs[r].ready.resize(n_chunks, 0);
         }
+    }
+}
 
-        scores[kmer_to_add].count += 1;
-        scores[kmer_to_add].score += 1;
+/*METHOD: Output buffers, classifiers and store part of a converting thread*/
+void init_thread(kfile_job &job, kfile_thread &ctx) {
+    const vector<int> &read_lens = *job.read_lens;
+    size_t n_lens = read_lens.size();
+    ctx.thread = omp_get_thread_num();
+    ctx.out_bufs.resize(n_lens);
+    ctx.classifiers.reserve(n_lens);
+    ctx.taxids_mapped.resize(n_lens);
+    for (size_t r = 0; r < n_lens; r++) {
+        ctx.out_bufs[r].reserve(OUTPUT_BUFFER_SIZE);
+        ctx.classifiers.push_back(KmerClassifier(read_lens[r] - job.kmer_len + 1, job.my_taxonomy));
+        //The classifiers of a thread share its cache
+        if (!job.caches.empty())
+            ctx.classifiers.back().set_cache(&job.caches[ctx.thread]);
+    }
+    ctx.part = (job.store == NULL) ? NULL : &job.store_parts[ctx.thread];
+}
 
-        if (active_kmers.size() == 0) {
-            if (scores[1].count > 0) {
-                return 1;
-            } else {
-                return 0;
-            }
+/*METHOD: Warn about a sequence left out for lack of a taxid*/
+void report_missing(kfile_job &job, const char *seqid, size_t seqid_len) {
+    int n_missing = __atomic_add_fetch(&job.seqs_missing, 1, __ATOMIC_RELAXED);
+    if (n_missing <= MAX_MISSING_REPORTED) {
+        #pragma omp critical(report_missing)
+        cerr << "\r\t\tWarning: " << string(seqid, seqid_len) << " not found in seqid2taxid map\n";
+    }
+}
+
+/*METHOD: Add the read mappings of a sequence (those of the thread) to the
+ * thread's distributions and output buffers*/
+void record_mappings(kfile_job &job, kfile_thread &ctx, const char *seqid, size_t seqid_len, int taxid, uint64_t position) {
+    vector<kfile_output> &outs = job.outs;
+    const vector<TaxidCounts> &taxids_mapped = ctx.taxids_mapped;
+    for (size_t r = 0; r < ctx.out_bufs.size(); r++) {
+        if (!job.distribs[r].empty())
+            job.distribs[r][ctx.thread].add(taxid, taxids_mapped[r], position);
+        if (outs[r].fd < 0)
+            continue;
+        string &out_buf = ctx.out_bufs[r];
+        out_buf.append(seqid, seqid_len);
+        out_buf.push_back('\t');
+        append_int(out_buf, taxid);
+        out_buf.append("\t\t");
+        for (auto it=taxids_mapped[r].begin(); it!=taxids_mapped[r].end(); ++it){
+            append_int(out_buf, it->taxid);
+            out_buf.push_back(':');
+            append_int(out_buf, it->count);
+            out_buf.push_back(' ');
         }
+        out_buf.push_back('\n');
+        if (!job.options->ordered && out_buf.size() >= OUTPUT_BUFFER_SIZE)
+            flush_unordered(outs[r], out_buf);
+    }
+    __atomic_add_fetch(&job.seqs_read, 1, __ATOMIC_RELAXED);
+    report_progress(&job.seqs_read, &job.last_report, &job.progress_lock);
+}
 
-        int max_score = 0;
-        int max_taxid = 0;
-        for (auto it = active_kmers.begin(); it != active_kmers.end(); it++) {
-            if (!new_kmer || *it != kmer_to_add) {
-                auto not_found = scores[*it].active_ancestors.end();
-                auto item1 = scores[*it].active_ancestors.find(kmer_to_remove);
-                auto item2 = new_kmer ? not_found : scores[*it].active_ancestors.find(kmer_to_add);
-
-                if (item1 != not_found) {
-                    scores[*it].score -= 1;
-                    if (scores[kmer_to_remove].count == 0)
-                        scores[*it].active_ancestors.erase(item1);
-                }
+/*METHOD: Hand the ordered output of a finished chunk over for writing*/
+void finish_chunk(kfile_job &job, kfile_thread &ctx, size_t chunk) {
+    if (!job.options->ordered)
+        return;
+    vector<kfile_output> &outs = job.outs;
+    for (size_t r = 0; r < outs.size(); r++) {
+        if (outs[r].fd < 0)
+            continue;
+        outs[r].pending[chunk].swap(ctx.out_bufs[r]);
+        ctx.out_bufs[r].reserve(OUTPUT_BUFFER_SIZE);
+        __atomic_store_n(&outs[r].ready[chunk], 1, __ATOMIC_RELEASE);
+        drain_ordered(outs[r]);
+    }
+}
 
-                if (item2 != not_found) {
-                    scores[*it].score += 1;
-                }
-            }
+/*METHOD: Write what is left in the buffers of a thread (unordered output)
+ * or of all threads (ordered output, after the parallel region)*/
+void flush_outputs(kfile_job &job, kfile_thread *ctx) {
+    vector<kfile_output> &outs = job.outs;
+    for (size_t r = 0; r < outs.size(); r++) {
+        if (outs[r].fd < 0)
+            continue;
+        if (ctx != NULL)
+            flush_unordered(outs[r], ctx->out_bufs[r]);
+        else
+            drain_ordered(outs[r]);
+    }
+}
 
-            if (scores[*it].score > max_score) {
-                max_score = scores[*it].score;
-                max_taxid = *it;
-            } else if (scores[*it].score == max_score) {
-                taxonomy *n1 = taxid2node->find(*it)->second;
-                taxonomy *n2 = taxid2node->find(max_taxid)->second;
-                //Get to the same level
-                while (n1->get_lvl_num() > n2->get_lvl_num()) {
-                    if (n1->get_parent() == NULL){
-                        cerr << n1->get_taxid() << endl;
-                    }
-
-                    n1 = n1->get_parent();
+/*METHOD: Convert the lines of a batch of chunks in parallel. Chunk c of the
+ * batch is chunk first_chunk + c of the file (for ordered output).*/
+void process_chunks(kfile_job &job, const vector<kfile_chunk> &chunks, size_t first_chunk) {
+    reserve_chunks(job, first_chunk + chunks.size());
+    #pragma omp parallel
+    {
+        kfile_thread ctx;
+        init_thread(job, ctx);
+
+        //Get a chunk and process each of its lines
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t c = 0; c < chunks.size(); c++) {
+            const char *lineStart = chunks[c].begin;
+            const char *chunkEnd = chunks[c].end;
+            while (lineStart < chunkEnd) {
+                const char *lineEnd = static_cast<const char *>(memchr(lineStart, '\n', chunkEnd - lineStart));
+                if (lineEnd == NULL)
+                    lineEnd = chunkEnd;
+                size_t len = lineEnd - lineStart;
+                if (len == 0) {
+                    lineStart = lineEnd + 1;
+                    continue;
                 }
-                while (n1->get_lvl_num() < n2->get_lvl_num()) {
-                    if (n2->get_parent() == NULL){
-                        cerr << n2->get_taxid() << endl;
-                    }
-                    n2 = n2->get_parent();
+                //CALL METHOD TO PROCESS THE LINE
+                kfile_line line;
+                if (!convert_line(job, ctx, lineStart, len, line)) {
+                    //Sequences without a taxid are left out of the output
+                    report_missing(job, line.seqid, line.seqid_len);
+                    lineStart = lineEnd + 1;
+                    continue;
                 }
-                //Find LCA
-                while (n1 != n2) {
-                    n1 = n1->get_parent();
-                    n2 = n2->get_parent();
+                //Format read information and distributions into this thread's buffers
+                uint64_t position = chunks[c].position + (lineStart - chunks[c].begin);
+                record_mappings(job, ctx, line.seqid, line.seqid_len, line.taxid, position);
+                if (line.reused)
+                    __atomic_add_fetch(&job.seqs_reused, 1, __ATOMIC_RELAXED);
+                if (line.deduped) {
+                    __atomic_add_fetch(&job.seqs_deduped, 1, __ATOMIC_RELAXED);
+                    __atomic_add_fetch(&job.bytes_deduped, (uint64_t) len, __ATOMIC_RELAXED);
                 }
-                max_taxid = n1->get_taxid();
+                lineStart = lineEnd + 1;
             }
+            //Ordered output keeps each chunk's buffer until all earlier chunks are written
+            finish_chunk(job, ctx, first_chunk + c);
         }
+        if (!job.options->ordered)
+            flush_outputs(job, &ctx);
+    }
+    if (job.options->ordered)
+        flush_outputs(job, NULL);
+}
 
-        return max_taxid;
+/*METHOD: Hash the kmer column of every line of the chunks in parallel and
+ * keep the columns found more than once*/
+void find_duplicates(const vector<kfile_chunk> &chunks, SequenceDedup &dedup) {
+    vector<vector<line_hash>> parts(omp_get_max_threads());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t c = 0; c < chunks.size(); c++) {
+        vector<line_hash> &part = parts[omp_get_thread_num()];
+        const char *lineStart = chunks[c].begin;
+        while (lineStart < chunks[c].end) {
+            const char *lineEnd = static_cast<const char *>(memchr(lineStart, '\n', chunks[c].end - lineStart));
+            if (lineEnd == NULL)
+                lineEnd = chunks[c].end;
+            //The kmer column follows the fourth tab
+            const char *p = lineStart;
+            int n_tabs = 0;
+            while (n_tabs < 4 && p != NULL) {
+                p = static_cast<const char *>(memchr(p, '\t', lineEnd - p));
+                if (p != NULL) {
+                    p++;
+                    n_tabs++;
+                }
+            }
+            if (n_tabs == 4)
+                part.push_back(SequenceDedup::hash_column(p, lineEnd));
+            lineStart = lineEnd + 1;
+        }
+    }
+    vector<line_hash> all;
+    for (size_t t = 0; t < parts.size(); t++) {
+        all.insert(all.end(), parts[t].begin(), parts[t].end());
+        vector<line_hash>().swap(parts[t]);
     }
+    dedup.set_duplicates(all);
+}
 
-    void reset() {
-        scores[0].count = 0;
-        scores[0].score = 0;
-        scores[1].count = 0;
-        scores[1].score = 0;
+/*METHOD: Set up the conversion: per-thread caches, the store of an earlier
+ * run, the output files and the per-thread distributions*/
+void start_job(kfile_job &job, const taxonomy *my_taxonomy, const SeqidIndex *seqid2taxid, const int kmer_len, const vector<int> &read_lens, const convert_options &options) {
+    int n_threads = omp_get_max_threads();
+    const string &store_file = options.store_file;
+    const vector<string> &o_files = options.output_files;
+    const vector<string> &d_files = options.distrib_files;
+    job.my_taxonomy = my_taxonomy;
+    job.seqid2taxid = seqid2taxid;
+    job.kmer_len = kmer_len;
+    job.read_lens = &read_lens;
+    job.options = &options;
+    job.seqs_read = 0;
+    job.seqs_missing = 0;
+    job.seqs_reused = 0;
+    job.seqs_deduped = 0;
+    job.bytes_deduped = 0;
+    job.dedup = NULL;
+    job.dedup_bytes = 0;
+    job.last_report = omp_get_wtime();
+    omp_init_lock(&job.progress_lock);
+    if (options.cache_size > 0) {
+        job.caches.resize(n_threads);
+        for (int t = 0; t < n_threads; t++)
+            job.caches[t].init(options.cache_size);
+    }
 
-        for (auto it = active_kmers.begin(); it != active_kmers.end(); ++it) {
-            scores[*it].count = 0;
-            scores[*it].score = 0;
-        }
+    /*Read mappings of earlier runs*/
+    job.store = NULL;
+    if (!store_file.empty()) {
+        job.store = new MappingStore(my_taxonomy, kmer_len);
+        if (job.store->open(store_file))
+            printf("\t>>Loaded %llu stored read mappings from %s\n", (unsigned long long) job.store->size(), store_file.c_str());
+        else
+            printf("\t>>No usable store %s; converting all sequences\n", store_file.c_str());
+        job.store_parts.resize(n_threads);
+    }
 
-        active_kmers.clear();
+    //Open one output file per read length; threads write whole buffers to them
+    size_t n_lens = read_lens.size();
+    vector<kfile_output> &outs = job.outs;
+    outs.resize(n_lens);
+    for (size_t r = 0; r < n_lens; r++) {
+        kfile_output &out = outs[r];
+        out.fd = -1;
+        if (o_files[r].empty())
+            continue;
+        out.fd = open(o_files[r].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out.fd < 0)
+            err(1, "  cannot open %s", o_files[r].c_str());
+        out.offset = 0;
+        out.next_chunk = 0;
+        omp_init_lock(&out.write_lock);
     }
 
- private:
- std::set<int> active_kmers;
- std::map<int, TaxidInfo> scores;
-};
+    //Per-thread kmer distributions of each read length
+    job.distribs.resize(n_lens);
+    for (size_t r = 0; r < n_lens; r++) {
+        if (!d_files[r].empty())
+            job.distribs[r].resize(n_threads);
+    }
+}
 
-inline unsigned int fast_atou(const char *str)
-{
-    unsigned int val = 0;
-    while(*str) {
-        val = (val << 1) + (val << 3) + *(str++) - 48;
+/*METHOD: Report on the conversion, write the store and the kmer
+ * distribution files (partial ones of a shard of data_size bytes)*/
+void finish_job(kfile_job &job, const uint64_t data_size) {
+    const convert_options &options = *job.options;
+    const vector<string> &d_files = options.distrib_files;
+    cerr << "\r\t\t" << job.seqs_read << " sequences converted\n";
+    if (job.seqs_missing > 0)
+        cerr << "\t\tWarning: " << job.seqs_missing << " sequences skipped (seqid not in seqid2taxid map)\n";
+    if (job.dedup != NULL) {
+        printf("\t\t%i duplicate sequences took the read mappings of an identical one (%.1f%% of the kraken file)\n",
+            job.seqs_deduped, (job.dedup_bytes > 0) ? 100.0 * job.bytes_deduped / job.dedup_bytes : 0.0);
+        delete job.dedup;
+    }
+    if (!job.caches.empty()) {
+        uint64_t lookups = 0, hits = 0;
+        size_t memory = 0;
+        for (size_t t = 0; t < job.caches.size(); t++) {
+            lookups += job.caches[t].get_lookups();
+            hits += job.caches[t].get_hits();
+            memory += job.caches[t].get_memory();
+        }
+        printf("\t\tClassification cache: %llu of %llu lookups hit (%.1f%%), %.1f MB in %i caches\n",
+            (unsigned long long) hits, (unsigned long long) lookups, (lookups > 0) ? 100.0 * hits / lookups : 0.0,
+            memory / 1048576.0, (int) job.caches.size());
+    }
+    if (job.store != NULL) {
+        printf("\t\t%i sequences reused from the store, %i converted\n", job.seqs_reused, job.seqs_read - job.seqs_reused - job.seqs_deduped);
+        if (!job.store->save(options.store_file, job.store_parts))
+            printf("\t\tWarning: could not write store %s\n", options.store_file.c_str());
+        vector<store_part>().swap(job.store_parts);
+        delete job.store;
+    }
+    const vector<int> &read_lens = *job.read_lens;
+    size_t n_lens = read_lens.size();
+    vector<kfile_output> &outs = job.outs;
+    for (size_t r = 0; r < n_lens; r++) {
+        if (outs[r].fd < 0)
+            continue;
+        omp_destroy_lock(&outs[r].write_lock);
+        close(outs[r].fd);
+    }
+    /*Merge the per-thread distributions and write the kmer_distrib files*/
+    for (size_t r = 0; r < n_lens; r++) {
+        if (job.distribs[r].empty())
+            continue;
+        KmerDistribution distrib;
+        distrib.merge(job.distribs[r]);
+        if (options.n_shards > 0) {
+            printf("\t>>STEP 4: CREATING PARTIAL KMER DISTRIBUTION FILE %s\n", d_files[r].c_str());
+            distrib_part_info info = {job.kmer_len, read_lens[r], options.shard, options.n_shards, data_size};
+            if (!distrib.write_part(d_files[r], info))
+                err(1, "  cannot write %s", d_files[r].c_str());
+            continue;
+        }
+        printf("\t>>STEP 4: CREATING KMER DISTRIBUTION FILE %s\n", d_files[r].c_str());
+        if (!distrib.write(d_files[r], options.distrib_index))
+            err(1, "  cannot write %s", d_files[r].c_str());
     }
-    return val;
+    omp_destroy_lock(&job.progress_lock);
 }
 
-/*METHOD: Evaluate the kraken database file*/
-void evaluate_kfile(string k_file, string o_file, const taxonomy *my_taxonomy, const map<int, taxonomy *> *taxid2node, const map<string, int> seqid2taxid, const int kmer_len, const int read_len){
-    /*Parallel Variables*/
 
-    FILE * kraken_file = fopen(k_file.c_str(),"r");
-    int fd = fileno(kraken_file);
-    struct stat sb;
-    fstat(fd,&sb);
-    size_t dataSize = sb.st_size;
-    char * data = static_cast<char*>(mmap(NULL, dataSize, PROT_READ,MAP_PRIVATE,fd,0));
-    size_t globalLineCounter = 0;
+/*METHOD: Evaluate the kraken database file for every read length.
+ * Read mappings go to the output files and/or are aggregated into the
+ * distribution files of the options (empty names are skipped). With a store
+ * file, sequences whose kmer line was converted in an earlier run reuse its
+ * read mappings, and the sequences of this run are merged into the store.
+ * With n_shards > 0 only the lines of one shard are evaluated and the
+ * distribution files hold its partial counts. A plain kraken file is mapped
+ * and split among the threads at once unless max_memory (bytes) is given; a
+ * compressed or streamed one is converted in batches of blocks while the
+ * next blocks are read, with all block buffers within max_memory. A
+ * cache_size (bytes per thread) caches the classification of recent windows.
+ * With dedup, a mapped file is first scanned for duplicated kmer columns,
+ * which are then converted once.*/
+void evaluate_kfile(const string &k_file, const taxonomy *my_taxonomy, const SeqidIndex *seqid2taxid, const int kmer_len, const vector<int> &read_lens, const convert_options &options){
+    size_t max_memory = options.max_memory;
+    int shard = options.shard;
+    int n_shards = options.n_shards;
+    /*Parallel Variables*/
+    KrakenReader reader;
+    if (!reader.open(k_file, max_memory > 0)) {
+        if (errno == ENOTSUP)
+            errx(1, "  cannot open %s: zstd support was not compiled in (rebuild with make ZSTD=yes)", k_file.c_str());
+        err(1, "  cannot open %s", k_file.c_str());
+    }
+    bool plain = (reader.get_format() == KRAKEN_PLAIN);
+    bool mapped = plain && max_memory == 0;
+    if (!plain && n_shards > 0)
+        errx(1, "  --shard needs an uncompressed kraken file (%s is %s)", k_file.c_str(), reader.get_format_name());
+    const char *data = reader.data();
+    size_t dataSize = reader.size();
+    int n_threads = omp_get_max_threads();
+
+    /*Blocks of a streamed file: one batch is converted while the next is
+     * queued, and the reader holds one more block plus up to two blocks of
+     * unfinished text*/
+    size_t block_size = STREAM_BLOCK_SIZE;
+    size_t batch_blocks = (size_t) n_threads * STREAM_BLOCKS_PER_THREAD;
+    if (max_memory > 0) {
+        size_t n_blocks = max_memory / block_size;
+        if (n_blocks < 2 * (size_t) n_threads + 3) {
+            n_blocks = 2 * (size_t) n_threads + 3;
+            block_size = max_memory / n_blocks;
+        }
+        if (block_size < MIN_STREAM_BLOCK_SIZE)
+            errx(1, "  --max-memory must be at least %llu MB with %i threads",
+                (unsigned long long) (((2 * (size_t) n_threads + 3) * MIN_STREAM_BLOCK_SIZE + (1 << 20) - 1) >> 20), n_threads);
+        batch_blocks = min(batch_blocks, (n_blocks - 3) / 2);
+    }
 
-    int seqs_read = 0;
+    kfile_job job;
+    start_job(job, my_taxonomy, seqid2taxid, kmer_len, read_lens, options);
     /*Iterate over kraken file in parallel*/
     printf("\t>>STEP 3: CONVERTING KMER MAPPINGS INTO READ CLASSIFICATIONS:\n");
-    printf("\t\t%imers, with a database built using %imers\n",read_len, kmer_len);
+    if (!mapped)
+        printf("\t\treading %s input in batches of %llu blocks of %llu KB\n", reader.get_format_name(),
+            (unsigned long long) batch_blocks, (unsigned long long) block_size >> 10);
+    for (size_t r = 0; r < read_lens.size(); r++)
+        printf("\t\t%imers, with a database built using %imers\n",read_lens[r], kmer_len);
+    printf("\t\tparsing kmer mappings with the %s tokenizer\n", get_tokenizer_name());
     cerr << "\t\t0 sequences converted...";
-    //Open file to append
-    ofstream outfile;
-    outfile.open(o_file, ofstream::out);
+    vector<kfile_chunk> chunks;
+    size_t shard_begin = 0, shard_end = dataSize;
+    if (n_shards > 0) {
+        get_shard_range(reader, shard, n_shards, shard_begin, shard_end);
+        printf("\t>>Shard %i/%i: bytes %llu-%llu of %llu\n", shard + 1, n_shards,
+            (unsigned long long) shard_begin, (unsigned long long) shard_end, (unsigned long long) dataSize);
+    }
+    if (mapped) {
+        /*Hand out line-aligned byte ranges so each thread only scans its own lines*/
+        size_t chunk_size = dataSize / ((size_t) n_threads * CHUNKS_PER_THREAD) + 1;
+        chunk_size = max(min(chunk_size, (size_t) MAX_CHUNK_SIZE), (size_t) MIN_CHUNK_SIZE);
+        vector<std::pair<size_t, size_t>> ranges;
+        partition_kfile(data, shard_begin, shard_end, chunk_size, ranges);
+        for (size_t c = 0; c < ranges.size(); c++) {
+            kfile_chunk chunk = {data + ranges[c].first, data + ranges[c].second, ranges[c].first};
+            chunks.push_back(chunk);
+        }
+        if (options.dedup) {
+            job.dedup = new SequenceDedup();
+            find_duplicates(chunks, *job.dedup);
+            job.dedup_bytes = shard_end - shard_begin;
+            printf("\t\t%llu kmer columns appear more than once\n", (unsigned long long) job.dedup->size());
+        }
+        process_chunks(job, chunks, 0);
+    } else {
+        if (options.dedup)
+            printf("\t\t--dedup needs an uncompressed kraken file read without --max-memory; converting every sequence\n");
+        /*Convert batches of blocks; the reader keeps one more batch ready
+         * meanwhile*/
+        if (plain)
+            reader.set_range(shard_begin, shard_end);
+        reader.start(block_size, batch_blocks);
+        vector<kraken_block> batch(batch_blocks);
+        size_t first_chunk = 0;
+        bool more = true;
+        while (more) {
+            chunks.clear();
+            for (size_t b = 0; b < batch_blocks; b++) {
+                if (!reader.next_block(batch[b])) {
+                    more = false;
+                    break;
+                }
+                kfile_chunk chunk = {batch[b].text.data(), batch[b].text.data() + batch[b].text.size(), batch[b].position};
+                chunks.push_back(chunk);
+            }
+            process_chunks(job, chunks, first_chunk);
+            first_chunk += chunks.size();
+        }
+        if (!reader.get_error().empty())
+            errx(1, "  cannot read %s: %s", k_file.c_str(), reader.get_error().c_str());
+        if (!plain)
+            dataSize = (first_chunk > 0) ? batch[(first_chunk - 1) % batch_blocks].position + batch[(first_chunk - 1) % batch_blocks].text.size() : 0;
+    }
+    finish_job(job, dataSize);
+}
+
+/*Kmers [begin, end) of library record number record, classified by one thread*/
+struct scan_item {
+    size_t record;
+    size_t begin;
+    size_t end;
+};
 
+/*METHOD: Classify the kmers of a batch of library records with the Kraken 2
+ * database and convert them in parallel. Long sequences are classified in
+ * pieces by several threads and joined again before conversion. Record r of
+ * the batch is sequence first_record + r of the library (for ordered output).*/
+void process_records(kfile_job &job, const Kraken2Database &db, const vector<library_record> &records, size_t n_records, size_t first_record) {
+    const vector<int> &read_lens = *job.read_lens;
+    size_t n_lens = read_lens.size();
+    size_t kmer_len = job.kmer_len;
+    reserve_chunks(job, first_record + n_records);
+    vector<scan_item> items;
+    vector<size_t> first_item(n_records + 1);
+    for (size_t r = 0; r < n_records; r++) {
+        first_item[r] = items.size();
+        size_t n_kmers = (records[r].seq.size() >= kmer_len) ? records[r].seq.size() - kmer_len + 1 : 0;
+        for (size_t b = 0; b < n_kmers; b += LIBRARY_SCAN_KMERS) {
+            scan_item item = {r, b, min(n_kmers, b + LIBRARY_SCAN_KMERS)};
+            items.push_back(item);
+        }
+    }
+    first_item[n_records] = items.size();
+    vector<vector<kmer_pair>> item_runs(items.size());
     #pragma omp parallel
     {
-        bool processMore = true;
-        size_t lastReadPos = 0;
-        size_t newLineCnt = 0;
-        size_t i;
-        string kraken_line;
-        KmerClassifier classifier;
-
-        //Get the line and process
-        while(processMore) {
-            //Get line number
-            int currLineToProcess = __sync_fetch_and_add(&globalLineCounter,1);
-            //Get line
-            for (i = lastReadPos; i < dataSize; i++){
-                newLineCnt += (data[i]=='\n');
-                if(newLineCnt == currLineToProcess){
-                    char * lineStart = &data[i + (data[i]=='\n' ? 1 : 0)];
-                    size_t pos=0;
-                    while(lineStart[pos] != '\n' && (i + pos) < dataSize){
-                        pos++;
-                    }
-                    char *lineEnd = &lineStart[pos];
-                    size_t len = lineEnd - lineStart;
-                    kraken_line.resize(len);
-                    kraken_line.assign(lineStart, len);
-                    //Variables for things to save
-                    string seqid = "";
-                    int taxid = -1;
-                    std::map<int, int> taxids_mapped;
-
-                    //CALL METHOD TO PROCESS THE LINE
-                    convert_line(kraken_line, &seqid2taxid, read_len, kmer_len, my_taxonomy, taxid2node, seqid, taxid, taxids_mapped, classifier);
-                    //PRINT FOR LINE
-                    #pragma omp atomic
-                    seqs_read += 1;
-                    #pragma omp critical
-                    {
-                        cerr << "\r\t\t" << seqs_read << " sequences converted (finished: ";
-                        cerr << seqid << ")";
-                        //Print read information
-                        outfile << seqid << "\t";
-                        outfile << taxid << "\t";
-                        outfile << "" << "\t";
-                        //Print distributions
-                        for (auto it=taxids_mapped.begin(); it!=taxids_mapped.end(); ++it){
-                            outfile << it->first << ":" << it->second << " ";
-                        }
-                        outfile << "\n";
-                    }
-                    lastReadPos = i+1;
-                    break;
+        kfile_thread ctx;
+        init_thread(job, ctx);
+        vector<kmer_pair> runs;
+
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t i = 0; i < items.size(); i++) {
+            const string &seq = records[items[i].record].seq;
+            db.get_runs(seq.data(), seq.size(), items[i].begin, items[i].end, item_runs[i]);
+        }
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t r = 0; r < n_records; r++) {
+            const library_record &record = records[r];
+            int taxid = job.seqid2taxid->find(record.id.data(), record.id.size());
+            if (taxid == SEQID_NOT_FOUND) {
+                report_missing(job, record.id.data(), record.id.size());
+                finish_chunk(job, ctx, first_record + r);
+                continue;
+            }
+            //Join the runs of the pieces of the sequence
+            runs.clear();
+            for (size_t i = first_item[r]; i < first_item[r + 1]; i++) {
+                for (auto it = item_runs[i].begin(); it != item_runs[i].end(); ++it) {
+                    if (!runs.empty() && runs.back().taxid == it->taxid)
+                        runs.back().count += it->count;
+                    else
+                        runs.push_back(*it);
                 }
+                vector<kmer_pair>().swap(item_runs[i]);
+            }
+            for (size_t l = 0; l < n_lens; l++)
+                ctx.taxids_mapped[l].clear();
+            bool reused = false;
+            store_key key;
+            if (job.store != NULL) {
+                key = job.store->get_key(runs);
+                reused = job.store->find(key, read_lens, ctx.taxids_mapped);
             }
-            if(i == dataSize) {
-                processMore = false;
+            if (!reused) {
+                uint64_t n_kmers = (record.seq.size() >= kmer_len) ? record.seq.size() - kmer_len + 1 : 0;
+                convert_runs(job, ctx, runs, n_kmers);
+            }
+            if (job.store != NULL)
+                job.store->add(*ctx.part, key, read_lens, ctx.taxids_mapped);
+            record_mappings(job, ctx, record.id.data(), record.id.size(), taxid, first_record + r);
+            if (reused)
+                __atomic_add_fetch(&job.seqs_reused, 1, __ATOMIC_RELAXED);
+            finish_chunk(job, ctx, first_record + r);
+        }
+        if (!job.options->ordered)
+            flush_outputs(job, &ctx);
+    }
+    if (job.options->ordered)
+        flush_outputs(job, NULL);
+}
+
+/*METHOD: Evaluate the library sequences of a Kraken 2 database for every
+ * read length without database.kraken: the kmers of each sequence are
+ * classified with the database itself and go straight to the read
+ * classifiers. The library FASTA files are read in batches of sequences.
+ * Output files, distribution files, store and cache as in evaluate_kfile
+ * (the options of a kraken file, shards, max_memory and dedup, are unused).*/
+void evaluate_library(const Kraken2Database &db, const vector<string> &library_files, const taxonomy *my_taxonomy, const SeqidIndex *seqid2taxid, const vector<int> &read_lens, const convert_options &options) {
+    int n_threads = omp_get_max_threads();
+    int kmer_len = db.get_kmer_len();
+    size_t batch_size = (size_t) n_threads * LIBRARY_BATCH_SIZE;
+    kfile_job job;
+    start_job(job, my_taxonomy, seqid2taxid, kmer_len, read_lens, options);
+
+    printf("\t>>STEP 3: CLASSIFYING LIBRARY SEQUENCES INTO READ CLASSIFICATIONS:\n");
+    printf("\t\tKraken 2 database of %llu minimizers (%imers, minimizer length %i)\n",
+        (unsigned long long) db.size(), kmer_len, db.get_minimizer_len());
+    printf("\t\treading library sequences in batches of %llu MB\n", (unsigned long long) batch_size >> 20);
+    for (size_t r = 0; r < read_lens.size(); r++)
+        printf("\t\t%imers, with a database built using %imers\n",read_lens[r], kmer_len);
+    cerr << "\t\t0 sequences converted...";
+    LibraryReader reader;
+    vector<library_record> batch;
+    size_t n_records = 0;
+    size_t batch_bases = 0;
+    size_t first_record = 0;
+    for (size_t f = 0; f < library_files.size(); f++) {
+        if (!reader.open(library_files[f]))
+            err(1, "  cannot open %s", library_files[f].c_str());
+        while (true) {
+            if (n_records == batch.size())
+                batch.resize(n_records + 1);
+            if (!reader.next(batch[n_records]))
+                break;
+            batch_bases += batch[n_records].seq.size();
+            n_records += 1;
+            if (batch_bases >= batch_size) {
+                process_records(job, db, batch, n_records, first_record);
+                first_record += n_records;
+                n_records = 0;
+                batch_bases = 0;
             }
         }
+        if (!reader.get_error().empty())
+            errx(1, "  cannot read %s: %s", library_files[f].c_str(), reader.get_error().c_str());
+        reader.close();
     }
-    cerr << "\r\t\t" << globalLineCounter << " sequences converted\n";
+    if (n_records > 0)
+        process_records(job, db, batch, n_records, first_record);
+    finish_job(job, 0);
+}
 
+/*Taxon index of the kmers of a pair (TAXON_NONE for unclassified, ambiguous
+ * and unknown kmers)*/
+inline int get_pair_taxon(const kmer_pair &pair, const taxonomy *my_taxonomy) {
+    if (pair.taxid == 0 || pair.taxid > INT32_MAX)
+        return TAXON_NONE;
+    return my_taxonomy->get_index((int) pair.taxid);
+}
+
+/*METHOD: Read mappings of the reads starting at kmers [seg_begin, seg_end) of
+ * a sequence, given as its runs (run first_run starts at kmer run_pos). Each
+ * read length is fed up to n_kmers - 1 kmers past seg_end, so the windows
+ * starting in the segment are complete, and the segments of a sequence
+ * together classify every window exactly once.*/
+void convert_segment(const vector<kmer_pair> &runs, size_t first_run, uint64_t run_pos, uint64_t seg_begin, uint64_t seg_end, const vector<int> &n_kmers, const taxonomy *my_taxonomy, vector<TaxidCounts> &taxids_mapped) {
+    size_t n_lens = n_kmers.size();
+    vector<KmerClassifier> classifiers;
+    vector<uint64_t> feed_end(n_lens);
+    uint64_t max_end = 0;
+    classifiers.reserve(n_lens);
+    for (size_t r = 0; r < n_lens; r++) {
+        classifiers.push_back(KmerClassifier(n_kmers[r], my_taxonomy));
+        feed_end[r] = seg_end + n_kmers[r] - 1;
+        max_end = max(max_end, feed_end[r]);
+    }
+    uint64_t pos = run_pos;
+    for (size_t i = first_run; i < runs.size() && pos < max_end; i++) {
+        if (runs[i].taxid == KMER_MATE_SEPARATOR) {
+            for (size_t r = 0; r < n_lens; r++)
+                classifiers[r].reset();
+            continue;
+        }
+        int taxon = get_pair_taxon(runs[i], my_taxonomy);
+        uint64_t begin = max(pos, seg_begin);
+        uint64_t end = pos + runs[i].count;
+        for (size_t r = 0; r < n_lens; r++) {
+            uint64_t stop = min(end, feed_end[r]);
+            if (stop > begin)
+                classifiers[r].add_run(taxon, (int) (stop - begin), taxids_mapped[r]);
+        }
+        pos = end;
+    }
+}
+
+/*METHOD: Convert the kmer runs of a long sequence as overlapping segments,
+ * each an OpenMP task, so threads that have run out of chunks help with it.
+ * Returns false (converting nothing) if the sequence is too short to be
+ * worth splitting.*/
+bool convert_segments(const vector<kmer_pair> &runs, const vector<int> &n_kmers, const taxonomy *my_taxonomy, TaxidCounts **taxids_mapped) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < runs.size(); i++)
+        total += (runs[i].taxid == KMER_MATE_SEPARATOR) ? 0 : runs[i].count;
+    uint64_t n_segments = min((uint64_t) omp_get_num_threads() * SEGMENTS_PER_THREAD, total / MIN_SEGMENT_KMERS);
+    if (n_segments < 2)
+        return false;
+    //Segment boundaries and the run holding the first kmer of each segment
+    uint64_t seg_len = (total + n_segments - 1) / n_segments;
+    vector<size_t> first_run(n_segments, runs.size());
+    vector<uint64_t> run_pos(n_segments, total);
+    uint64_t pos = 0;
+    uint64_t s = 0;
+    for (size_t i = 0; i < runs.size() && s < n_segments; i++) {
+        uint64_t count = (runs[i].taxid == KMER_MATE_SEPARATOR) ? 0 : runs[i].count;
+        while (s < n_segments && s * seg_len < pos + count) {
+            first_run[s] = i;
+            run_pos[s] = pos;
+            s++;
+        }
+        pos += count;
+    }
+    vector<vector<TaxidCounts>> seg_mapped(n_segments, vector<TaxidCounts>(n_kmers.size()));
+    for (uint64_t k = 0; k < n_segments; k++) {
+        #pragma omp task default(shared) firstprivate(k)
+        convert_segment(runs, first_run[k], run_pos[k], k * seg_len, min((k + 1) * seg_len, total), n_kmers, my_taxonomy, seg_mapped[k]);
+    }
+    #pragma omp taskwait
+    for (uint64_t k = 0; k < n_segments; k++) {
+        for (size_t r = 0; r < n_kmers.size(); r++) {
+            for (auto it = seg_mapped[k][r].begin(); it != seg_mapped[k][r].end(); ++it)
+                taxids_mapped[r]->add(it->taxid, it->count);
+        }
+    }
+    return true;
+}
+
+/*METHOD: Convert the kmer field [p, line_end) of a long sequence as segments*/
+bool convert_segments(const char *p, const char *line_end, const vector<int> &n_kmers, const taxonomy *my_taxonomy, TaxidCounts **taxids_mapped) {
+    vector<kmer_pair> runs;
+    kmer_pair pairs[KMER_PAIR_BATCH];
+    size_t n_pairs;
+    while ((n_pairs = parse_kmer_pairs(p, line_end, pairs, KMER_PAIR_BATCH)) > 0)
+        runs.insert(runs.end(), pairs, pairs + n_pairs);
+    return convert_segments(runs, n_kmers, my_taxonomy, taxids_mapped);
+}
+
+/*METHOD: Classifiers and read mappings of the read lengths of at least one
+ * kmer (the only ones producing read mappings); returns their number*/
+inline size_t get_active_lengths(const kfile_job &job, kfile_thread &ctx, KmerClassifier **active, TaxidCounts **mapped, vector<int> *n_kmers) {
+    const vector<int> &read_lens = *job.read_lens;
+    const int kmer_len = job.kmer_len;
+    size_t n_lens = 0;
+    for (size_t r = 0; r < read_lens.size(); r++) {
+        if (read_lens[r] - kmer_len + 1 > 0) {
+            active[n_lens] = &ctx.classifiers[r];
+            mapped[n_lens] = &ctx.taxids_mapped[r];
+            if (n_kmers != NULL)
+                n_kmers->push_back(read_lens[r] - kmer_len + 1);
+            n_lens += 1;
+        }
+    }
+    return n_lens;
+}
+
+/*METHOD: Feed kmer runs to the classifier of every active read length*/
+inline void classify_pairs(const kmer_pair *pairs, size_t n_pairs, KmerClassifier **active, TaxidCounts **mapped, size_t n_lens, const taxonomy *my_taxonomy) {
+    for (size_t i = 0; i < n_pairs; i++) {
+        //Reads do not span the two mates of a paired sequence
+        if (pairs[i].taxid == KMER_MATE_SEPARATOR) {
+            for (size_t r = 0; r < n_lens; r++)
+                active[r]->reset();
+            continue;
+        }
+        int taxon = get_pair_taxon(pairs[i], my_taxonomy);
+        //Each classifier slides over the whole run at once
+        for (size_t r = 0; r < n_lens; r++)
+            active[r]->add_run(taxon, (int) pairs[i].count, *mapped[r]);
+    }
+}
+
+/*METHOD: Read mappings of a sequence of n_seq_kmers kmers given as its
+ * kmer runs, into the thread's read mappings (ordered by taxid), splitting
+ * long sequences into segments*/
+void convert_runs(const kfile_job &job, kfile_thread &ctx, const vector<kmer_pair> &runs, uint64_t n_seq_kmers) {
+    const taxonomy *my_taxonomy = job.my_taxonomy;
+    KmerClassifier *active[MAX_READ_LENGTHS];
+    TaxidCounts *mapped[MAX_READ_LENGTHS];
+    vector<int> n_kmers;
+    size_t n_lens = get_active_lengths(job, ctx, active, mapped, &n_kmers);
+    bool converted = false;
+    if (n_seq_kmers >= SPLIT_LINE_SIZE && omp_get_num_threads() > 1)
+        converted = convert_segments(runs, n_kmers, my_taxonomy, mapped);
+    if (!converted) {
+        classify_pairs(runs.data(), runs.size(), active, mapped, n_lens, my_taxonomy);
+        for (size_t r = 0; r < n_lens; r++)
+            active[r]->reset();
+    }
+    for (size_t r = 0; r < n_lens; r++)
+        mapped[r]->sort();
 }
 
 // /***************************************************************************************/
-// /*METHOD: CONVERT DISTRIBUTIONS INTO READ MAPPINGS - SEND TO PRINT*/
-void convert_line(string line, const std::map<string,int> *seqid2taxid, const int read_len, const int kmer_len, const taxonomy *my_taxonomy, const std::map<int, taxonomy *> *taxid2node, string &seqid, int &taxid, std::map<int,int> &taxids_mapped, KmerClassifier &classifier){
-    int pos1, pos2, pos3, pos4, pos5;
-    pos1 = line.find("\t");
-    pos2 = line.find("\t", pos1+1);
-    pos3 = line.find("\t", pos2+1);
-    pos4 = line.find("\t", pos3+1);
-    pos5 = line.find("\n", pos4+1);
+// /*METHOD: CONVERT DISTRIBUTIONS INTO READ MAPPINGS - SEND TO PRINT
+//  * The kmer runs are decoded once and fed to the classifier of every read length.
+//  * Long sequences are split into segments converted by several threads.
+//  * The read mappings of each read length go to the thread's taxids_mapped,
+//  * ordered by taxid; the seqid and taxid of the line go to result.
+//  * With a store, stored read mappings are reused (setting reused) and new
+//  * ones are recorded in the thread's part. With dedup, a duplicated kmer
+//  * column already converted in this run is not converted again (setting
+//  * deduped)*/
+bool convert_line(const kfile_job &job, kfile_thread &ctx, const char *line, size_t line_len, kfile_line &result){
+    const vector<int> &read_lens = *job.read_lens;
+    const MappingStore *store = job.store;
+    SequenceDedup *dedup = job.dedup;
+    vector<TaxidCounts> &taxids_mapped = ctx.taxids_mapped;
+    for (size_t r = 0; r < taxids_mapped.size(); r++)
+        taxids_mapped[r].clear();
+    result.reused = false;
+    result.deduped = false;
+    const char *line_end = line + line_len;
+    const char *tabs[4];
+    const char *p = line;
+    int n_tabs = 0;
+    while (n_tabs < 4) {
+        p = static_cast<const char *>(memchr(p, '\t', line_end - p));
+        if (p == NULL)
+            break;
+        tabs[n_tabs++] = p++;
+    }
     //Extract seqid and taxid
-    seqid = line.substr(pos1 + 1, pos2 - pos1 - 1);
-    taxid = seqid2taxid->find(seqid)->second;
-    char *curr_ks = &line[pos4 + 1];
-
-    /*Initialize variables for getting read mappings instead of kmer mappings */
-    int n_kmers = read_len - kmer_len + 1;
-
-    //Saving values
-    vector<std::pair<int, int>> all_kmers;
-    size_t count_kmers = 0;
-    //Iterate through all of the kmer pairs
-    int mid, end;
-    int pair_taxid, pair_count;
-    string curr_pair, pair_tstr;
-    size_t len = line.size() - pos4;
-    size_t n_alloc = 0;
-    curr_ks[len - 1] = ' ';
-    for (int i = 0; i < len; i++) {
-        if (curr_ks[i] == ' ')
-          n_alloc++;
-    }
-    all_kmers.reserve(n_alloc);
-    for (size_t i = 0; i < len; i++) {
-        // Split up this pair into the taxid and the number of kmers
-        char *data = &curr_ks[i];
-        char *mid = (char *)memchr(data, (int)':', len - i);
-        if (mid == NULL) break;
-        char *end = (char *)memchr(data, (int)' ', len - i);
-        *mid = '\0';
-        *end  = '\0';
-        pair_count = fast_atou(mid + 1);
-        if (data[0] == 'A')
-            pair_taxid = 0;
-        else {
-            pair_taxid = fast_atou(data);
+    result.seqid = (n_tabs > 0) ? tabs[0] + 1 : line_end;
+    result.seqid_len = (n_tabs > 1) ? tabs[1] - result.seqid : line_end - result.seqid;
+    result.taxid = job.seqid2taxid->find(result.seqid, result.seqid_len);
+    if (result.taxid == SEQID_NOT_FOUND)
+        return false;
+    if (n_tabs < 4)
+        return true;
+
+    /*Only read lengths of at least one kmer produce read mappings*/
+    KmerClassifier *active[MAX_READ_LENGTHS];
+    TaxidCounts *mapped[MAX_READ_LENGTHS];
+    size_t n_lens = get_active_lengths(job, ctx, active, mapped, NULL);
+    if (n_lens == 0)
+        return true;
+    //A copy of a duplicated kmer column takes the read mappings of the first
+    long dedup_slot = -1;
+    if (dedup != NULL && dedup->size() > 0) {
+        dedup_slot = dedup->find_slot(SequenceDedup::hash_column(tabs[3] + 1, line_end));
+        if (dedup_slot >= 0 && dedup->get(dedup_slot, taxids_mapped)) {
+            result.deduped = true;
+            if (store != NULL)
+                store->add(*ctx.part, store->get_key(tabs[3] + 1, line_end), read_lens, taxids_mapped);
+            return true;
         }
-        // Add kmers to queue
-        all_kmers.push_back(std::make_pair(pair_taxid, pair_count));
-        count_kmers += 1;
-
-        i = end - curr_ks;
-    }
-
-    //Process all mappings
-    deque<int> curr_kmers;
-    int mapped_taxid = -1;
-    uint32_t prev_kmer = -1, next_kmer;
-    uint32_t prev_taxid;
-    uint32_t hash1, hash2;
-    size_t hash;
-
-    for (int k = 0; k < count_kmers; k++) {
-        next_kmer = all_kmers[k].first;
-        int count = all_kmers[k].second;
-        for (int j = 0; j < count; j++) {
-            curr_kmers.push_back(next_kmer);
-            if (curr_kmers.size() == n_kmers) {
-                if (prev_kmer == next_kmer) {
-                    mapped_taxid = prev_taxid;
-                } else {
-                    mapped_taxid = classifier.classify_kmers(
-                        next_kmer, prev_kmer, taxid2node);
-                }
-                //Save to map
-                auto t_it = taxids_mapped.find(mapped_taxid);
-                if (t_it == taxids_mapped.end()){
-                    taxids_mapped[mapped_taxid] = 1;
-                    //.insert(std::pair<int,int>(mapped_taxid, 1));
-                } else {
-                    t_it->second += 1;
-                }
-                prev_taxid = mapped_taxid;
-                //Remove last element
-                prev_kmer = curr_kmers.front();
-                curr_kmers.pop_front();
-            } else {
-                classifier.classify_kmers(next_kmer, prev_kmer, taxid2node);
-            }
+    }
+    store_key key;
+    if (store != NULL) {
+        key = store->get_key(tabs[3] + 1, line_end);
+        if (store->find(key, read_lens, taxids_mapped)) {
+            result.reused = true;
+            store->add(*ctx.part, key, read_lens, taxids_mapped);
+            if (dedup_slot >= 0)
+                dedup->put(dedup_slot, taxids_mapped);
+            return true;
         }
     }
-    classifier.reset();
+    p = tabs[3] + 1;
+    bool converted = false;
+    if (line_end - p >= SPLIT_LINE_SIZE && omp_get_num_threads() > 1) {
+        vector<int> n_kmers;
+        for (size_t r = 0; r < read_lens.size(); r++) {
+            if (read_lens[r] - job.kmer_len + 1 > 0)
+                n_kmers.push_back(read_lens[r] - job.kmer_len + 1);
+        }
+        converted = convert_segments(p, line_end, n_kmers, job.my_taxonomy, mapped);
+    }
+    if (!converted) {
+        //Iterate through all of the kmer pairs, tokenized in batches
+        kmer_pair pairs[KMER_PAIR_BATCH];
+        size_t n_pairs;
+        while ((n_pairs = parse_kmer_pairs(p, line_end, pairs, KMER_PAIR_BATCH)) > 0)
+            classify_pairs(pairs, n_pairs, active, mapped, n_lens, job.my_taxonomy);
+        for (size_t r = 0; r < n_lens; r++)
+            active[r]->reset();
+    }
+    for (size_t r = 0; r < n_lens; r++)
+        mapped[r]->sort();
+    if (dedup_slot >= 0)
+        dedup->put(dedup_slot, taxids_mapped);
+    if (store != NULL)
+        store->add(*ctx.part, key, read_lens, taxids_mapped);
+    return true;
 }
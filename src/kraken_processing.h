@@ -25,17 +25,135 @@
 #include "kmer2read_headers.h"
 #include "taxonomy.h"
 #include "ctime.h"
+#include "kmer_classifier.h"
+#include "seqid_index.h"
+#include "kmer_distribution.h"
+#include "mapping_store.h"
+#include "kraken_reader.h"
+#include "kmer_tokenizer.h"
+#include "sequence_dedup.h"
+#include "kraken2_db.h"
+#include "library_reader.h"
 #include <sys/mman.h>
+#include <fcntl.h>
 
-#include <deque>
+/*Line-aligned chunk sizes used to split the kraken file across threads*/
+#define MIN_CHUNK_SIZE (1 << 20)
+#define MAX_CHUNK_SIZE (64 << 20)
+#define CHUNKS_PER_THREAD 16
+/*Compressed (or streamed) input is read into blocks of this size, converted
+ * in batches of this many blocks per thread; a memory limit shrinks the
+ * blocks down to the minimum size*/
+#define STREAM_BLOCK_SIZE (8 << 20)
+#define MIN_STREAM_BLOCK_SIZE (256 << 10)
+#define STREAM_BLOCKS_PER_THREAD 4
+/*Sequences with a kmer field of at least this many bytes are split into up
+ * to this many segments per thread (of at least this many kmers each),
+ * converted as OpenMP tasks*/
+#define SPLIT_LINE_SIZE (1 << 20)
+#define SEGMENTS_PER_THREAD 4
+#define MIN_SEGMENT_KMERS (1 << 16)
+/*Library sequences are read in batches of this many bases per thread and
+ * their kmers classified in pieces of at most this many kmers*/
+#define LIBRARY_BATCH_SIZE (16 << 20)
+#define LIBRARY_SCAN_KMERS (1 << 20)
+/*Output is formatted per thread and written in blocks of at least this size*/
+#define OUTPUT_BUFFER_SIZE (4 << 20)
+/*Minimum number of seconds between progress updates*/
+#define PROGRESS_INTERVAL 1.0
+/*Maximum number of read lengths evaluated in one pass*/
+#define MAX_READ_LENGTHS 64
+/*Number of missing seqids printed individually*/
+#define MAX_MISSING_REPORTED 10
 
-class KmerClassifier;
+/*Options of a conversion: the output and kmer distribution files of each
+ * read length (empty names are skipped) and the run options of the command
+ * line*/
+struct convert_options {
+    vector<string> output_files;
+    vector<string> distrib_files;
+    bool ordered;
+    /*Write indexed kmer_distrib files*/
+    bool distrib_index;
+    /*Read mappings of earlier runs, rewritten at the end (empty if none)*/
+    string store_file;
+    /*Only evaluate shard number shard of n_shards (0 shards: everything)*/
+    int shard;
+    int n_shards;
+    /*Bytes of read buffers of a streamed file (0 maps a plain file)*/
+    size_t max_memory;
+    /*Bytes of window classification cache per thread (0 for none)*/
+    size_t cache_size;
+    /*Convert duplicated kmer columns once*/
+    bool dedup;
+};
 
-void evaluate_kfile(string, string, const taxonomy *, const map<int, taxonomy *> *, map<string, int>, const int, const int);
+/*Shared state for flushing per-thread output buffers*/
+struct kfile_output {
+    int fd;
+    off_t offset;
+    size_t next_chunk;
+    vector<string> pending;
+    vector<int> ready;
+    omp_lock_t write_lock;
+};
 
-void convert_line(string, const map<string, int> *, const int, const int, const taxonomy *, const map<int, taxonomy *> *, string &, int &, std::map<int,int> &, KmerClassifier &);
+/*State shared by the threads converting a kraken file*/
+struct kfile_job {
+    const taxonomy *my_taxonomy;
+    const SeqidIndex *seqid2taxid;
+    int kmer_len;
+    const vector<int> *read_lens;
+    const convert_options *options;
+    vector<kfile_output> outs;
+    vector<vector<KmerDistribution>> distribs;
+    MappingStore *store;
+    vector<store_part> store_parts;
+    /*Per-thread window classification caches (empty when disabled)*/
+    vector<ClassifyCache> caches;
+    int seqs_read;
+    int seqs_missing;
+    int seqs_reused;
+    int seqs_deduped;
+    uint64_t bytes_deduped;
+    /*Duplicated kmer columns and the bytes scanned for them*/
+    SequenceDedup *dedup;
+    uint64_t dedup_bytes;
+    double last_report;
+    omp_lock_t progress_lock;
+};
 
-int get_classification(deque<int> &, const taxonomy *, const map<int, taxonomy *> *);
+/*State of one converting thread: its output buffers, the classifier and
+ * read mappings of every read length and its part of the store (NULL
+ * without a store)*/
+struct kfile_thread {
+    int thread;
+    vector<string> out_bufs;
+    vector<KmerClassifier> classifiers;
+    vector<TaxidCounts> taxids_mapped;
+    store_part *part;
+};
+
+/*A converted kraken line: its seqid and taxid, and whether its read
+ * mappings were reused from the store or from an identical line*/
+struct kfile_line {
+    const char *seqid;
+    size_t seqid_len;
+    int taxid;
+    bool reused;
+    bool deduped;
+};
+
+void partition_kfile(const char *, size_t, size_t, size_t, vector<std::pair<size_t, size_t>> &);
+void get_shard_range(const KrakenReader &, int, int, size_t &, size_t &);
+
+void evaluate_kfile(const string &, const taxonomy *, const SeqidIndex *, const int, const vector<int> &, const convert_options &);
+
+void evaluate_library(const Kraken2Database &, const vector<string> &, const taxonomy *, const SeqidIndex *, const vector<int> &, const convert_options &);
+
+bool convert_line(const kfile_job &, kfile_thread &, const char *, size_t, kfile_line &);
+
+void convert_runs(const kfile_job &, kfile_thread &, const vector<kmer_pair> &, uint64_t);
 
 
 #endif
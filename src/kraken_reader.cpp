@@ -0,0 +1,375 @@
+/*********************************************************************
+ * kraken_reader.cpp is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "kraken_reader.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*Constructor and Destructor*/
+KrakenReader::KrakenReader() {
+    this->format = KRAKEN_PLAIN;
+    this->mapped = NULL;
+    this->file_size = 0;
+    this->plain_fd = -1;
+    this->read_offset = 0;
+    this->read_end = 0;
+    this->dropped = 0;
+    this->gz = NULL;
+#ifdef HAVE_ZSTD
+    this->zstd_file = NULL;
+    this->zstd_stream = NULL;
+    this->zstd_last = 0;
+#endif
+    this->block_size = 0;
+    this->max_blocks = 0;
+    this->finished = false;
+    this->stopping = false;
+}
+
+KrakenReader::~KrakenReader() {
+    if (this->worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(this->queue_lock);
+            this->stopping = true;
+        }
+        this->queue_changed.notify_all();
+        this->worker.join();
+    }
+    close_input();
+    if (this->mapped != NULL)
+        munmap(this->mapped, this->file_size);
+}
+
+/*METHOD: Release the streamed or compressed input*/
+void KrakenReader::close_input() {
+    if (this->plain_fd >= 0)
+        close(this->plain_fd);
+    this->plain_fd = -1;
+    if (this->gz != NULL)
+        gzclose(this->gz);
+    this->gz = NULL;
+#ifdef HAVE_ZSTD
+    if (this->zstd_stream != NULL)
+        ZSTD_freeDStream(this->zstd_stream);
+    if (this->zstd_file != NULL)
+        fclose(this->zstd_file);
+    this->zstd_stream = NULL;
+    this->zstd_file = NULL;
+#endif
+}
+
+/*METHOD: Open a kraken file: map (or prepare to stream) a plain file, or
+ * prepare to decompress a gzip/zstd file (recognized by its magic bytes)*/
+bool KrakenReader::open(const string &k_file, bool stream_plain) {
+    int fd = ::open(k_file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    unsigned char magic[4] = {0, 0, 0, 0};
+    ssize_t n_magic = pread(fd, magic, sizeof(magic), 0);
+    if (n_magic >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        this->format = KRAKEN_GZIP;
+    } else if (n_magic == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        this->format = KRAKEN_ZSTD;
+    } else {
+        this->format = KRAKEN_PLAIN;
+        struct stat sb;
+        if (fstat(fd, &sb) != 0) {
+            close(fd);
+            return false;
+        }
+        this->file_size = sb.st_size;
+        if (stream_plain) {
+            this->plain_fd = fd;
+            this->read_end = this->file_size;
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            return true;
+        }
+        if (this->file_size > 0) {
+            void *data = mmap(NULL, this->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                return false;
+            }
+            this->mapped = static_cast<char *>(data);
+        }
+        close(fd);
+        return true;
+    }
+    if (this->format == KRAKEN_GZIP) {
+        this->gz = gzdopen(fd, "rb");
+        if (this->gz == NULL) {
+            close(fd);
+            return false;
+        }
+        gzbuffer(this->gz, 1 << 20);
+        return true;
+    }
+#ifdef HAVE_ZSTD
+    this->zstd_file = fdopen(fd, "rb");
+    this->zstd_stream = ZSTD_createDStream();
+    if (this->zstd_file == NULL || this->zstd_stream == NULL) {
+        if (this->zstd_file == NULL)
+            close(fd);
+        close_input();
+        return false;
+    }
+    ZSTD_initDStream(this->zstd_stream);
+    this->zstd_in.resize(ZSTD_DStreamInSize());
+    this->zstd_buffer.src = this->zstd_in.data();
+    this->zstd_buffer.size = 0;
+    this->zstd_buffer.pos = 0;
+    return true;
+#else
+    close(fd);
+    errno = ENOTSUP;
+    return false;
+#endif
+}
+
+/*METHOD: Name of the compression format*/
+const char *KrakenReader::get_format_name() const {
+    static const char *names[] = {"plain text", "gzip", "zstd"};
+    return names[this->format];
+}
+
+/*METHOD: Start of the first line of a plain file starting at or after pos*/
+size_t KrakenReader::line_start(size_t pos) const {
+    if (pos == 0 || pos >= this->file_size)
+        return min(pos, this->file_size);
+    if (this->mapped != NULL) {
+        const char *nl = static_cast<const char *>(memchr(this->mapped + pos - 1, '\n', this->file_size - pos + 1));
+        return (nl == NULL) ? this->file_size : (nl - this->mapped) + 1;
+    }
+    char buf[1 << 16];
+    size_t at = pos - 1;
+    while (at < this->file_size) {
+        ssize_t n = pread(this->plain_fd, buf, min(sizeof(buf), this->file_size - at), at);
+        if (n <= 0)
+            break;
+        const char *nl = static_cast<const char *>(memchr(buf, '\n', n));
+        if (nl != NULL)
+            return at + (nl - buf) + 1;
+        at += n;
+    }
+    return this->file_size;
+}
+
+/*METHOD: Only stream bytes [begin, end) of a plain file*/
+void KrakenReader::set_range(size_t begin, size_t end) {
+    this->read_offset = begin;
+    this->read_end = end;
+    this->dropped = begin;
+}
+
+/*METHOD: Start the reader thread*/
+void KrakenReader::start(size_t block_size, size_t max_blocks) {
+    this->block_size = max(block_size, (size_t) 1);
+    this->max_blocks = max(max_blocks, (size_t) 1);
+    this->worker = std::thread(&KrakenReader::read_blocks, this);
+}
+
+/*METHOD: Read up to n bytes of the streamed plain file with pread, then drop
+ * the pages read so far from the page cache; -1 on an error*/
+long KrakenReader::read_plain(char *dst, size_t n) {
+    size_t got = 0;
+    n = min(n, (size_t) (this->read_end - this->read_offset));
+    while (got < n) {
+        ssize_t r = pread(this->plain_fd, dst + got, n - got, this->read_offset);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            this->read_error = strerror(errno);
+            return -1;
+        }
+        if (r == 0)
+            break;
+        got += r;
+        this->read_offset += r;
+    }
+    //Only whole pages, so the page holding the next line stays cached
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t drop_end = this->read_offset / page * page;
+    if (drop_end > this->dropped) {
+        posix_fadvise(this->plain_fd, this->dropped, drop_end - this->dropped, POSIX_FADV_DONTNEED);
+        this->dropped = drop_end;
+    }
+    return (long) got;
+}
+
+/*METHOD: Read (decompressing) up to n bytes (fewer only at the end); -1 on an error*/
+long KrakenReader::read_raw(char *dst, size_t n) {
+    size_t got = 0;
+    if (this->format == KRAKEN_PLAIN)
+        return read_plain(dst, n);
+    if (this->format == KRAKEN_GZIP) {
+        while (got < n) {
+            int r = gzread(this->gz, dst + got, (unsigned) min(n - got, (size_t) 1 << 30));
+            if (r < 0) {
+                int errnum;
+                this->read_error = gzerror(this->gz, &errnum);
+                return -1;
+            }
+            if (r == 0)
+                break;
+            got += r;
+        }
+        return (long) got;
+    }
+#ifdef HAVE_ZSTD
+    while (got < n) {
+        if (this->zstd_buffer.pos == this->zstd_buffer.size) {
+            this->zstd_buffer.size = fread(this->zstd_in.data(), 1, this->zstd_in.size(), this->zstd_file);
+            this->zstd_buffer.pos = 0;
+            if (this->zstd_buffer.size == 0) {
+                if (ferror(this->zstd_file)) {
+                    this->read_error = strerror(errno);
+                    return -1;
+                }
+                //A frame left unfinished means the file was cut short
+                if (this->zstd_last != 0) {
+                    this->read_error = "truncated zstd file";
+                    return -1;
+                }
+                break;
+            }
+        }
+        ZSTD_outBuffer out = {dst + got, n - got, 0};
+        size_t ret = ZSTD_decompressStream(this->zstd_stream, &out, &this->zstd_buffer);
+        if (ZSTD_isError(ret)) {
+            this->read_error = ZSTD_getErrorName(ret);
+            return -1;
+        }
+        this->zstd_last = ret;
+        got += out.pos;
+    }
+#endif
+    return (long) got;
+}
+
+/*METHOD: Queue a finished block, waiting while the queue is full (false if
+ * the reader is being closed)*/
+bool KrakenReader::push_block(kraken_block &block) {
+    std::unique_lock<std::mutex> guard(this->queue_lock);
+    this->queue_changed.wait(guard, [this]() { return this->stopping || this->blocks.size() < this->max_blocks; });
+    if (this->stopping)
+        return false;
+    this->blocks.push_back(kraken_block());
+    this->blocks.back().text.swap(block.text);
+    this->blocks.back().position = block.position;
+    guard.unlock();
+    this->queue_changed.notify_all();
+    return true;
+}
+
+/*METHOD: Reader thread: cut the text into blocks of whole lines. A line
+ * longer than a block is kept whole in a larger block, whose buffers are
+ * released once it has been passed on.*/
+void KrakenReader::read_blocks() {
+    vector<char> buffer;
+    size_t filled = 0;
+    uint64_t position = this->read_offset;
+    bool ok = true;
+    while (true) {
+        if (buffer.size() < filled + this->block_size)
+            buffer.resize(filled + this->block_size);
+        long n = read_raw(buffer.data() + filled, buffer.size() - filled);
+        if (n < 0) {
+            ok = false;
+            break;
+        }
+        filled += n;
+        bool at_end = (size_t) n < buffer.size() - (filled - n);
+        /*End the block after the last complete line. The text kept from
+         * before has no newline, so only the bytes just read are searched.*/
+        size_t cut = filled;
+        if (!at_end) {
+            size_t unread = filled - n;
+            while (cut > unread && buffer[cut - 1] != '\n')
+                cut--;
+            if (cut == unread)
+                cut = 0;
+            if (cut == 0)
+                continue;
+        }
+        if (cut > 0) {
+            kraken_block block;
+            block.position = position;
+            if (buffer.size() > KRAKEN_OVERSIZED * this->block_size) {
+                //A long line: pass on the buffer itself rather than a copy,
+                //keeping only the text after it
+                vector<char> rest(buffer.begin() + cut, buffer.begin() + filled);
+                buffer.resize(cut);
+                block.text.swap(buffer);
+                buffer.swap(rest);
+            } else {
+                {
+                    std::lock_guard<std::mutex> guard(this->queue_lock);
+                    if (!this->free_texts.empty()) {
+                        block.text.swap(this->free_texts.back());
+                        this->free_texts.pop_back();
+                    }
+                }
+                block.text.assign(buffer.begin(), buffer.begin() + cut);
+                memmove(buffer.data(), buffer.data() + cut, filled - cut);
+            }
+            position += cut;
+            filled -= cut;
+            if (!push_block(block))
+                break;
+        }
+        if (at_end)
+            break;
+    }
+    std::lock_guard<std::mutex> guard(this->queue_lock);
+    if (!ok)
+        this->error = this->read_error.empty() ? "cannot read" : this->read_error;
+    this->finished = true;
+    this->queue_changed.notify_all();
+}
+
+/*METHOD: Wait for the next block; false at the end of the text or on an error.
+ * The buffer block held before is kept for reuse, unless it grew for a long line.*/
+bool KrakenReader::next_block(kraken_block &block) {
+    std::unique_lock<std::mutex> guard(this->queue_lock);
+    this->queue_changed.wait(guard, [this]() { return this->finished || !this->blocks.empty(); });
+    if (this->blocks.empty() || !this->error.empty())
+        return false;
+    if (block.text.capacity() > KRAKEN_OVERSIZED * this->block_size) {
+        //Only buffers of about a block are reused (not those of long lines)
+        vector<char>().swap(block.text);
+    } else if (block.text.capacity() > 0) {
+        this->free_texts.push_back(vector<char>());
+        this->free_texts.back().swap(block.text);
+    }
+    block.text.swap(this->blocks.front().text);
+    block.position = this->blocks.front().position;
+    this->blocks.pop_front();
+    guard.unlock();
+    this->queue_changed.notify_all();
+    return true;
+}
+
+/*METHOD: Decompression error, empty if none*/
+string KrakenReader::get_error() const {
+    std::lock_guard<std::mutex> guard(this->queue_lock);
+    return this->error;
+}
@@ -0,0 +1,139 @@
+/*********************************************************************
+ * kraken_reader.h is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef KRAKEN_READER_H
+#define KRAKEN_READER_H
+
+#include "kmer2read_headers.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/*Buffers larger than this many blocks (grown for a line longer than a
+ * block) are released instead of reused*/
+#define KRAKEN_OVERSIZED 2
+
+/*Compression of a kraken file, detected from its first bytes*/
+enum kraken_format {
+    KRAKEN_PLAIN = 0,
+    KRAKEN_GZIP,
+    KRAKEN_ZSTD
+};
+
+/*A block of whole lines of (decompressed) kraken text and its position in the text*/
+struct kraken_block {
+    vector<char> text;
+    uint64_t position;
+};
+
+/* Class reading a kraken file that may be compressed.
+ * A plain file is either memory-mapped as a whole or streamed with pread. A
+ * streamed or gzip (or, when built with HAVE_ZSTD, zstd) file is read by a
+ * background thread into blocks that end on line boundaries; at most
+ * max_blocks wait in a queue, so reading runs ahead of the threads parsing
+ * earlier blocks. Block buffers handed back through next_block are reused,
+ * so the buffers in use stay within a fixed pool; only a line longer than a
+ * block needs a buffer of its own size, which is freed after it has been
+ * converted. Streamed plain text is dropped from the page cache once it has
+ * been copied into a block.
+ */
+class KrakenReader {
+    public:
+        KrakenReader();
+        ~KrakenReader();
+        KrakenReader(const KrakenReader &) = delete;
+        KrakenReader& operator=(const KrakenReader &) = delete;
+        /*Open a file and detect its compression; a plain file is mapped
+         * unless streaming is requested (false with errno set on failure)*/
+        bool open(const string &, bool);
+        kraken_format get_format() const;
+        const char *get_format_name() const;
+        /*Mapped text (NULL when streamed) and size of a plain file*/
+        const char *data() const;
+        size_t size() const;
+        /*Start of the first line of a plain file starting at or after a position*/
+        size_t line_start(size_t) const;
+        /*Only stream bytes [begin, end) of a plain file*/
+        void set_range(size_t, size_t);
+        /*Start reading into blocks of about block_size bytes*/
+        void start(size_t, size_t);
+        /*Wait for the next block; false at the end of the text (or on an error)*/
+        bool next_block(kraken_block &);
+        /*Decompression error, empty if none*/
+        string get_error() const;
+    private:
+        void read_blocks();
+        long read_raw(char *, size_t);
+        long read_plain(char *, size_t);
+        bool push_block(kraken_block &);
+        void close_input();
+
+        kraken_format format;
+        /*Plain file*/
+        char *mapped;
+        size_t file_size;
+        /*Streamed plain file: next byte to read, end of the range and start
+         * of the bytes still in the page cache*/
+        int plain_fd;
+        uint64_t read_offset;
+        uint64_t read_end;
+        uint64_t dropped;
+        /*Compressed file*/
+        gzFile gz;
+#ifdef HAVE_ZSTD
+        FILE *zstd_file;
+        ZSTD_DStream *zstd_stream;
+        vector<char> zstd_in;
+        ZSTD_inBuffer zstd_buffer;
+        size_t zstd_last;
+#endif
+        /*Reader thread, the queue of finished blocks and the buffers to reuse*/
+        std::thread worker;
+        mutable std::mutex queue_lock;
+        std::condition_variable queue_changed;
+        deque<kraken_block> blocks;
+        vector<vector<char>> free_texts;
+        size_t block_size;
+        size_t max_blocks;
+        bool finished;
+        bool stopping;
+        string error;
+        /*Error of the reader thread, published to error when it ends*/
+        string read_error;
+};
+
+inline kraken_format KrakenReader::get_format() const {
+    return this->format;
+}
+
+inline const char *KrakenReader::data() const {
+    return this->mapped;
+}
+
+inline size_t KrakenReader::size() const {
+    return this->file_size;
+}
+
+#endif
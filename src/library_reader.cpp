@@ -0,0 +1,134 @@
+/*********************************************************************
+ * library_reader.cpp is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "library_reader.h"
+
+/*Constructor*/
+LibraryReader::LibraryReader() {
+    this->gz = NULL;
+    this->buf_pos = 0;
+    this->buf_len = 0;
+    this->at_eof = false;
+    this->have_header = false;
+}
+/*Destructor*/
+LibraryReader::~LibraryReader() {
+    close();
+}
+
+/*METHOD: Open a plain or gzip compressed FASTA file*/
+bool LibraryReader::open(const string &file) {
+    close();
+    //gzip reads uncompressed files unchanged
+    this->gz = gzopen(file.c_str(), "rb");
+    if (this->gz == NULL)
+        return false;
+    this->buffer.resize(LIBRARY_READ_SIZE);
+    this->buf_pos = 0;
+    this->buf_len = 0;
+    this->at_eof = false;
+    this->have_header = false;
+    this->error.clear();
+    return true;
+}
+
+/*METHOD: Close the current file*/
+void LibraryReader::close() {
+    if (this->gz != NULL)
+        gzclose(this->gz);
+    this->gz = NULL;
+}
+
+/*METHOD: Next line (without its end of line); false at the end of the file*/
+bool LibraryReader::read_line(const char *&line_start, size_t &line_len) {
+    this->line.clear();
+    while (true) {
+        const char *start = this->buffer.data() + this->buf_pos;
+        const char *nl = static_cast<const char *>(memchr(start, '\n', this->buf_len - this->buf_pos));
+        if (nl != NULL) {
+            this->buf_pos = nl - this->buffer.data() + 1;
+            if (this->line.empty()) {
+                line_start = start;
+                line_len = nl - start;
+            } else {
+                this->line.append(start, nl - start);
+                line_start = this->line.data();
+                line_len = this->line.size();
+            }
+            break;
+        }
+        //A line continuing past the buffer is collected in line
+        this->line.append(start, this->buf_len - this->buf_pos);
+        this->buf_pos = this->buf_len = 0;
+        if (this->at_eof)
+            return false;
+        int n = gzread(this->gz, this->buffer.data(), this->buffer.size());
+        if (n < 0) {
+            int errnum;
+            this->error = gzerror(this->gz, &errnum);
+            return false;
+        }
+        if (n == 0) {
+            this->at_eof = true;
+            if (this->line.empty())
+                return false;
+            line_start = this->line.data();
+            line_len = this->line.size();
+            break;
+        }
+        this->buf_len = n;
+    }
+    if (line_len > 0 && line_start[line_len - 1] == '\r')
+        line_len -= 1;
+    return true;
+}
+
+/*METHOD: Read the next record*/
+bool LibraryReader::next(library_record &record) {
+    const char *p;
+    size_t n;
+    //Find the first header of the file
+    while (!this->have_header) {
+        if (!read_line(p, n))
+            return false;
+        if (n == 0)
+            continue;
+        if (p[0] != '>') {
+            this->error = "not a FASTA file";
+            return false;
+        }
+        this->header.assign(p + 1, n - 1);
+        this->have_header = true;
+    }
+    size_t id_len = this->header.find_first_of(" \t");
+    record.id.assign(this->header, 0, id_len);
+    record.seq.clear();
+    this->have_header = false;
+    while (read_line(p, n)) {
+        if (n > 0 && p[0] == '>') {
+            this->header.assign(p + 1, n - 1);
+            this->have_header = true;
+            break;
+        }
+        record.seq.append(p, n);
+    }
+    return this->error.empty();
+}
@@ -0,0 +1,73 @@
+/*********************************************************************
+ * library_reader.h is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef LIBRARY_READER_H
+#define LIBRARY_READER_H
+
+#include "kmer2read_headers.h"
+#include <zlib.h>
+
+/*Size of the buffer library files are read through*/
+#define LIBRARY_READ_SIZE (1 << 20)
+
+/*A library sequence: its id (the header up to the first whitespace) and bases*/
+struct library_record {
+    string id;
+    string seq;
+};
+
+/* Class streaming the records of a FASTA library file, plain or gzip
+ * compressed. Sequence lines are joined; the record buffers handed to next
+ * are reused, so reading does not allocate once they have grown.
+ */
+class LibraryReader {
+    public:
+        LibraryReader();
+        ~LibraryReader();
+        LibraryReader(const LibraryReader &) = delete;
+        LibraryReader& operator=(const LibraryReader &) = delete;
+        /*Open a file (false with errno set on failure)*/
+        bool open(const string &);
+        void close();
+        /*Read the next record; false at the end of the file (or on an error)*/
+        bool next(library_record &);
+        /*Read or format error, empty if none*/
+        string get_error() const;
+    private:
+        bool read_line(const char *&, size_t &);
+
+        gzFile gz;
+        vector<char> buffer;
+        size_t buf_pos;
+        size_t buf_len;
+        bool at_eof;
+        /*A header line was read that starts the next record*/
+        bool have_header;
+        string header;
+        string line;
+        string error;
+};
+
+inline string LibraryReader::get_error() const {
+    return this->error;
+}
+
+#endif
@@ -0,0 +1,283 @@
+/*********************************************************************
+ * mapping_store.cpp is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "mapping_store.h"
+#include "kmer_tokenizer.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+
+/*Store file layout: header, entries sorted by (hash, read length), then mappings*/
+#define MAPPING_STORE_MAGIC "BRKNMST"
+#define MAPPING_STORE_VERSION 1
+#define MAPPING_STORE_BYTE_ORDER 0x01020304
+/*Initial value of the two halves of a key*/
+#define STORE_KEY_SEED_0 0x243F6A8885A308D3ULL
+#define STORE_KEY_SEED_1 0x13198A2E03707344ULL
+
+struct mapping_store_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t kmer_len;
+    uint32_t reserved;
+    uint64_t n_entries;
+    uint64_t n_mappings;
+    uint64_t entries_offset;
+    uint64_t mappings_offset;
+};
+
+/*METHOD: Mix the bits of a 64-bit value*/
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/*METHOD: Add a value to both halves of a key*/
+static inline void add_hash(store_key &key, uint64_t val) {
+    key.hash[0] = mix64(key.hash[0] ^ val);
+    key.hash[1] = mix64((key.hash[1] + val) * 0x9E3779B97F4A7C15ULL);
+}
+
+/*Sort helpers: entries by key, then read length*/
+static inline bool entry_less(const store_entry &a, const store_entry &b) {
+    if (a.hash[0] != b.hash[0]) return a.hash[0] < b.hash[0];
+    if (a.hash[1] != b.hash[1]) return a.hash[1] < b.hash[1];
+    return a.read_len < b.read_len;
+}
+
+/*Constructor: hash the lineage of every taxon (parents come first in pre-order)*/
+MappingStore::MappingStore(const taxonomy *my_taxonomy, int kmer_len) {
+    this->my_taxonomy = my_taxonomy;
+    this->kmer_len = kmer_len;
+    this->lineage_hashes.resize(my_taxonomy->size());
+    for (int i = 0; i < my_taxonomy->size(); i++) {
+        int parent = my_taxonomy->get_parent(i);
+        uint64_t base = (parent < 0) ? 0x5851F42D4C957F2DULL : this->lineage_hashes[parent];
+        this->lineage_hashes[i] = mix64(base ^ ((uint64_t) (uint32_t) my_taxonomy->get_taxid(i) << 1 | 1));
+    }
+    this->entries = NULL;
+    this->mappings = NULL;
+    this->n_entries = 0;
+    this->data = NULL;
+    this->data_size = 0;
+}
+
+MappingStore::~MappingStore() {
+    if (this->data != NULL)
+        munmap(this->data, this->data_size);
+}
+
+/*METHOD: Map the store of an earlier run; fails if it is missing, damaged or
+ * was written for another kmer length*/
+bool MappingStore::open(const string &store_file) {
+    int fd = ::open(store_file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t) sb.st_size < sizeof(mapping_store_header)) {
+        close(fd);
+        return false;
+    }
+    size_t size = sb.st_size;
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+    const mapping_store_header *header = static_cast<const mapping_store_header *>(mapped);
+    bool ok = memcmp(header->magic, MAPPING_STORE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == MAPPING_STORE_VERSION
+        && header->byte_order == MAPPING_STORE_BYTE_ORDER
+        && header->kmer_len == this->kmer_len
+        && header->entries_offset % 8 == 0 && header->mappings_offset % 8 == 0
+        && header->entries_offset <= size && header->n_entries <= (size - header->entries_offset) / sizeof(store_entry)
+        && header->mappings_offset <= size && header->n_mappings <= (size - header->mappings_offset) / sizeof(store_mapping);
+    const char *base = static_cast<const char *>(mapped);
+    const store_entry *entries = reinterpret_cast<const store_entry *>(base + header->entries_offset);
+    for (uint64_t e = 0; ok && e < header->n_entries; e++) {
+        ok = entries[e].offset <= header->n_mappings && entries[e].n_mappings <= header->n_mappings - entries[e].offset;
+    }
+    if (!ok) {
+        munmap(mapped, size);
+        return false;
+    }
+    this->data = mapped;
+    this->data_size = size;
+    this->entries = entries;
+    this->mappings = reinterpret_cast<const store_mapping *>(base + header->mappings_offset);
+    this->n_entries = header->n_entries;
+    return true;
+}
+
+/*METHOD: Add kmer runs to a key. Ambiguous, unclassified and unknown taxids
+ * all hash alike since they are classified alike.*/
+void MappingStore::add_pairs(store_key &key, const kmer_pair *pairs, size_t n_pairs) const {
+    for (size_t i = 0; i < n_pairs; i++) {
+        if (pairs[i].taxid == KMER_MATE_SEPARATOR) {
+            add_hash(key, KMER_MATE_SEPARATOR);
+            continue;
+        }
+        uint32_t taxid = pairs[i].taxid;
+        int taxon = (taxid > 0 && taxid <= INT32_MAX) ? this->my_taxonomy->get_index((int) taxid) : -1;
+        add_hash(key, (taxon < 0) ? 0 : this->lineage_hashes[taxon]);
+        add_hash(key, pairs[i].count);
+    }
+}
+
+/*METHOD: Hash the kmer runs (taxid:count pairs) of a kraken line*/
+store_key MappingStore::get_key(const char *p, const char *line_end) const {
+    store_key key = {{STORE_KEY_SEED_0, STORE_KEY_SEED_1}};
+    kmer_pair pairs[KMER_PAIR_BATCH];
+    size_t n_pairs;
+    while ((n_pairs = parse_kmer_pairs(p, line_end, pairs, KMER_PAIR_BATCH)) > 0)
+        add_pairs(key, pairs, n_pairs);
+    return key;
+}
+
+/*METHOD: Hash the kmer runs of a sequence classified in this run (the same
+ * key as the kraken line of these runs)*/
+store_key MappingStore::get_key(const vector<kmer_pair> &runs) const {
+    store_key key = {{STORE_KEY_SEED_0, STORE_KEY_SEED_1}};
+    add_pairs(key, runs.data(), runs.size());
+    return key;
+}
+
+/*METHOD: Read mappings of a key at every read length (lengths shorter than a
+ * kmer have none); false unless all of them are stored*/
+bool MappingStore::find(const store_key &key, const vector<int> &read_lens, vector<TaxidCounts> &taxids_mapped) const {
+    store_entry probe;
+    probe.hash[0] = key.hash[0];
+    probe.hash[1] = key.hash[1];
+    for (size_t r = 0; r < read_lens.size(); r++) {
+        if (read_lens[r] - this->kmer_len + 1 <= 0)
+            continue;
+        probe.read_len = read_lens[r];
+        const store_entry *end = this->entries + this->n_entries;
+        const store_entry *e = std::lower_bound(this->entries, end, probe, entry_less);
+        if (e == end || entry_less(probe, *e))
+            return false;
+    }
+    for (size_t r = 0; r < read_lens.size(); r++) {
+        if (read_lens[r] - this->kmer_len + 1 <= 0)
+            continue;
+        probe.read_len = read_lens[r];
+        const store_entry *e = std::lower_bound(this->entries, this->entries + this->n_entries, probe, entry_less);
+        const store_mapping *m = this->mappings + e->offset;
+        for (uint32_t i = 0; i < e->n_mappings; i++)
+            taxids_mapped[r].add((int) m[i].taxid, (int) m[i].count);
+    }
+    return true;
+}
+
+/*METHOD: Record the read mappings of a sequence in a thread's part*/
+void MappingStore::add(store_part &part, const store_key &key, const vector<int> &read_lens, const vector<TaxidCounts> &taxids_mapped) const {
+    for (size_t r = 0; r < read_lens.size(); r++) {
+        if (read_lens[r] - this->kmer_len + 1 <= 0)
+            continue;
+        store_entry e;
+        e.hash[0] = key.hash[0];
+        e.hash[1] = key.hash[1];
+        e.read_len = read_lens[r];
+        e.n_mappings = (uint32_t) taxids_mapped[r].size();
+        e.offset = part.mappings.size();
+        part.entries.push_back(e);
+        for (auto it = taxids_mapped[r].begin(); it != taxids_mapped[r].end(); ++it) {
+            store_mapping m = {it->taxid, it->count};
+            part.mappings.push_back(m);
+        }
+    }
+}
+
+/*METHOD: Write the entries of all parts as a new store (written to a
+ * temporary file, then renamed). Entries of the opened store that this run did
+ * not record again (other read lengths, sequences not seen) are kept; sequences
+ * seen twice are stored once*/
+bool MappingStore::save(const string &store_file, vector<store_part> &parts) const {
+    /*Entries of all parts and of the opened store in key order, each
+     * remembering its part (parts.size() for the opened store)*/
+    const size_t opened = parts.size();
+    vector<std::pair<store_entry, size_t>> all;
+    for (size_t p = 0; p < parts.size(); p++) {
+        for (size_t e = 0; e < parts[p].entries.size(); e++)
+            all.push_back(std::make_pair(parts[p].entries[e], p));
+        vector<store_entry>().swap(parts[p].entries);
+    }
+    for (size_t e = 0; e < this->n_entries; e++)
+        all.push_back(std::make_pair(this->entries[e], opened));
+    //Entries of this run come before the stored entry they replace
+    std::sort(all.begin(), all.end(), [](const std::pair<store_entry, size_t> &a, const std::pair<store_entry, size_t> &b) {
+        if (entry_less(a.first, b.first)) return true;
+        if (entry_less(b.first, a.first)) return false;
+        return a.second < b.second;
+    });
+    vector<store_entry> entries;
+    entries.reserve(all.size());
+    uint64_t n_mappings = 0;
+    for (size_t i = 0; i < all.size(); i++) {
+        if (!entries.empty() && !entry_less(entries.back(), all[i].first))
+            continue;
+        entries.push_back(all[i].first);
+        entries.back().offset = n_mappings;
+        n_mappings += all[i].first.n_mappings;
+    }
+
+    mapping_store_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAPPING_STORE_MAGIC, sizeof(header.magic));
+    header.version = MAPPING_STORE_VERSION;
+    header.byte_order = MAPPING_STORE_BYTE_ORDER;
+    header.kmer_len = this->kmer_len;
+    header.n_entries = entries.size();
+    header.n_mappings = n_mappings;
+    header.entries_offset = (sizeof(header) + 7) & ~(uint64_t) 7;
+    header.mappings_offset = header.entries_offset + entries.size() * sizeof(store_entry);
+
+    string tmp_file = store_file + ".tmp." + std::to_string(getpid());
+    FILE *out = fopen(tmp_file.c_str(), "wb");
+    if (out == NULL)
+        return false;
+    static const char padding[8] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(padding, 1, header.entries_offset - sizeof(header), out) == header.entries_offset - sizeof(header);
+    if (ok && !entries.empty())
+        ok = fwrite(entries.data(), sizeof(store_entry), entries.size(), out) == entries.size();
+    /*Mappings in entry order, skipping repeated sequences*/
+    const store_entry *last = NULL;
+    for (size_t i = 0; ok && i < all.size(); i++) {
+        if (last != NULL && !entry_less(*last, all[i].first))
+            continue;
+        last = &all[i].first;
+        size_t count = all[i].first.n_mappings;
+        const store_mapping *m = (all[i].second == opened) ? this->mappings + all[i].first.offset
+            : &parts[all[i].second].mappings[all[i].first.offset];
+        if (count > 0)
+            ok = fwrite(m, sizeof(store_mapping), count, out) == count;
+    }
+    ok = (fclose(out) == 0) && ok;
+    if (ok)
+        ok = rename(tmp_file.c_str(), store_file.c_str()) == 0;
+    if (!ok)
+        unlink(tmp_file.c_str());
+    return ok;
+}
@@ -0,0 +1,101 @@
+/*********************************************************************
+ * mapping_store.h is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef MAPPING_STORE_H
+#define MAPPING_STORE_H
+
+#include "kmer2read_headers.h"
+#include "taxonomy.h"
+#include "taxid_counts.h"
+#include "kmer_tokenizer.h"
+
+/*Content hash of a sequence's kmer line (and the lineages of its taxa)*/
+struct store_key {
+    uint64_t hash[2];
+};
+
+/*Read mappings of one sequence at one read length: mappings [offset, offset + n_mappings)*/
+struct store_entry {
+    uint64_t hash[2];
+    int32_t read_len;
+    uint32_t n_mappings;
+    uint64_t offset;
+};
+
+/*Number of reads of a sequence classified as one taxid*/
+struct store_mapping {
+    int32_t taxid;
+    int32_t count;
+};
+
+/*Entries and mappings recorded by one thread*/
+struct store_part {
+    vector<store_entry> entries;
+    vector<store_mapping> mappings;
+};
+
+/* Class keeping the read mappings of every database sequence between runs.
+ * Entries are keyed by a 128-bit hash of the sequence's kmer runs, where each
+ * taxid is hashed together with its lineage, so a sequence is only reused if
+ * neither its kmers nor the part of the taxonomy they touch have changed.
+ * Seqids and genome taxids are not part of the key: they are looked up again
+ * in every run. The store file is mapped and searched in place; each run
+ * writes a new store holding the entries of the sequences it saw, plus the
+ * stored entries it did not replace.
+ */
+class MappingStore {
+    public:
+        MappingStore(const taxonomy *, int);
+        ~MappingStore();
+        MappingStore(const MappingStore &) = delete;
+        MappingStore& operator=(const MappingStore &) = delete;
+        /*Map the store of an earlier run (false if missing or not compatible)*/
+        bool open(const string &);
+        size_t size() const;
+        /*Key of the kmer column of a kraken line*/
+        store_key get_key(const char *, const char *) const;
+        /*Key of the kmer runs of a sequence*/
+        store_key get_key(const vector<kmer_pair> &) const;
+        /*Read mappings of a key at every read length; false unless all are stored*/
+        bool find(const store_key &, const vector<int> &, vector<TaxidCounts> &) const;
+        /*Record the read mappings of a sequence seen in this run*/
+        void add(store_part &, const store_key &, const vector<int> &, const vector<TaxidCounts> &) const;
+        /*Write the entries recorded in this run merged with the opened store*/
+        bool save(const string &, vector<store_part> &) const;
+    private:
+        void add_pairs(store_key &, const kmer_pair *, size_t) const;
+
+        const taxonomy *my_taxonomy;
+        int kmer_len;
+        /*Hash of the root-to-node path of every taxon*/
+        vector<uint64_t> lineage_hashes;
+        const store_entry *entries;
+        const store_mapping *mappings;
+        size_t n_entries;
+        void *data;
+        size_t data_size;
+};
+
+inline size_t MappingStore::size() const {
+    return this->n_entries;
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*********************************************************************
+ * seqid_index.cpp is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "seqid_index.h"
+
+#define SEQID_INITIAL_SLOTS 1024
+
+/*Constructor*/
+SeqidIndex::SeqidIndex() {
+    this->key_offsets.push_back(0);
+    this->slots.assign(SEQID_INITIAL_SLOTS, 0);
+    this->mask = SEQID_INITIAL_SLOTS - 1;
+}
+
+/*METHOD: Hash the bytes of a seqid, 8 bytes at a time*/
+uint32_t SeqidIndex::hash(const char *key, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, key, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+        key += 8;
+        len -= 8;
+    }
+    uint64_t w = 0;
+    memcpy(&w, key, len);
+    h = (h ^ w) * 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 29;
+    return (uint32_t) h;
+}
+
+/*METHOD: Slot holding this seqid, or the empty slot where it belongs*/
+size_t SeqidIndex::find_slot(const char *key, size_t len, uint32_t h) const {
+    size_t s = h & this->mask;
+    while (this->slots[s] != 0) {
+        uint32_t e = this->slots[s] - 1;
+        uint64_t start = this->key_offsets[e];
+        if (this->key_hashes[e] == h && this->key_offsets[e + 1] - start == len
+                && memcmp(&this->keys[start], key, len) == 0)
+            return s;
+        s = (s + 1) & this->mask;
+    }
+    return s;
+}
+
+/*METHOD: Double the hash table*/
+void SeqidIndex::grow() {
+    this->slots.assign(this->slots.size() * 2, 0);
+    this->mask = this->slots.size() - 1;
+    for (uint32_t e = 0; e < this->taxids.size(); e++) {
+        size_t s = this->key_hashes[e] & this->mask;
+        while (this->slots[s] != 0)
+            s = (s + 1) & this->mask;
+        this->slots[s] = e + 1;
+    }
+}
+
+/*METHOD: Add a seqid and its taxid*/
+void SeqidIndex::insert(const char *key, size_t len, int taxid) {
+    uint32_t h = hash(key, len);
+    size_t s = find_slot(key, len, h);
+    if (this->slots[s] != 0)
+        return;
+    //Keep the table at most 3/4 full
+    if ((this->taxids.size() + 1) * 4 > this->slots.size() * 3) {
+        grow();
+        s = find_slot(key, len, h);
+    }
+    this->keys.insert(this->keys.end(), key, key + len);
+    this->key_offsets.push_back(this->keys.size());
+    this->key_hashes.push_back(h);
+    this->taxids.push_back(taxid);
+    this->slots[s] = (uint32_t) this->taxids.size();
+}
+
+/*METHOD: Look up a seqid*/
+int SeqidIndex::find(const char *key, size_t len) const {
+    size_t s = find_slot(key, len, hash(key, len));
+    if (this->slots[s] == 0)
+        return SEQID_NOT_FOUND;
+    return this->taxids[this->slots[s] - 1];
+}
@@ -0,0 +1,61 @@
+/*********************************************************************
+ * seqid_index.h is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef SEQID_INDEX_H
+#define SEQID_INDEX_H
+
+#include "kmer2read_headers.h"
+
+/* Class mapping sequence ids to taxids.
+ * Seqid bytes are interned once into a single arena and the entries are
+ * found through an open-addressing hash table of entry numbers, so lookups
+ * can be made directly from a (pointer, length) view of the kraken line.
+ */
+class SeqidIndex {
+    public:
+        SeqidIndex();
+        /*Add a seqid; the first taxid given for a seqid is kept*/
+        void insert(const char *, size_t, int);
+        /*Taxid of a seqid, or SEQID_NOT_FOUND*/
+        int find(const char *, size_t) const;
+        size_t size() const;
+    private:
+        static uint32_t hash(const char *, size_t);
+        size_t find_slot(const char *, size_t, uint32_t) const;
+        void grow();
+
+        /*Interned seqid bytes; entry e owns [key_offsets[e], key_offsets[e+1])*/
+        vector<char> keys;
+        vector<uint64_t> key_offsets;
+        vector<uint32_t> key_hashes;
+        vector<int> taxids;
+        /*Hash table of entry numbers + 1 (0 marks an empty slot)*/
+        vector<uint32_t> slots;
+        size_t mask;
+};
+
+#define SEQID_NOT_FOUND -1
+
+inline size_t SeqidIndex::size() const {
+    return this->taxids.size();
+}
+
+#endif
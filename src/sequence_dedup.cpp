@@ -0,0 +1,117 @@
+/*********************************************************************
+ * sequence_dedup.cpp is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "sequence_dedup.h"
+
+static inline bool hash_less(const line_hash &a, const line_hash &b) {
+    if (a.hash[0] != b.hash[0]) return a.hash[0] < b.hash[0];
+    return a.hash[1] < b.hash[1];
+}
+
+static inline bool hash_equal(const line_hash &a, const line_hash &b) {
+    return a.hash[0] == b.hash[0] && a.hash[1] == b.hash[1];
+}
+
+/*Constructor and Destructor*/
+SequenceDedup::SequenceDedup() {
+    this->slots = NULL;
+}
+
+SequenceDedup::~SequenceDedup() {
+    delete[] this->slots;
+}
+
+/*METHOD: 128-bit hash of the bytes [p, end), 8 bytes at a time in two lanes*/
+line_hash SequenceDedup::hash_column(const char *p, const char *end) {
+    uint64_t h0 = 0x243F6A8885A308D3ULL ^ (uint64_t) (end - p);
+    uint64_t h1 = 0x13198A2E03707344ULL;
+    while (end - p >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h0 = (h0 ^ w) * 0x9E3779B97F4A7C15ULL;
+        h0 ^= h0 >> 29;
+        h1 = (h1 + w) * 0xC2B2AE3D27D4EB4FULL;
+        h1 ^= h1 >> 31;
+        p += 8;
+    }
+    uint64_t w = 0;
+    memcpy(&w, p, end - p);
+    h0 = (h0 ^ w) * 0x9E3779B97F4A7C15ULL;
+    h1 = (h1 + w) * 0xC2B2AE3D27D4EB4FULL;
+    //Finish each lane with the murmur3 finalizer, mixing in the other
+    line_hash h;
+    uint64_t x = h0 ^ (h1 >> 32);
+    x ^= x >> 33; x *= 0xff51afd7ed558ccdULL; x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ULL; x ^= x >> 33;
+    h.hash[0] = x;
+    x = h1 ^ (h0 << 17);
+    x ^= x >> 33; x *= 0xff51afd7ed558ccdULL; x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ULL; x ^= x >> 33;
+    h.hash[1] = x;
+    return h;
+}
+
+/*METHOD: Keep one copy of every hash that appears more than once*/
+void SequenceDedup::set_duplicates(vector<line_hash> &all) {
+    std::sort(all.begin(), all.end(), hash_less);
+    this->hashes.clear();
+    for (size_t i = 1; i < all.size(); i++) {
+        if (hash_equal(all[i], all[i - 1]) && (this->hashes.empty() || !hash_equal(this->hashes.back(), all[i])))
+            this->hashes.push_back(all[i]);
+    }
+    vector<line_hash>().swap(all);
+    delete[] this->slots;
+    this->slots = new dedup_slot[this->hashes.size()];
+    for (size_t i = 0; i < this->hashes.size(); i++)
+        this->slots[i].state = 0;
+}
+
+/*METHOD: Slot of a duplicated column, or -1*/
+long SequenceDedup::find_slot(const line_hash &h) const {
+    auto it = std::lower_bound(this->hashes.begin(), this->hashes.end(), h, hash_less);
+    if (it == this->hashes.end() || !hash_equal(*it, h))
+        return -1;
+    return it - this->hashes.begin();
+}
+
+/*METHOD: Copy the read mappings of a slot if they have been published*/
+bool SequenceDedup::get(long s, vector<TaxidCounts> &taxids_mapped) const {
+    const dedup_slot &slot = this->slots[s];
+    if (__atomic_load_n(&slot.state, __ATOMIC_ACQUIRE) != 2)
+        return false;
+    for (size_t r = 0; r < taxids_mapped.size(); r++) {
+        for (uint32_t i = slot.offsets[r]; i < slot.offsets[r + 1]; i++)
+            taxids_mapped[r].add(slot.mappings[i].taxid, slot.mappings[i].count);
+    }
+    return true;
+}
+
+/*METHOD: Publish the read mappings of a slot (only the first caller does)*/
+void SequenceDedup::put(long s, const vector<TaxidCounts> &taxids_mapped) {
+    dedup_slot &slot = this->slots[s];
+    int empty = 0;
+    if (!__atomic_compare_exchange_n(&slot.state, &empty, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    slot.offsets.push_back(0);
+    for (size_t r = 0; r < taxids_mapped.size(); r++) {
+        slot.mappings.insert(slot.mappings.end(), taxids_mapped[r].begin(), taxids_mapped[r].end());
+        slot.offsets.push_back((uint32_t) slot.mappings.size());
+    }
+    __atomic_store_n(&slot.state, 2, __ATOMIC_RELEASE);
+}
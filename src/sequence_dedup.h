@@ -0,0 +1,73 @@
+/*********************************************************************
+ * sequence_dedup.h is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef SEQUENCE_DEDUP_H
+#define SEQUENCE_DEDUP_H
+
+#include "kmer2read_headers.h"
+#include "taxid_counts.h"
+
+/*Hash of the bytes of a sequence's kmer column*/
+struct line_hash {
+    uint64_t hash[2];
+};
+
+/* Class sharing the read mappings of sequences whose kmer columns are byte
+ * for byte identical (duplicated plasmids, identical assemblies under
+ * several accessions) within one run.
+ * A pre-pass hashes the kmer column of every line and keeps the hashes seen
+ * more than once, sorted. The first thread to convert one of them claims its
+ * slot and publishes the read mappings; later copies take them from the
+ * slot instead of being converted. Threads never wait for each other: a
+ * copy seen while its slot is still being filled is simply converted too.
+ */
+class SequenceDedup {
+    public:
+        SequenceDedup();
+        ~SequenceDedup();
+        SequenceDedup(const SequenceDedup &) = delete;
+        SequenceDedup& operator=(const SequenceDedup &) = delete;
+        static line_hash hash_column(const char *, const char *);
+        /*Keep the hashes found more than once among the given ones*/
+        void set_duplicates(vector<line_hash> &);
+        size_t size() const;
+        /*Slot of a duplicated column, or -1*/
+        long find_slot(const line_hash &) const;
+        /*Copy the published read mappings of a slot (false if not ready)*/
+        bool get(long, vector<TaxidCounts> &) const;
+        /*Publish the read mappings of a slot unless another thread has*/
+        void put(long, const vector<TaxidCounts> &);
+    private:
+        struct dedup_slot {
+            /*0 = empty, 1 = being filled, 2 = ready*/
+            int state;
+            vector<taxid_count> mappings;
+            vector<uint32_t> offsets;
+        };
+        vector<line_hash> hashes;
+        dedup_slot *slots;
+};
+
+inline size_t SequenceDedup::size() const {
+    return this->hashes.size();
+}
+
+#endif
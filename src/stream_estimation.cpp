@@ -0,0 +1,205 @@
+/*********************************************************************
+ * stream_estimation.cpp is used as part of the bracken_est program
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "stream_estimation.h"
+
+/*Constructor: counts for every taxon of the taxonomy*/
+ReadCounter::ReadCounter(const taxonomy *my_taxonomy) {
+    this->my_taxonomy = my_taxonomy;
+    this->direct_counts.assign(my_taxonomy->size(), 0);
+    this->clade_counts.assign(my_taxonomy->size(), 0);
+    this->n_reads = 0;
+    this->n_unclassified = 0;
+    this->n_unknown = 0;
+}
+
+/*METHOD: Read the scientific name of every taxon from names.dmp*/
+bool ReadCounter::load_names(const string &n_file) {
+    ifstream namefile(n_file.c_str());
+    if (!namefile.is_open())
+        return false;
+    this->names.assign(this->my_taxonomy->size(), "");
+    string line;
+    while (getline(namefile, line)) {
+        //taxid | name | unique name | name class |
+        size_t pos1 = line.find("\t|\t");
+        size_t pos2 = (pos1 == string::npos) ? pos1 : line.find("\t|\t", pos1 + 3);
+        size_t pos3 = (pos2 == string::npos) ? pos2 : line.find("\t|\t", pos2 + 3);
+        if (pos3 == string::npos || line.compare(pos3 + 3, 15, "scientific name") != 0)
+            continue;
+        int idx = this->my_taxonomy->get_index(atoi(line.substr(0, pos1).c_str()));
+        if (idx >= 0)
+            this->names[idx] = line.substr(pos1 + 3, pos2 - pos1 - 3);
+    }
+    return true;
+}
+
+/*METHOD: Count one line of Kraken output. The taxid column is either a
+ * taxid or "name (taxid N)" (Kraken 2 --use-names).*/
+bool ReadCounter::add_line(const char *line, size_t len) {
+    if (len < 2 || line[1] != '\t')
+        return false;
+    if (line[0] == 'U') {
+        add_read(0);
+        return true;
+    }
+    if (line[0] != 'C')
+        return false;
+    /*Third column*/
+    const char *end = line + len;
+    const char *field = (const char *) memchr(line + 2, '\t', len - 2);
+    if (field == NULL)
+        return false;
+    field += 1;
+    const char *field_end = (const char *) memchr(field, '\t', end - field);
+    if (field_end == NULL)
+        field_end = end;
+    const char *digits = field;
+    if (field_end > field && field_end[-1] == ')') {
+        const char *open = field_end - 1;
+        while (open > field && *open != '(')
+            open--;
+        if (field_end - open < 8 || memcmp(open, "(taxid ", 7) != 0)
+            return false;
+        digits = open + 7;
+        field_end -= 1;
+    }
+    if (digits == field_end)
+        return false;
+    long long taxid = 0;
+    for (const char *p = digits; p < field_end; p++) {
+        if (*p < '0' || *p > '9' || taxid > INT32_MAX)
+            return false;
+        taxid = taxid * 10 + (*p - '0');
+    }
+    if (taxid > INT32_MAX)
+        return false;
+    add_read((int) taxid);
+    return true;
+}
+
+/*METHOD: Count a read at its taxon and every ancestor of it*/
+void ReadCounter::add_read(int taxid) {
+    this->n_reads += 1;
+    if (taxid == 0) {
+        this->n_unclassified += 1;
+        return;
+    }
+    int root = this->my_taxonomy->get_root();
+    int idx = this->my_taxonomy->get_index(taxid);
+    if (idx < 0 || root < 0 || !this->my_taxonomy->is_ancestor(root, idx)) {
+        this->n_unknown += 1;
+        return;
+    }
+    this->direct_counts[idx] += 1;
+    while (idx >= 0) {
+        this->clade_counts[idx] += 1;
+        idx = this->my_taxonomy->get_parent(idx);
+    }
+}
+
+/*Report codes of the ranks Kraken reports*/
+static char rank_letter(taxon_rank rank) {
+    switch (rank) {
+        case RANK_SUPERKINGDOM:
+        case RANK_DOMAIN:
+            return 'D';
+        case RANK_KINGDOM:
+            return 'K';
+        case RANK_PHYLUM:
+            return 'P';
+        case RANK_CLASS:
+            return 'C';
+        case RANK_ORDER:
+            return 'O';
+        case RANK_FAMILY:
+            return 'F';
+        case RANK_GENUS:
+            return 'G';
+        case RANK_SPECIES:
+            return 'S';
+        default:
+            return 0;
+    }
+}
+
+/*METHOD: Append the report line of one taxon*/
+void ReadCounter::add_report_line(vector<string> &lines, int idx, const string &code, int depth) const {
+    int taxid = this->my_taxonomy->get_taxid(idx);
+    string name = this->names.empty() ? "" : this->names[idx];
+    if (name.empty())
+        name = (taxid == 1) ? "root" : std::to_string(taxid);
+    char buffer[96];
+    snprintf(buffer, sizeof(buffer), "%6.2f\t%llu\t%llu\t%s\t%i\t",
+        100.0 * this->clade_counts[idx] / this->n_reads,
+        (unsigned long long) this->clade_counts[idx],
+        (unsigned long long) this->direct_counts[idx], code.c_str(), taxid);
+    lines.push_back(buffer + string(2 * depth, ' ') + name);
+}
+
+/*METHOD: Build the report as Kraken 2 does: unclassified reads, then the tree
+ * from the root in pre-order with children sorted by decreasing clade count.
+ * Taxa without reads are left out; taxa of other ranks get the code of their
+ * closest ranked ancestor and their distance to it (e.g. S1).*/
+void ReadCounter::build_report(vector<string> &lines) const {
+    lines.clear();
+    if (this->n_unclassified > 0) {
+        char buffer[96];
+        snprintf(buffer, sizeof(buffer), "%6.2f\t%llu\t%llu\tU\t0\tunclassified",
+            100.0 * this->n_unclassified / this->n_reads,
+            (unsigned long long) this->n_unclassified, (unsigned long long) this->n_unclassified);
+        lines.push_back(buffer);
+    }
+    int root = this->my_taxonomy->get_root();
+    if (root < 0 || this->clade_counts[root] == 0)
+        return;
+    /*Stack of (taxon, depth, code letter, distance to the ranked ancestor)*/
+    struct entry { int idx; int depth; char letter; int offset; };
+    vector<entry> stack;
+    stack.push_back({root, 0, 'R', 0});
+    vector<int> children;
+    while (!stack.empty()) {
+        entry e = stack.back();
+        stack.pop_back();
+        string code(1, e.letter);
+        if (e.offset > 0)
+            code += std::to_string(e.offset);
+        add_report_line(lines, e.idx, code, e.depth);
+        children.clear();
+        for (const int *c = this->my_taxonomy->children_begin(e.idx); c != this->my_taxonomy->children_end(e.idx); c++) {
+            if (this->clade_counts[*c] > 0)
+                children.push_back(*c);
+        }
+        std::sort(children.begin(), children.end(), [this](int a, int b) {
+            if (this->clade_counts[a] != this->clade_counts[b])
+                return this->clade_counts[a] > this->clade_counts[b];
+            return this->my_taxonomy->get_taxid(a) < this->my_taxonomy->get_taxid(b);
+        });
+        /*Pushed in reverse so the largest clade is reported first*/
+        for (size_t i = children.size(); i-- > 0; ) {
+            char letter = rank_letter(this->my_taxonomy->get_rank(children[i]));
+            if (letter != 0)
+                stack.push_back({children[i], e.depth + 1, letter, 0});
+            else
+                stack.push_back({children[i], e.depth + 1, e.letter, e.offset + 1});
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/*********************************************************************
+ * stream_estimation.h is used as part of the bracken_est program
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef STREAM_ESTIMATION_H
+#define STREAM_ESTIMATION_H
+
+#include "kmer2read_headers.h"
+#include "taxonomy.h"
+
+/* Class counting Kraken per-read output (C/U, read ID, taxid, length, kmers)
+ * as it arrives. Each classified read adds one to the direct count of its
+ * taxon and to the clade counts of the taxon and all of its ancestors, so a
+ * Kraken-style report of all reads so far can be built at any time.
+ */
+class ReadCounter {
+    public:
+        ReadCounter(const taxonomy *);
+        /*Read scientific names from names.dmp (taxids are used otherwise)*/
+        bool load_names(const string &);
+        /*Count one line of Kraken output (false if it is not one)*/
+        bool add_line(const char *, size_t);
+        /*Count a read classified as a taxid (0 for unclassified)*/
+        void add_read(int);
+        uint64_t get_reads() const;
+        uint64_t get_unknown() const;
+        /*Kraken report lines of all reads counted so far*/
+        void build_report(vector<string> &) const;
+    private:
+        void add_report_line(vector<string> &, int, const string &, int) const;
+
+        const taxonomy *my_taxonomy;
+        /*Per-taxon counts, indexed by taxonomy index*/
+        vector<uint64_t> direct_counts;
+        vector<uint64_t> clade_counts;
+        vector<string> names;
+        uint64_t n_reads;
+        uint64_t n_unclassified;
+        /*Reads classified as taxids missing from (or detached in) the taxonomy*/
+        uint64_t n_unknown;
+};
+
+inline uint64_t ReadCounter::get_reads() const {
+    return this->n_reads;
+}
+
+inline uint64_t ReadCounter::get_unknown() const {
+    return this->n_unknown;
+}
+
+#endif
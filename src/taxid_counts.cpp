@@ -0,0 +1,59 @@
+/*********************************************************************
+ * taxid_counts.cpp is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#include "taxid_counts.h"
+
+/*Constructor*/
+TaxidCounts::TaxidCounts() {
+    this->table.assign(TAXID_COUNTS_MIN_SLOTS, 0);
+    this->mask = TAXID_COUNTS_MIN_SLOTS - 1;
+    this->shift = 32 - __builtin_ctz(TAXID_COUNTS_MIN_SLOTS);
+}
+
+/*METHOD: Remove all counts, resetting only the slots in use*/
+void TaxidCounts::clear() {
+    for (size_t i = 0; i < this->entries.size(); i++)
+        this->table[this->entries[i].slot] = 0;
+    this->entries.clear();
+}
+
+/*METHOD: Double the table and place the entries again*/
+void TaxidCounts::grow() {
+    this->table.assign(2 * this->table.size(), 0);
+    this->mask = (uint32_t) this->table.size() - 1;
+    this->shift -= 1;
+    for (size_t i = 0; i < this->entries.size(); i++) {
+        uint32_t slot = home_slot(this->entries[i].taxid);
+        while (this->table[slot] != 0)
+            slot = (slot + 1) & this->mask;
+        this->entries[i].slot = slot;
+        this->table[slot] = (uint32_t) i + 1;
+    }
+}
+
+/*METHOD: Order the entries by taxid, keeping the table pointing at them*/
+void TaxidCounts::sort() {
+    std::sort(this->entries.begin(), this->entries.end(), [](const taxid_count &a, const taxid_count &b) {
+        return a.taxid < b.taxid;
+    });
+    for (size_t i = 0; i < this->entries.size(); i++)
+        this->table[this->entries[i].slot] = (uint32_t) i + 1;
+}
@@ -0,0 +1,105 @@
+/*********************************************************************
+ * taxid_counts.h is used as part of the kmer2distr script
+ * Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+ *
+ * This file is part of Bracken.
+ * Bracken is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.*/
+/************************************************************************
+ * Jennifer Lu, jlu26@jhmi.edu
+ * Updated: 2022/03/31
+ */
+#ifndef TAXID_COUNTS_H
+#define TAXID_COUNTS_H
+
+#include "kmer2read_headers.h"
+
+/*Number of reads mapped to one taxid*/
+struct taxid_count {
+    int taxid;
+    int count;
+    /*Slot of the taxid in the hash table*/
+    uint32_t slot;
+};
+
+/* Class counting the reads mapped to each taxid of one sequence.
+ * Counts are kept in a list of entries and found through an open-addressing
+ * table of entry numbers. Both keep their capacity, and clear() only resets
+ * the slots that were used, so a thread reuses one instance for every
+ * sequence without allocating once it has seen its largest sequence.
+ */
+class TaxidCounts {
+    public:
+        TaxidCounts();
+        void add(int, int);
+        void clear();
+        /*Order the entries by taxid (they are kept in insertion order otherwise)*/
+        void sort();
+        bool empty() const;
+        size_t size() const;
+        const taxid_count *begin() const;
+        const taxid_count *end() const;
+    private:
+        uint32_t home_slot(int) const;
+        void grow();
+
+        vector<taxid_count> entries;
+        /*Entry number + 1 of each slot (0 if free)*/
+        vector<uint32_t> table;
+        uint32_t mask;
+        int shift;
+};
+
+/*Slots of a new table (a power of 2)*/
+#define TAXID_COUNTS_MIN_SLOTS 64
+
+/*Fibonacci hashing: the top bits of taxid * 2^32 / phi*/
+inline uint32_t TaxidCounts::home_slot(int taxid) const {
+    return ((uint32_t) taxid * 0x9E3779B1U) >> this->shift;
+}
+
+inline void TaxidCounts::add(int taxid, int count) {
+    uint32_t slot = home_slot(taxid);
+    while (this->table[slot] != 0) {
+        taxid_count &e = this->entries[this->table[slot] - 1];
+        if (e.taxid == taxid) {
+            e.count += count;
+            return;
+        }
+        slot = (slot + 1) & this->mask;
+    }
+    taxid_count e = {taxid, count, slot};
+    this->entries.push_back(e);
+    this->table[slot] = (uint32_t) this->entries.size();
+    //Keep the table at most half full
+    if (2 * this->entries.size() > this->table.size())
+        grow();
+}
+
+inline bool TaxidCounts::empty() const {
+    return this->entries.empty();
+}
+
+inline size_t TaxidCounts::size() const {
+    return this->entries.size();
+}
+
+inline const taxid_count *TaxidCounts::begin() const {
+    return this->entries.data();
+}
+
+inline const taxid_count *TaxidCounts::end() const {
+    return this->entries.data() + this->entries.size();
+}
+
+#endif
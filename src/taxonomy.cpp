@@ -7,7 +7,7 @@
  * it under the terms of the GNU General Public License as published by
  * the Free Software Foundation; either version 3 of the license, or
  * (at your option) any later version.
- * 
+ *
  * This program is distributed in the hope that it will be useful,
  * but WITHOUT ANY WARRANTY; without even the implied warranty of
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
@@ -21,30 +21,469 @@
  */
 
 #include "taxonomy.h"
+#include "ctime.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <limits.h>
 using std::vector;
 using std::string;
 
+static const char *RANK_NAMES[] = {
+    "no rank", "superkingdom", "domain", "kingdom", "phylum", "class",
+    "order", "family", "genus", "species", "subspecies", "strain", "other"
+};
+
+/*METHOD: Convert a nodes.dmp rank into its rank code*/
+taxon_rank get_rank_code(const string &rank) {
+    for (int r = RANK_NO_RANK; r < RANK_OTHER; r++) {
+        if (rank == RANK_NAMES[r])
+            return (taxon_rank) r;
+    }
+    return RANK_OTHER;
+}
+
+/*METHOD: Name of a rank code*/
+const char *get_rank_name(taxon_rank rank) {
+    return RANK_NAMES[rank];
+}
+
 /*Null constructor*/
 taxonomy::taxonomy() {
-    this->taxid = -1;
-    this->lvl_type = "N";
-    this->parent = NULL;
-    this->lvl_num = 0;
-}
-/*Constructor without Parent*/
-taxonomy::taxonomy(int taxid, string level_type) {
-    this->taxid = taxid;
-    this->lvl_type = level_type;
-    this->parent = NULL;
-    this->lvl_num = 0;
-}
-/*Constructor for the Taxonomy Node*/
-taxonomy::taxonomy(int taxid, string level_type, taxonomy *parent) {
-    this->taxid = taxid;
-    this->lvl_type = level_type;
-    this->lvl_num = 0;
-    this->parent = parent;
-}
-/*Destructor */ 
+    this->root = -1;
+    this->cache_data = NULL;
+    this->cache_size = 0;
+}
+/*Destructor */
 taxonomy::~taxonomy() {
+    if (this->cache_data != NULL)
+        munmap(this->cache_data, this->cache_size);
+}
+
+/*METHOD: Number all nodes in DFS pre-order and build the lookup tables.
+ * Nodes whose parent is missing (or that are not linked to the root)
+ * become the roots of their own trees.*/
+void taxonomy::build(const vector<int> &node_taxids, const vector<int> &node_parents, const vector<uint8_t> &node_ranks) {
+    int n = (int) node_taxids.size();
+    /*Index the nodes.dmp records by taxid (later records replace earlier ones)*/
+    index_taxids(node_taxids);
+    vector<int> record(n, -1);
+    for (int r = 0; r < n; r++)
+        record[r] = get_index(node_taxids[r]);
+    /*Children of each record, in file order*/
+    vector<int> parent_record(n, -1);
+    vector<int> n_kids(n + 1, 0);
+    for (int r = 0; r < n; r++) {
+        if (record[r] != r || node_taxids[r] == 1)
+            continue;
+        int p = get_index(node_parents[r]);
+        if (p >= 0 && p != r) {
+            parent_record[r] = p;
+            n_kids[p] += 1;
+        }
+    }
+    vector<int> kid_offsets(n + 1, 0);
+    for (int r = 0; r < n; r++)
+        kid_offsets[r + 1] = kid_offsets[r] + n_kids[r];
+    vector<int> kids(kid_offsets[n]);
+    vector<int> kid_fill(kid_offsets.begin(), kid_offsets.end() - 1);
+    for (int r = 0; r < n; r++) {
+        if (parent_record[r] >= 0)
+            kids[kid_fill[parent_record[r]]++] = r;
+    }
+
+    /*Pre-order numbering, starting with the root*/
+    vector<int> order;
+    order.reserve(n);
+    vector<int> new_index(n, -1);
+    vector<int> starts;
+    int root_record = get_index(1);
+    if (root_record >= 0)
+        starts.push_back(root_record);
+    for (int r = 0; r < n; r++) {
+        if (record[r] == r && parent_record[r] < 0 && r != root_record)
+            starts.push_back(r);
+    }
+    //Records in parent cycles are reached last
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t s = 0; s < starts.size(); s++) {
+            vector<int> stack(1, starts[s]);
+            while (!stack.empty()) {
+                int r = stack.back();
+                stack.pop_back();
+                if (new_index[r] >= 0)
+                    continue;
+                new_index[r] = (int) order.size();
+                order.push_back(r);
+                for (int k = kid_offsets[r + 1] - 1; k >= kid_offsets[r]; k--)
+                    stack.push_back(kids[k]);
+            }
+        }
+        starts.clear();
+        for (int r = 0; r < n; r++) {
+            if (record[r] == r && new_index[r] < 0)
+                starts.push_back(r);
+        }
+    }
+
+    /*Fill the flat arrays in index order*/
+    int n_nodes = (int) order.size();
+    vector<int> new_taxids(n_nodes, 0);
+    vector<int> new_parents(n_nodes, -1);
+    vector<int> new_depths(n_nodes, 0);
+    vector<uint8_t> new_ranks(n_nodes, RANK_NO_RANK);
+    vector<int> new_subtree_end(n_nodes, 0);
+    vector<int> new_child_offsets(n_nodes + 1, 0);
+    for (int idx = 0; idx < n_nodes; idx++) {
+        int r = order[idx];
+        int p = parent_record[r];
+        new_taxids[idx] = node_taxids[r];
+        new_ranks[idx] = node_ranks[r];
+        new_subtree_end[idx] = idx;
+        //Cycle members are numbered as roots; cut their link to the parent
+        if (p >= 0 && new_index[p] < idx) {
+            new_parents[idx] = new_index[p];
+            new_depths[idx] = new_depths[new_index[p]] + 1;
+            new_child_offsets[new_index[p] + 1] += 1;
+        }
+    }
+    for (int idx = n_nodes - 1; idx > 0; idx--) {
+        int p = new_parents[idx];
+        if (p >= 0 && new_subtree_end[idx] > new_subtree_end[p])
+            new_subtree_end[p] = new_subtree_end[idx];
+    }
+    for (int idx = 0; idx < n_nodes; idx++)
+        new_child_offsets[idx + 1] += new_child_offsets[idx];
+    vector<int> new_children(new_child_offsets[n_nodes], 0);
+    vector<int> child_fill(new_child_offsets.begin(), new_child_offsets.end() - 1);
+    for (int idx = 0; idx < n_nodes; idx++) {
+        if (new_parents[idx] >= 0)
+            new_children[child_fill[new_parents[idx]]++] = idx;
+    }
+    this->root = (n_nodes > 0 && new_taxids[0] == 1) ? 0 : -1;
+    index_taxids(new_taxids);
+    build_rmq(new_depths);
+    this->taxids.assign(new_taxids);
+    this->parents.assign(new_parents);
+    this->depths.assign(new_depths);
+    this->ranks.assign(new_ranks);
+    this->subtree_end.assign(new_subtree_end);
+    this->child_offsets.assign(new_child_offsets);
+    this->children.assign(new_children);
+}
+
+/*METHOD: Build the taxid -> index lookup for taxids listed in index order*/
+void taxonomy::index_taxids(const vector<int> &node_taxids) {
+    int max_taxid = 0;
+    for (size_t i = 0; i < node_taxids.size(); i++)
+        max_taxid = max(max_taxid, node_taxids[i]);
+    vector<int> direct;
+    vector<std::pair<int, int>> sorted;
+    if (max_taxid < MAX_DIRECT_TAXID || (size_t) max_taxid < 4 * node_taxids.size()) {
+        direct.assign((size_t) max_taxid + 1, -1);
+        for (size_t i = 0; i < node_taxids.size(); i++) {
+            if (node_taxids[i] >= 0)
+                direct[node_taxids[i]] = (int) i;
+        }
+    } else {
+        for (size_t i = 0; i < node_taxids.size(); i++)
+            sorted.push_back(std::make_pair(node_taxids[i], (int) i));
+        std::sort(sorted.begin(), sorted.end());
+        //Keep the last record of a repeated taxid
+        size_t n_unique = 0;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            if (n_unique > 0 && sorted[n_unique - 1].first == sorted[i].first)
+                n_unique -= 1;
+            sorted[n_unique++] = sorted[i];
+        }
+        sorted.resize(n_unique);
+    }
+    this->taxid_index.assign(direct);
+    this->sorted_taxids.assign(sorted);
+}
+
+/*METHOD: Build the range minimum tables over the pre-order depths*/
+void taxonomy::build_rmq(const vector<int> &node_depths) {
+    /*Stack of increasing depths within each block of 64 nodes*/
+    int n = (int) node_depths.size();
+    int n_blocks = (n + 63) / 64;
+    vector<uint64_t> mask(n, 0);
+    vector<int> table(n_blocks, 0);
+    vector<uint64_t> offsets(1, 0);
+    for (int b = 0; b < n_blocks; b++) {
+        int start = b * 64;
+        int end = min(start + 64, n);
+        uint64_t curr = 0;
+        for (int i = start; i < end; i++) {
+            while (curr != 0 && node_depths[start + 63 - __builtin_clzll(curr)] >= node_depths[i])
+                curr ^= (uint64_t) 1 << (63 - __builtin_clzll(curr));
+            curr |= (uint64_t) 1 << (i - start);
+            mask[i] = curr;
+        }
+        table[b] = start + __builtin_ctzll(mask[end - 1]);
+    }
+    /*Sparse table over the block minima: level k covers 2^k blocks*/
+    for (int k = 1; (1 << k) <= n_blocks; k++) {
+        size_t prev = offsets[k - 1];
+        offsets.push_back(table.size());
+        for (int b = 0; b + (1 << k) <= n_blocks; b++) {
+            int left = table[prev + b];
+            int right = table[prev + b + (1 << (k - 1))];
+            table.push_back((node_depths[right] < node_depths[left]) ? right : left);
+        }
+    }
+    this->block_mask.assign(mask);
+    this->sparse.assign(table);
+    this->sparse_offsets.assign(offsets);
+}
+
+/*Cache file layout: header, then each array aligned to 8 bytes*/
+#define TAXONOMY_CACHE_MAGIC "BRKNTAX"
+#define TAXONOMY_CACHE_VERSION 1
+#define TAXONOMY_CACHE_BYTE_ORDER 0x01020304
+#define TAXONOMY_CACHE_SECTIONS 12
+
+struct taxonomy_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    /*Size and modification time of the nodes.dmp the cache was built from*/
+    uint64_t nodes_size;
+    int64_t nodes_mtime_sec;
+    int64_t nodes_mtime_nsec;
+    int32_t root;
+    uint32_t n_sections;
+    uint64_t offsets[TAXONOMY_CACHE_SECTIONS];
+    uint64_t counts[TAXONOMY_CACHE_SECTIONS];
+};
+
+/*METHOD: Save all arrays to a binary cache file (written to a temporary file, then renamed)*/
+bool taxonomy::save_cache(const string &cache_file, const struct stat &nodes_stat) const {
+    const void *data[TAXONOMY_CACHE_SECTIONS] = {
+        this->taxids.data(), this->parents.data(), this->depths.data(), this->ranks.data(),
+        this->subtree_end.data(), this->child_offsets.data(), this->children.data(),
+        this->taxid_index.data(), this->sorted_taxids.data(), this->block_mask.data(),
+        this->sparse.data(), this->sparse_offsets.data()
+    };
+    size_t widths[TAXONOMY_CACHE_SECTIONS] = {
+        sizeof(int), sizeof(int), sizeof(int), sizeof(uint8_t),
+        sizeof(int), sizeof(int), sizeof(int),
+        sizeof(int), sizeof(std::pair<int, int>), sizeof(uint64_t),
+        sizeof(int), sizeof(uint64_t)
+    };
+    size_t counts[TAXONOMY_CACHE_SECTIONS] = {
+        this->taxids.size(), this->parents.size(), this->depths.size(), this->ranks.size(),
+        this->subtree_end.size(), this->child_offsets.size(), this->children.size(),
+        this->taxid_index.size(), this->sorted_taxids.size(), this->block_mask.size(),
+        this->sparse.size(), this->sparse_offsets.size()
+    };
+    taxonomy_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TAXONOMY_CACHE_MAGIC, sizeof(header.magic));
+    header.version = TAXONOMY_CACHE_VERSION;
+    header.byte_order = TAXONOMY_CACHE_BYTE_ORDER;
+    header.nodes_size = nodes_stat.st_size;
+    get_mtime(nodes_stat, header.nodes_mtime_sec, header.nodes_mtime_nsec);
+    header.root = this->root;
+    header.n_sections = TAXONOMY_CACHE_SECTIONS;
+    uint64_t offset = (sizeof(header) + 7) & ~(uint64_t) 7;
+    for (int i = 0; i < TAXONOMY_CACHE_SECTIONS; i++) {
+        header.offsets[i] = offset;
+        header.counts[i] = counts[i];
+        offset = (offset + counts[i] * widths[i] + 7) & ~(uint64_t) 7;
+    }
+
+    string tmp_file = cache_file + ".tmp." + std::to_string(getpid());
+    FILE *out = fopen(tmp_file.c_str(), "wb");
+    if (out == NULL)
+        return false;
+    static const char padding[8] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    uint64_t written = sizeof(header);
+    for (int i = 0; ok && i < TAXONOMY_CACHE_SECTIONS; i++) {
+        ok = fwrite(padding, 1, header.offsets[i] - written, out) == header.offsets[i] - written;
+        if (ok && counts[i] > 0)
+            ok = fwrite(data[i], widths[i], counts[i], out) == counts[i];
+        written = header.offsets[i] + counts[i] * widths[i];
+    }
+    ok = (fclose(out) == 0) && ok;
+    if (ok)
+        ok = rename(tmp_file.c_str(), cache_file.c_str()) == 0;
+    if (!ok)
+        unlink(tmp_file.c_str());
+    return ok;
+}
+
+/*METHOD: Check that the cache sections describe one consistent tree*/
+static bool cache_sections_consistent(const taxonomy_cache_header *header, const char *base) {
+    const uint64_t *counts = header->counts;
+    uint64_t n = counts[0];
+    if (n > (uint64_t) INT_MAX)
+        return false;
+    /*Per-node arrays (including the block masks) have one entry per taxid*/
+    if (counts[1] != n || counts[2] != n || counts[3] != n || counts[4] != n || counts[9] != n)
+        return false;
+    /*CSR child lists: n + 1 offsets, the last one being the number of children*/
+    if (counts[5] != n + 1)
+        return false;
+    const int *child_offsets = reinterpret_cast<const int *>(base + header->offsets[5]);
+    if (child_offsets[0] != 0 || child_offsets[n] < 0 || (uint64_t) child_offsets[n] != counts[6])
+        return false;
+    /*Exactly one of the direct and sorted taxid lookups*/
+    if ((counts[7] > 0) == (counts[8] > 0))
+        return false;
+    /*One sparse table level per power of two up to the number of blocks*/
+    uint64_t n_blocks = (n + 63) / 64;
+    uint64_t n_levels = 1;
+    while (((uint64_t) 1 << n_levels) <= n_blocks)
+        n_levels += 1;
+    if (counts[11] != n_levels)
+        return false;
+    const uint64_t *sparse_offsets = reinterpret_cast<const uint64_t *>(base + header->offsets[11]);
+    for (uint64_t k = 0; k < n_levels; k++) {
+        uint64_t level_size = (k == 0) ? n_blocks : n_blocks + 1 - ((uint64_t) 1 << k);
+        if (sparse_offsets[k] > counts[10] || level_size > counts[10] - sparse_offsets[k])
+            return false;
+    }
+    return header->root == -1 || (header->root == 0 && n > 0);
+}
+
+/*METHOD: Map a binary cache file; fails if it was built from a different nodes.dmp*/
+bool taxonomy::load_cache(const string &cache_file, const struct stat &nodes_stat) {
+    int fd = open(cache_file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t) sb.st_size < sizeof(taxonomy_cache_header)) {
+        close(fd);
+        return false;
+    }
+    size_t size = sb.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    /*Check the header against this build and the current nodes.dmp*/
+    const taxonomy_cache_header *header = static_cast<const taxonomy_cache_header *>(data);
+    int64_t mtime_sec, mtime_nsec;
+    get_mtime(nodes_stat, mtime_sec, mtime_nsec);
+    bool ok = memcmp(header->magic, TAXONOMY_CACHE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == TAXONOMY_CACHE_VERSION
+        && header->byte_order == TAXONOMY_CACHE_BYTE_ORDER
+        && header->n_sections == TAXONOMY_CACHE_SECTIONS
+        && header->nodes_size == (uint64_t) nodes_stat.st_size
+        && header->nodes_mtime_sec == mtime_sec
+        && header->nodes_mtime_nsec == mtime_nsec;
+    size_t widths[TAXONOMY_CACHE_SECTIONS] = {
+        sizeof(int), sizeof(int), sizeof(int), sizeof(uint8_t),
+        sizeof(int), sizeof(int), sizeof(int),
+        sizeof(int), sizeof(std::pair<int, int>), sizeof(uint64_t),
+        sizeof(int), sizeof(uint64_t)
+    };
+    for (int i = 0; ok && i < TAXONOMY_CACHE_SECTIONS; i++) {
+        ok = header->offsets[i] % 8 == 0 && header->offsets[i] <= size
+            && header->counts[i] <= (size - header->offsets[i]) / widths[i];
+    }
+    if (ok)
+        ok = cache_sections_consistent(header, static_cast<const char *>(data));
+    if (!ok) {
+        munmap(data, size);
+        return false;
+    }
+    const char *base = static_cast<const char *>(data);
+    this->taxids.view(reinterpret_cast<const int *>(base + header->offsets[0]), header->counts[0]);
+    this->parents.view(reinterpret_cast<const int *>(base + header->offsets[1]), header->counts[1]);
+    this->depths.view(reinterpret_cast<const int *>(base + header->offsets[2]), header->counts[2]);
+    this->ranks.view(reinterpret_cast<const uint8_t *>(base + header->offsets[3]), header->counts[3]);
+    this->subtree_end.view(reinterpret_cast<const int *>(base + header->offsets[4]), header->counts[4]);
+    this->child_offsets.view(reinterpret_cast<const int *>(base + header->offsets[5]), header->counts[5]);
+    this->children.view(reinterpret_cast<const int *>(base + header->offsets[6]), header->counts[6]);
+    this->taxid_index.view(reinterpret_cast<const int *>(base + header->offsets[7]), header->counts[7]);
+    this->sorted_taxids.view(reinterpret_cast<const std::pair<int, int> *>(base + header->offsets[8]), header->counts[8]);
+    this->block_mask.view(reinterpret_cast<const uint64_t *>(base + header->offsets[9]), header->counts[9]);
+    this->sparse.view(reinterpret_cast<const int *>(base + header->offsets[10]), header->counts[10]);
+    this->sparse_offsets.view(reinterpret_cast<const uint64_t *>(base + header->offsets[11]), header->counts[11]);
+    this->root = header->root;
+    if (this->cache_data != NULL)
+        munmap(this->cache_data, this->cache_size);
+    this->cache_data = data;
+    this->cache_size = size;
+    return true;
+}
+
+/*METHOD: Position of the shallowest node in [l, r] within one block*/
+int taxonomy::argmin_in_block(int l, int r) const {
+    uint64_t m = this->block_mask[r] & (~(uint64_t) 0 << (l % 64));
+    return (l / 64) * 64 + __builtin_ctzll(m);
+}
+
+/*METHOD: Position of the shallowest node in [l, r]*/
+int taxonomy::argmin(int l, int r) const {
+    int bl = l / 64;
+    int br = r / 64;
+    if (bl == br)
+        return argmin_in_block(l, r);
+    int best = argmin_in_block(l, bl * 64 + 63);
+    int right = argmin_in_block(br * 64, r);
+    if (this->depths[right] < this->depths[best])
+        best = right;
+    if (bl + 1 < br) {
+        int k = 31 - __builtin_clz(br - bl - 1);
+        const int *level = &this->sparse[this->sparse_offsets[k]];
+        int mid1 = level[bl + 1];
+        int mid2 = level[br - (1 << k)];
+        if (this->depths[mid1] < this->depths[best])
+            best = mid1;
+        if (this->depths[mid2] < this->depths[best])
+            best = mid2;
+    }
+    return best;
+}
+
+/*METHOD: Use the nodes.dmp to construct the taxonomy!*/ 
+bool construct_taxonomy(const string &t_file, taxonomy *my_taxonomy, bool use_cache) {
+    /*Initialize variables*/
+    int pos1, pos2, pos3;
+    int n_count = 0;
+    string line;
+    vector<int> node_taxids;
+    vector<int> node_parents;
+    vector<uint8_t> node_ranks;
+    /*Load the cached tree unless nodes.dmp has changed since it was written*/
+    struct stat node_stat;
+    string cache_file = t_file + TAXONOMY_CACHE_SUFFIX;
+    if (stat(t_file.c_str(), &node_stat) != 0)
+        return false;
+    if (use_cache && my_taxonomy->load_cache(cache_file, node_stat)) {
+        printf("\t>>STEP 2: LOADING TAXONOMY CACHE\n");
+        printf("\t\t%i total nodes loaded from %s\n", my_taxonomy->size(), cache_file.c_str());
+        return true;
+    }
+    /*Read through file line by line*/
+    ifstream nodefile (t_file);
+    if (nodefile.is_open()){
+        printf("\t>>STEP 2: READING NODES.DMP FILE\n");
+        printf("\t\t0 nodes read");
+        while(getline(nodefile, line)) {
+            n_count += 1;
+            if (n_count % 1000 == 0) 
+                printf("\r\t\t%i nodes read", n_count);
+            //Find delimiter indices
+            pos1 = line.find("\t|\t");
+            pos2 = line.find("\t|\t", pos1+1);
+            pos3 = line.find("\t|\t", pos2+1);
+            //Extract taxid, parent, and rank information
+            node_taxids.push_back(atoi(line.substr(0, pos1).c_str()));
+            node_parents.push_back(atoi(line.substr(pos1+3, pos2-pos1-3).c_str()));
+            node_ranks.push_back(get_rank_code(line.substr(pos2+3, pos3-pos2-3)));
+        }
+        printf("\r\t\t%i total nodes read\n", n_count);
+        nodefile.close();
+    } else {
+        return false;
+    }
+    /*Link parents/children and number the tree from the root*/
+    my_taxonomy->build(node_taxids, node_parents, node_ranks);
+    if (use_cache && !my_taxonomy->save_cache(cache_file, node_stat))
+        printf("\t\tWarning: could not write taxonomy cache %s\n", cache_file.c_str());
+    return true;
 }
@@ -7,7 +7,7 @@
  * it under the terms of the GNU General Public License as published by
  * the Free Software Foundation; either version 3 of the license, or
  * (at your option) any later version.
- * 
+ *
  * This program is distributed in the hope that it will be useful,
  * but WITHOUT ANY WARRANTY; without even the implied warranty of
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
@@ -24,68 +24,193 @@
 #define TAXONOMY_H
 #include "kmer2read_headers.h"
 
-/* Class defining the  Taxonomy.
- * This class specifies the methods and variables
- * used for adding to/accessing the taxonomy tree node
+/*Taxonomy ranks listed in nodes.dmp (all others are stored as RANK_OTHER)*/
+enum taxon_rank {
+    RANK_NO_RANK = 0,
+    RANK_SUPERKINGDOM,
+    RANK_DOMAIN,
+    RANK_KINGDOM,
+    RANK_PHYLUM,
+    RANK_CLASS,
+    RANK_ORDER,
+    RANK_FAMILY,
+    RANK_GENUS,
+    RANK_SPECIES,
+    RANK_SUBSPECIES,
+    RANK_STRAIN,
+    RANK_OTHER
+};
+
+taxon_rank get_rank_code(const string &);
+const char *get_rank_name(taxon_rank);
+
+/* Read-only array that either owns its elements or points into a
+ * memory-mapped file.
+ */
+template <typename T>
+class flat_array {
+    public:
+        flat_array() : ptr(NULL), len(0) {}
+        flat_array(const flat_array &) = delete;
+        flat_array& operator=(const flat_array &) = delete;
+        /*Take over the elements of a vector*/
+        void assign(vector<T> &elements) {
+            this->owned.swap(elements);
+            vector<T>().swap(elements);
+            this->ptr = this->owned.data();
+            this->len = this->owned.size();
+        }
+        /*Point at elements owned by someone else (e.g. a mapped file)*/
+        void view(const T *elements, size_t n) {
+            vector<T>().swap(this->owned);
+            this->ptr = elements;
+            this->len = n;
+        }
+        const T& operator[](size_t i) const { return this->ptr[i]; }
+        const T* data() const { return this->ptr; }
+        size_t size() const { return this->len; }
+        bool empty() const { return this->len == 0; }
+    private:
+        vector<T> owned;
+        const T *ptr;
+        size_t len;
+};
+
+/* Class defining the Taxonomy.
+ * The tree is stored as flat arrays indexed by a dense node index.
+ * Nodes are numbered in DFS pre-order starting at the root (taxid 1), so each
+ * subtree is the contiguous index range [index, subtree_end] and children are
+ * kept as CSR lists. Taxids map to indices through a direct-mapped array
+ * (or a sorted table when taxids are too sparse for one).
+ *
+ * The LCA of two nodes is the parent of the shallowest node between them in
+ * pre-order, found with a range minimum query: a sparse table over blocks of
+ * 64 nodes plus a per-node bitmask of the increasing-depth stack within its
+ * block. Both LCA and ancestor queries take constant time.
  */
 class taxonomy{
     public:
         /*Constructor and Destructor*/
         taxonomy();
-        taxonomy(int, string);
-        taxonomy(int, string, taxonomy *);
         ~taxonomy();
-        /*Methods for accessing this node's information*/
-        int get_taxid() const;
-        int get_lvl_num() const;
-        string get_lvl_type() const; 
-        taxonomy* get_parent() const;
-        vector<taxonomy *> get_children() const;
-        /*Methods for manipulating the tree*/
-        void add_parent(taxonomy *);
-        void add_child(taxonomy *);
-        void set_lvl_num(int);
-        /*Other methods for comparisons*/
-        void get_lca(taxonomy *); 
+        /*Build from the taxid, parent taxid and rank of every nodes.dmp line*/
+        void build(const vector<int> &, const vector<int> &, const vector<uint8_t> &);
+        /*Save to/load from a binary cache tied to the stat of nodes.dmp*/
+        bool save_cache(const string &, const struct stat &) const;
+        bool load_cache(const string &, const struct stat &);
+        /*Methods for accessing node information*/
+        int size() const;
+        int get_root() const;
+        int get_index(int) const;
+        int get_taxid(int) const;
+        int get_parent(int) const;
+        int get_depth(int) const;
+        taxon_rank get_rank(int) const;
+        const int* children_begin(int) const;
+        const int* children_end(int) const;
+        /*Methods for comparisons*/
+        bool is_ancestor(int, int) const;
+        int get_lca(int, int) const;
     private:
-        int taxid;
-        int lvl_num;
-        string lvl_type;
-        vector<taxonomy *> children;
-        taxonomy *parent;
+        void index_taxids(const vector<int> &);
+        void build_rmq(const vector<int> &);
+        int argmin_in_block(int, int) const;
+        int argmin(int, int) const;
+
+        int root;
+        flat_array<int> taxids;
+        flat_array<int> parents;
+        flat_array<int> depths;
+        flat_array<uint8_t> ranks;
+        flat_array<int> subtree_end;
+        flat_array<int> child_offsets;
+        flat_array<int> children;
+        /*taxid -> index lookup*/
+        flat_array<int> taxid_index;
+        flat_array<std::pair<int, int>> sorted_taxids;
+        /*Range minimum tables over the pre-order depths*/
+        flat_array<uint64_t> block_mask;
+        flat_array<int> sparse;
+        flat_array<uint64_t> sparse_offsets;
+        /*Mapped cache file backing the arrays (if loaded from one)*/
+        void *cache_data;
+        size_t cache_size;
 };
 
+/*Read nodes.dmp (or its cache); false if it cannot be opened*/
+bool construct_taxonomy(const string &, taxonomy *, bool);
+
+/*Suffix of the binary cache written next to nodes.dmp*/
+#define TAXONOMY_CACHE_SUFFIX ".bracken_cache"
+
+/*Taxid ranges larger than this (and sparse) use a sorted lookup table*/
+#define MAX_DIRECT_TAXID (1 << 26)
+
 /*Accessor Methods*/
 
-inline int taxonomy::get_taxid() const { return this->taxid; }
+inline int taxonomy::size() const {
+    return (int) this->taxids.size();
+}
+
+inline int taxonomy::get_root() const {
+    return this->root;
+}
 
-inline int taxonomy::get_lvl_num() const {
-    return this->lvl_num;
+/*Index of a taxid, or -1 if it is not in the taxonomy*/
+inline int taxonomy::get_index(int taxid) const {
+    if (!this->taxid_index.empty()) {
+        if (taxid < 0 || (size_t) taxid >= this->taxid_index.size())
+            return -1;
+        return this->taxid_index[taxid];
+    }
+    const std::pair<int, int> *begin = this->sorted_taxids.data();
+    const std::pair<int, int> *end = begin + this->sorted_taxids.size();
+    const std::pair<int, int> *it = std::lower_bound(begin, end, std::make_pair(taxid, -1));
+    if (it == end || it->first != taxid)
+        return -1;
+    return it->second;
 }
 
-inline string taxonomy::get_lvl_type() const {
-    return this->lvl_type;
+inline int taxonomy::get_taxid(int idx) const {
+    return this->taxids[idx];
 }
 
-inline taxonomy* taxonomy::get_parent() const{
-    return this->parent;
+inline int taxonomy::get_parent(int idx) const {
+    return this->parents[idx];
 }
 
-inline vector<taxonomy *> taxonomy::get_children() const {
-    return this->children;
+inline int taxonomy::get_depth(int idx) const {
+    return this->depths[idx];
 }
 
-/*Methods for manipulating the tree*/
-inline void taxonomy::add_parent(taxonomy *parent) {
-    this->parent = parent;
+inline taxon_rank taxonomy::get_rank(int idx) const {
+    return (taxon_rank) this->ranks[idx];
 }
 
-inline void taxonomy::add_child(taxonomy *new_child) {
-    this->children.push_back(new_child);
+inline const int* taxonomy::children_begin(int idx) const {
+    return this->children.data() + this->child_offsets[idx];
+}
+
+inline const int* taxonomy::children_end(int idx) const {
+    return this->children.data() + this->child_offsets[idx + 1];
+}
+
+/*Methods for comparisons*/
+
+/*Test whether a is b or an ancestor of b*/
+inline bool taxonomy::is_ancestor(int a, int b) const {
+    return a <= b && b <= this->subtree_end[a];
 }
 
-inline void taxonomy::set_lvl_num(int num) {
-    this->lvl_num = num;
+/*Find the lowest common ancestor of two nodes (-1 if they are in different trees)*/
+inline int taxonomy::get_lca(int a, int b) const {
+    if (a == b)
+        return a;
+    if (a > b)
+        std::swap(a, b);
+    if (b <= this->subtree_end[a])
+        return a;
+    return this->parents[argmin(a + 1, b)];
 }
 
 #endif
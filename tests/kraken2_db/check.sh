@@ -0,0 +1,78 @@
+#!/bin/bash
+
+#####################################################################
+#check.sh compares kmer2read_distr --kraken2-db with --kraken on a tiny database
+#Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+#
+#This file is part of Bracken.
+#
+#Bracken is free software; you can redistribute it and/or modify
+#it under the terms of the GNU General Public License as published by
+#the Free Software Foundation; either version 3 of the license, or
+#(at your option) any later version.
+#
+#This program is distributed in the hope that it will be useful,
+#but WITHOUT ANY WARRANTY; without even the implied warranty of
+#MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#GNU General Public License for more details
+#
+#You should have received a copy of the GNU General Public License
+#along with this program; if not, see <http://www.gnu.org/licenses/>.
+#
+#####################################################################
+#
+#For the revcom_version 1 and 0 databases written by make_fixture.py, the
+#--output and --distrib files of kmer2read_distr --kraken2-db/--library must be
+#identical to those of --kraken with the database's database.kraken.
+#If kraken2 is in the PATH, the kmer runs of its output for the library must
+#also match database.kraken.
+#
+#Usage: check.sh [KMER2READ_DISTR]
+#####################################################################
+
+set -u
+DIR=`dirname $(realpath $0 || echo $0)`
+KMER2READ=${1:-$DIR/../../src/kmer2read_distr}
+if [ ! -x "$KMER2READ" ]; then
+    echo "kmer2read_distr not found at $KMER2READ (run make in src/ first)"
+    exit 1
+fi
+TMP=`mktemp -d`
+trap 'rm -rf "$TMP"' EXIT
+
+READ_LENS="36,50,100,250"
+#kmer2read_distr refuses more threads than processors
+THREAD_COUNTS=1
+N_PROCS=`getconf _NPROCESSORS_ONLN 2> /dev/null || echo 1`
+if [ "$N_PROCS" -gt 1 ]; then
+    THREAD_COUNTS="1 $(( N_PROCS < 3 ? N_PROCS : 3 ))"
+fi
+FAILED=0
+for DB in revcom1 revcom0; do
+    OPTIONS=(--seqid2taxid $DIR/seqid2taxid.map --taxonomy $DIR/taxonomy --no-taxonomy-cache -k 35 -l $READ_LENS --ordered)
+    "$KMER2READ" "${OPTIONS[@]}" -t 1 --kraken $DIR/$DB/database.kraken \
+        --output $TMP/k36,$TMP/k50,$TMP/k100,$TMP/k250 --distrib $TMP/kd36,$TMP/kd50,$TMP/kd100,$TMP/kd250 > $TMP/log 2>&1 \
+        || { echo "FAILED $DB --kraken"; cat $TMP/log; FAILED=1; continue; }
+    for THREADS in $THREAD_COUNTS; do
+        "$KMER2READ" "${OPTIONS[@]}" -t $THREADS --kraken2-db $DIR/$DB --library $DIR/library/a.fna,$DIR/library/b.fna.gz \
+            --output $TMP/d36,$TMP/d50,$TMP/d100,$TMP/d250 --distrib $TMP/dd36,$TMP/dd50,$TMP/dd100,$TMP/dd250 > $TMP/log 2>&1 \
+            || { echo "FAILED $DB --kraken2-db -t $THREADS"; cat $TMP/log; FAILED=1; continue; }
+        for LEN in ${READ_LENS//,/ }; do
+            cmp -s $TMP/k$LEN $TMP/d$LEN || { echo "DIFFERENT $DB -t $THREADS: --output of read length $LEN"; FAILED=1; }
+            cmp -s $TMP/kd$LEN $TMP/dd$LEN || { echo "DIFFERENT $DB -t $THREADS: --distrib of read length $LEN"; FAILED=1; }
+        done
+    done
+    if hash kraken2 &> /dev/null; then
+        kraken2 --db $DIR/$DB --threads 1 $DIR/library/a.fna $DIR/library/b.fna.gz > $TMP/kraken2.out 2> $TMP/log \
+            || { echo "FAILED $DB kraken2"; cat $TMP/log; FAILED=1; continue; }
+        cut -f2,4,5 $TMP/kraken2.out > $TMP/kraken2.runs
+        cut -f2,4,5 $DIR/$DB/database.kraken | cmp -s - $TMP/kraken2.runs \
+            || { echo "DIFFERENT $DB: kraken2 output and database.kraken"; FAILED=1; }
+    else
+        echo "kraken2 not in the PATH: database.kraken of $DB not compared with kraken2"
+    fi
+done
+if [ $FAILED -eq 0 ]; then
+    echo "Kraken 2 database checks passed"
+fi
+exit $FAILED
@@ -0,0 +1,261 @@
+#! /usr/bin/env python3
+#####################################################################
+#make_fixture.py writes the tiny Kraken 2 database used by check.sh
+#Copyright (C) 2016-2023 Jennifer Lu, jlu26@jhmi.edu
+
+#This file is part of Bracken.
+
+#Bracken is free software; you can redistribute it and/or modify
+#it under the terms of the GNU General Public License as published by
+#the Free Software Foundation; either version 3 of the license, or
+#(at your option) any later version.
+
+#This program is distributed in the hope that it will be useful,
+#but WITHOUT ANY WARRANTY; without even the implied warranty of
+#MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#GNU General Public License for more details.
+
+#You should have received a copy of the GNU General Public License
+#along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+#####################################################################
+#
+#Writes, next to this script:
+#   - taxonomy/nodes.dmp, seqid2taxid.map and library/ (a.fna, b.fna.gz)
+#   - revcom1/ and revcom0/: opts.k2d, hash.k2d and taxo.k2d of the same
+#     library with revcom_version 1 and with the revcom_version 0 reverse
+#     complement of Kraken 2 databases built before v2.1
+#   - revcomN/database.kraken: the kraken2 output of the library against
+#     that database (classified, seqid, taxid, length, kmer runs)
+#
+#The library holds shared segments (runs of LCA taxa), N runs and IUPAC codes
+#(A: runs), lowercase bases, a duplicated genome, a sequence shorter than a
+#kmer, an all-N sequence and one that is not in the database.
+#
+#The database.kraken files are computed here with the Kraken 2 algorithm
+#(spaced-seed minimizers, compact hash lookup), not by running kraken2. When
+#kraken2 is installed, check.sh also compares them with its output.
+#
+#Usage: python3 make_fixture.py
+#####################################################################
+import gzip, os, random, struct
+
+OUT = os.path.dirname(os.path.abspath(__file__))
+K, L = 35, 31
+M64 = (1 << 64) - 1
+LMASK = (1 << (2 * L)) - 1
+#Default Kraken 2 spaced seed: every other base of the last 14 is masked
+SPACED_SEED = 0
+for pos in range(L):
+    if not (pos % 2 == 1 and pos < 14):
+        SPACED_SEED |= 3 << (2 * pos)
+TOGGLE_MASK = 0xe37e28c4271b5a2d
+CODE = {"A": 0, "C": 1, "G": 2, "T": 3}
+
+#Taxonomy: (taxid, parent, rank)
+NODES = [
+    (1, 1, "no rank"), (2, 1, "superkingdom"), (10, 2, "phylum"),
+    (100, 10, "genus"), (1001, 100, "species"), (1002, 100, "species"),
+    (10011, 1001, "strain"), (10012, 1001, "strain"),
+    (200, 10, "genus"), (2001, 200, "species"), (2002, 200, "species"),
+    (20, 2, "phylum"), (300, 20, "genus"), (3001, 300, "species"),
+    (3002, 300, "species"), (30021, 3002, "strain"),
+]
+PARENT = dict((t, p) for t, p, r in NODES)
+GENOME_TAXA = [10011, 10012, 1002, 2001, 2002, 3001, 30021]
+
+def lineage(t):
+    path = [t]
+    while t != 1:
+        t = PARENT[t]
+        path.append(t)
+    return path
+
+def lca(a, b):
+    if a == 0:
+        return b
+    if b == 0:
+        return a
+    pa = set(lineage(a))
+    for t in lineage(b):
+        if t in pa:
+            return t
+    return 1
+
+def random_seq(rng, n):
+    return "".join(rng.choice("ACGT") for _ in range(n))
+
+def make_records(rng):
+    shared = [random_seq(rng, 400) for _ in range(3)]
+    records = []
+    for i, t in enumerate(GENOME_TAXA):
+        n = rng.randint(1500, 2500)
+        parts = []
+        while sum(map(len, parts)) < n:
+            r = rng.random()
+            if r < 0.15:
+                parts.append(rng.choice(shared))
+            elif r < 0.22:
+                parts.append("N" * rng.randint(1, 40))
+            elif r < 0.3:
+                parts.append(random_seq(rng, rng.randint(10, 150)).lower())
+            elif r < 0.34:
+                parts.append(rng.choice("RYKM"))
+            else:
+                parts.append(random_seq(rng, rng.randint(50, 400)))
+        records.append(("g%d|kraken:taxid|%d" % (i, t), t, "".join(parts)))
+    records.append(("dup1", GENOME_TAXA[2], records[2][2]))
+    records.append(("short1", GENOME_TAXA[3], random_seq(rng, 20)))
+    records.append(("nseq", GENOME_TAXA[4], "N" * 100))
+    records.append(("nomap", GENOME_TAXA[5], random_seq(rng, 300)))
+    return records
+
+def revcomp(x, revcom_version):
+    if revcom_version == 0:
+        #Complement of the 2-bit groups of all 64 bits reversed, masked to L
+        r = 0
+        for i in range(32):
+            r |= ((x >> (2 * i)) & 3) << (2 * (31 - i))
+        return (~r) & LMASK
+    r = 0
+    for i in range(L):
+        r = (r << 2) | (3 - ((x >> (2 * i)) & 3))
+    return r
+
+def murmur(k):
+    k ^= k >> 33
+    k = (k * 0xff51afd7ed558ccd) & M64
+    k ^= k >> 33
+    k = (k * 0xc4ceb9fe1a85ec53) & M64
+    k ^= k >> 33
+    return k
+
+def minimizers(seq, revcom_version):
+    """Minimizer of every kmer (None if the kmer holds a non-ACGT base)"""
+    lmers = []
+    for i in range(len(seq) - L + 1):
+        s = seq[i:i + L].upper()
+        if any(c not in CODE for c in s):
+            lmers.append(None)
+            continue
+        v = 0
+        for c in s:
+            v = (v << 2) | CODE[c]
+        v = min(v, revcomp(v, revcom_version))
+        lmers.append((v & SPACED_SEED) ^ (TOGGLE_MASK & LMASK))
+    res = []
+    for i in range(len(seq) - K + 1):
+        w = lmers[i:i + K - L + 1]
+        res.append(None if None in w else min(w) ^ (TOGGLE_MASK & LMASK))
+    return res
+
+def write_database(records, revcom_version):
+    out = os.path.join(OUT, "revcom%d" % revcom_version)
+    if not os.path.isdir(out):
+        os.makedirs(out)
+    mins = [minimizers(seq, revcom_version) for sid, t, seq in records]
+    table = {}
+    for (sid, t, seq), ms in zip(records, mins):
+        if sid == "nomap":
+            continue
+        for m in ms:
+            if m is not None:
+                table[m] = lca(table.get(m, 0), t)
+    #Internal taxids in breadth-first order (parents before children), 0 unused
+    ext_ids = [0, 1]
+    i = 1
+    while i < len(ext_ids):
+        ext_ids.extend(sorted(t for t, p, r in NODES if p == ext_ids[i] and t != ext_ids[i]))
+        i += 1
+    internal = dict((e, i) for i, e in enumerate(ext_ids))
+    value_bits = 1
+    while (1 << value_bits) <= len(ext_ids):
+        value_bits += 1
+    capacity = 2 * len(table) + 1
+    cells = [0] * capacity
+    def probe(m):
+        hc = murmur(m)
+        idx = hc % capacity
+        while cells[idx] != 0 and (cells[idx] >> value_bits) != hc >> (32 + value_bits):
+            idx = (idx + 1) % capacity
+        return idx, hc >> (32 + value_bits)
+    n_cells = 0
+    for m in sorted(table):
+        idx, key = probe(m)
+        t = table[m]
+        if cells[idx] != 0:
+            #Same compacted key: the cell holds the LCA of both
+            t = lca(ext_ids[cells[idx] & ((1 << value_bits) - 1)], t)
+        else:
+            n_cells += 1
+        cells[idx] = (key << value_bits) | internal[t]
+    def lookup(m):
+        idx, key = probe(m)
+        return ext_ids[cells[idx] & ((1 << value_bits) - 1)] if cells[idx] != 0 else 0
+    with open(os.path.join(out, "hash.k2d"), "wb") as f:
+        f.write(struct.pack("<QQQQ", capacity, n_cells, 32 - value_bits, value_bits))
+        f.write(struct.pack("<%dI" % capacity, *cells))
+    #k, l, spaced seed mask, toggle mask, dna_db, minimum hash, revcom version,
+    #db version, db type
+    with open(os.path.join(out, "opts.k2d"), "wb") as f:
+        f.write(struct.pack("<QQQQ?7xQiii4x", K, L, SPACED_SEED, TOGGLE_MASK, True, 0, revcom_version, 0, 0))
+    ranks = dict((t, r) for t, p, r in NODES)
+    rank_names = sorted(set(ranks.values()))
+    rank_data = b"".join(r.encode() + b"\0" for r in rank_names)
+    rank_offsets = dict((r, len(b"".join(x.encode() + b"\0" for x in rank_names[:i]))) for i, r in enumerate(rank_names))
+    name_data = b""
+    nodes = b""
+    for i, e in enumerate(ext_ids):
+        children = [internal[t] for t, p, r in NODES if p == e and t != e]
+        parent = internal[PARENT[e]] if e > 1 else 0
+        rank = rank_offsets[ranks[e]] if e > 0 else rank_offsets["no rank"]
+        nodes += struct.pack("<7Q", parent, min(children) if children else 0, len(children),
+            len(name_data), rank, e, 0)
+        name_data += b"taxon %d\0" % e
+    with open(os.path.join(out, "taxo.k2d"), "wb") as f:
+        f.write(b"K2TAXDAT" + struct.pack("<QQQ", len(ext_ids), len(name_data), len(rank_data)))
+        f.write(nodes + name_data + rank_data)
+    with open(os.path.join(out, "database.kraken"), "w") as f:
+        for (sid, t, seq), ms in zip(records, mins):
+            runs = []
+            for m in ms:
+                label = "A" if m is None else str(lookup(m))
+                if runs and runs[-1][0] == label:
+                    runs[-1][1] += 1
+                else:
+                    runs.append([label, 1])
+            hits = " ".join("%s:%d" % (a, b) for a, b in runs) if runs else "0:0"
+            f.write("C\t%s\t%d\t%d\t%s\n" % (sid, t, len(seq), hits))
+
+def fasta(records):
+    lines = []
+    for sid, t, seq in records:
+        lines.append(">%s description\n" % sid)
+        for i in range(0, len(seq), 70):
+            lines.append(seq[i:i + 70] + "\n")
+    return "".join(lines)
+
+def main():
+    records = make_records(random.Random(7))
+    for d in ("taxonomy", "library"):
+        if not os.path.isdir(os.path.join(OUT, d)):
+            os.makedirs(os.path.join(OUT, d))
+    with open(os.path.join(OUT, "taxonomy", "nodes.dmp"), "w") as f:
+        for t, p, r in NODES:
+            f.write("%d\t|\t%d\t|\t%s\t|\t\t|\n" % (t, p, r))
+    with open(os.path.join(OUT, "seqid2taxid.map"), "w") as f:
+        for sid, t, seq in records:
+            if sid != "nomap":
+                f.write("%s\t%d\n" % (sid, t))
+    half = len(records) // 2
+    with open(os.path.join(OUT, "library", "a.fna"), "w") as f:
+        f.write(fasta(records[:half]))
+    #mtime 0 keeps the gzip file identical between runs
+    with open(os.path.join(OUT, "library", "b.fna.gz"), "wb") as raw:
+        with gzip.GzipFile(filename="", fileobj=raw, mode="wb", mtime=0) as f:
+            f.write(fasta(records[half:]).encode())
+    for revcom_version in (1, 0):
+        write_database(records, revcom_version)
+
+if __name__ == "__main__":
+    main()